@@ -19,6 +19,169 @@ typedef struct p6psg {
     char last_error[P6PSG_LAST_ERROR_MAXLEN];
 } p6psg_t;
 
+/* 最大ネスト段数 (ドライバのネストカウンタは 4 段まで) */
+#define P6PSG_NEST_MAX 4
+
+/*
+ * コマンドのオペランドバイト数を返す (-1: 未定義コマンド)
+ *  p[0] がコマンドコード、S コマンドだけは p[1] (第1パラメータ) で長さが変わる
+ */
+static int
+p6psg_operand_len(const uint8_t *p, size_t remain)
+{
+    uint8_t code = p[0];
+
+    if ((code & 0x80u) == 0) {
+        /* 音符: bit5..4 が音長フラグ */
+        switch (code & 0x30u) {
+        case 0x20u:
+            return 1;
+        case 0x30u:
+            return 2;
+        default:
+            return 0;
+        }
+    }
+    if (code < 0xc0u) {
+        /* o, v, v+, v- */
+        return 0;
+    }
+    switch (code) {
+    case 0xea:                      /* S */
+        if (remain < 2)
+            return 1;
+        return (p[1] != 0) ? 5 : 1;
+    case 0xeb: case 0xec:           /* W, W+/- */
+    case 0xf0: case 0xf1:           /* [, ] (1バイト) */
+    case 0xf4:                      /* I */
+    case 0xf7: case 0xf9: case 0xfa:/* L+, L, Q */
+    case 0xfb: case 0xfc: case 0xfd:/* U%, U+/-, M% */
+        return 1;
+    case 0xf2: case 0xf3:           /* ] (2バイト), : */
+    case 0xf8:                      /* T */
+        return 2;
+    case 0xf5:                      /* M */
+        return 4;
+    case 0xed: case 0xee: case 0xef:/* P1〜P3 */
+    case 0xf6:                      /* N */
+    case 0xfe: case 0xff:           /* J, エンドマーク */
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * 1チャンネル分の演奏データ検証
+ *  ロード時に 1 回だけ全コマンドを走査して、ドライバが実行時に
+ *  チェックなしで解釈できることを保証する。
+ *  - 全オペランドがチャンネルデータ内に収まること
+ *  - 未定義コマンドが無いこと
+ *  - [ ] のネストが対応していて 4 段以内、] のジャンプ先が対応する [ の直後、
+ *    : がループ内にあってジャンプ先が対応する ] の直後であること
+ *  - J はネスト外に高々 1 個で、J 以降に毎周必ず実行される音符があること
+ *    (ループ内で : より後ろの音符は最後の回に飛ばされるので数えない。
+ *     J [1 : c ] のように J から先が空回りするとドライバが止まらない)
+ *  - エンドマークはネスト外のデータ末尾にだけあること
+ */
+static int
+p6psg_verify_channel(p6psg_t *psg, int ch, const uint8_t *data, size_t len)
+{
+    uint32_t loop_top[P6PSG_NEST_MAX];  /* [ の直後のオフセット */
+    uint32_t loop_exit[P6PSG_NEST_MAX]; /* : のジャンプ先 (0: : 無し) */
+    int depth = 0;
+    int j_seen = 0;
+    int note_after_j = 0;           /* J 以降に毎周実行される音符あり */
+    size_t off = 0;
+
+#define VERIFY_FAIL(...)                                                \
+    do {                                                                \
+        int n_ = snprintf(psg->last_error, P6PSG_LAST_ERROR_MAXLEN,     \
+          "ch %c: offset 0x%04zx: ", 'A' + ch, start);                  \
+        if (n_ > 0 && n_ < P6PSG_LAST_ERROR_MAXLEN)                     \
+            snprintf(psg->last_error + n_,                              \
+              P6PSG_LAST_ERROR_MAXLEN - n_, __VA_ARGS__);               \
+        return 0;                                                       \
+    } while (0)
+
+    while (off < len) {
+        size_t start = off;
+        uint8_t code = data[off];
+        int olen = p6psg_operand_len(&data[off], len - off);
+        if (olen < 0)
+            VERIFY_FAIL("unknown command %02x", code);
+        if (olen > 0 && len - off - 1 < (size_t)olen)
+            VERIFY_FAIL("truncated operand of %02x", code);
+        const uint8_t *p = &data[off + 1];
+        off += 1 + olen;
+
+        uint32_t target;
+        switch (code) {
+        case 0xf0:                  /* [ */
+            if (depth >= P6PSG_NEST_MAX)
+                VERIFY_FAIL("nest too deep");
+            loop_top[depth] = (uint32_t)off;
+            loop_exit[depth] = 0;
+            depth++;
+            break;
+        case 0xf1:                  /* ] (1バイト) */
+        case 0xf2:                  /* ] (2バイト) */
+            if (depth == 0)
+                VERIFY_FAIL("']' without '['");
+            if (code == 0xf1)
+                target = (uint32_t)(off + (0xff00u | p[0])) & 0xffffu;
+            else
+                target = (uint32_t)(off + (p[0] | (p[1] << 8))) & 0xffffu;
+            if (target != loop_top[depth - 1])
+                VERIFY_FAIL("']' jumps to 0x%04x, not to its '['", target);
+            if (loop_exit[depth - 1] != 0 && loop_exit[depth - 1] != off)
+                VERIFY_FAIL("':' does not jump past its ']'");
+            depth--;
+            break;
+        case 0xf3:                  /* : */
+            if (depth == 0)
+                VERIFY_FAIL("':' outside of '[ ]'");
+            target = (uint32_t)(off + (p[0] | (p[1] << 8))) & 0xffffu;
+            if (target <= off ||
+                (loop_exit[depth - 1] != 0 && loop_exit[depth - 1] != target))
+                VERIFY_FAIL("bad ':' jump to 0x%04x", target);
+            loop_exit[depth - 1] = target;
+            break;
+        case 0xfe:                  /* J */
+            if (depth != 0)
+                VERIFY_FAIL("'J' inside '[ ]'");
+            if (j_seen)
+                VERIFY_FAIL("multiple 'J'");
+            j_seen = 1;
+            break;
+        case 0xff:                  /* エンドマーク */
+            if (off != len)
+                VERIFY_FAIL("end mark before end of data");
+            if (depth != 0)
+                VERIFY_FAIL("unterminated '['");
+            if (j_seen && !note_after_j)
+                VERIFY_FAIL("no note after 'J'");
+            return 1;
+        default:
+            if ((code & 0x80u) == 0 && j_seen) {
+                /* 囲むループのどれかで : を過ぎていれば飛ばされることがある */
+                int d = 0;
+
+                while (d < depth && loop_exit[d] == 0)
+                    d++;
+                if (d == depth)
+                    note_after_j = 1;
+            }
+            break;
+        }
+    }
+#undef VERIFY_FAIL
+
+    snprintf(psg->last_error, P6PSG_LAST_ERROR_MAXLEN,
+      "ch %c: invalid data (no end mark)", 'A' + ch);
+    return 0;
+}
+
 /* オブジェクト生成 */
 p6psg_t *
 p6psg_create(void)
@@ -144,6 +307,11 @@ p6psg_load(p6psg_t *psg, const char *path, p6psg_channel_dataset_t *channels)
           "invalid data (no end mark)");
         goto fail;
     }
+    if (!p6psg_verify_channel(psg, P6PSG_CH_A, &buf[a_addr], a_size) ||
+        !p6psg_verify_channel(psg, P6PSG_CH_B, &buf[b_addr], b_size) ||
+        !p6psg_verify_channel(psg, P6PSG_CH_C, &buf[c_addr], c_size)) {
+        goto fail;
+    }
     channels_tmp.ch[P6PSG_CH_A].ptr = &buf[a_addr];
     channels_tmp.ch[P6PSG_CH_A].len = a_size;
     channels_tmp.ch[P6PSG_CH_B].ptr = &buf[b_addr];
@@ -3,6 +3,10 @@
  *  For PSG Player demonstration on Raspberry Pi at Open Source Conference
  */
 
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -15,6 +19,7 @@
 #include <wchar.h>
 #include <locale.h>
 #include <termios.h>
+#include <time.h>
 
 #include "player_ui.h"
 #include "ym2149f.h"
@@ -212,16 +217,16 @@ ui_draw_red_segs_from_template(UI_state *ui,
 }
 
 static void
-ui_update_mixer(UI_state *ui)
+ui_update_mixer(UI_model *md)
 {
-    uint8_t m = ui->reg[AY_ENABLE];
+    uint8_t m = md->reg[AY_ENABLE];
     /* bit=1 disables */
-    ui->tone_enable[0]  = ((m & 0x01) == 0);
-    ui->tone_enable[1]  = ((m & 0x02) == 0);
-    ui->tone_enable[2]  = ((m & 0x04) == 0);
-    ui->noise_enable[0] = ((m & 0x08) == 0);
-    ui->noise_enable[1] = ((m & 0x10) == 0);
-    ui->noise_enable[2] = ((m & 0x20) == 0);
+    md->tone_enable[0]  = ((m & 0x01) == 0);
+    md->tone_enable[1]  = ((m & 0x02) == 0);
+    md->tone_enable[2]  = ((m & 0x04) == 0);
+    md->noise_enable[0] = ((m & 0x08) == 0);
+    md->noise_enable[1] = ((m & 0x10) == 0);
+    md->noise_enable[2] = ((m & 0x20) == 0);
 }
 
 static void
@@ -553,13 +558,13 @@ static void
 put_reg_if_changed(UI_state *ui, int row0, int col0, int regno)
 {
     /* 変化なければ更新不要 */
-    if (ui->cache_reg[regno] == ui->reg[regno])
+    if (ui->cache_reg[regno] == ui->m.reg[regno])
         return;
     char buf[4];
-    fmt_hex2h_fixed(buf, ui->reg[regno]);
+    fmt_hex2h_fixed(buf, ui->m.reg[regno]);
     ui_out_printf(ui, "\033[%d;%dH", row0 + 1, col0 + 1);
     ui_out_append(ui, buf, 3);
-    ui->cache_reg[regno] = ui->reg[regno];
+    ui->cache_reg[regno] = ui->m.reg[regno];
 }
 
 /* 描画キャッシュデータクリア */
@@ -584,7 +589,7 @@ ui_cache_clear(UI_state *ui)
 }
 
 /*
- * Required UI_state fields (already in your earlier UI_state):
+ * Draws from ui->m (a UI_model copied from live or pub):
  * - mus[3] : contains octave/note/volume/len/is_rest/t_ns
  * - reg[16]  : register shadow updated in ui_on_reg_write()
  * - tone_enable[3], noise_enable[3] : from mixer (r7)
@@ -597,9 +602,9 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
 {
     ui_out_reset(ui);
 
-    if (ui->redraw) {
+    if (ui->m.redraw_seq != ui->redraw_seen) {
         ui_cache_clear(ui);
-        ui->redraw = 0;
+        ui->redraw_seen = ui->m.redraw_seq;
     }
 
     if (!ui->template_drawn)
@@ -622,8 +627,26 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
          * 「日本語が出せる」「途中で切っても文字化けしない」
          * という仕様まで。
          */
-        utf8_fit_cols(fitted, sizeof(fitted),
-            (title ? title : "(no title)"), UI_W_TITLE);
+        char len_str[24];
+        int len_cols = 0;
+
+        /* 曲長が分かっていればタイトル欄の右端に " [イントロ+ループ]" */
+        if (ui->m.intro_ns != 0 || ui->m.loop_ns != 0) {
+            unsigned int is = (unsigned int)(ui->m.intro_ns / 1000000000ull);
+            unsigned int ls = (unsigned int)(ui->m.loop_ns / 1000000000ull);
+            if (ui->m.loop_ns != 0)
+                len_cols = snprintf(len_str, sizeof(len_str),
+                    " [%u:%02u+%u:%02u]", is / 60, is % 60, ls / 60, ls % 60);
+            else
+                len_cols = snprintf(len_str, sizeof(len_str),
+                    " [%u:%02u]", is / 60, is % 60);
+            if (len_cols < 0 || len_cols >= UI_W_TITLE / 2)
+                len_cols = 0;
+        }
+        utf8_fit_cols(fitted, sizeof(fitted) - len_cols,
+            (title ? title : "(no title)"), UI_W_TITLE - len_cols);
+        if (len_cols > 0)
+            strcat(fitted, len_str);
 
         size_t cur_len = strlen(fitted);
         size_t old_len = strlen(ui->cache_title);
@@ -644,13 +667,13 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
     /* 2) bpm and time */
     {
         char bpm_fixed[UI_W_BPM + 1];
-        double bpm = ui->bpm_x10 / 10.0;
+        double bpm = ui->m.bpm_x10 / 10.0;
         fmt_f1_fixed(bpm_fixed, UI_W_BPM, bpm);
         ui_put_fixed_if_changed(ui, ROW_TITLE, COL_TEMPO, UI_W_BPM, bpm_fixed,
           ui->cache_bpm);
 
         char tsec_fixed[UI_W_TSEC + 1];
-        double tsec = (double)(now_ns - ui->start_ns) / 1e9;
+        double tsec = (double)(now_ns - ui->m.start_ns) / 1e9;
         fmt_f1_fixed(tsec_fixed, UI_W_TSEC, tsec);
         ui_put_fixed_if_changed(ui, ROW_TITLE, COL_TSEC, UI_W_TSEC, tsec_fixed,
           ui->cache_tsec);
@@ -663,14 +686,14 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
 
         /* 「トーン無しノイズのみ」の判定用 */
         int noise_only =
-          (ui->tone_enable[ch] == 0) && (ui->noise_enable[ch] != 0);
+          (ui->m.tone_enable[ch] == 0) && (ui->m.noise_enable[ch] != 0);
 
         /* NOTE */
         {
             char note_tmp[UI_W_NOTE + 1];
-            make_note_ascii(note_tmp, ui->mus[ch].octave, ui->mus[ch].note,
-              ui->mus[ch].is_rest);
-            if (noise_only && (ui->mus[ch].volume != 0)) {
+            make_note_ascii(note_tmp, ui->m.mus[ch].octave, ui->m.mus[ch].note,
+              ui->m.mus[ch].is_rest);
+            if (noise_only && (ui->m.mus[ch].volume != 0)) {
                 /* ノイズのみの時はMMLのノートは意味がないので別表示にする */
                 strcpy(note_tmp, "NOI");
             }
@@ -683,13 +706,13 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
         /* Hz from register shadow (period) */
         {
             uint16_t period =
-                (uint16_t)ui->reg[AY_AFINE + ch * 2] |
-                ((uint16_t)(ui->reg[AY_ACOARSE + ch * 2] & 0x0f) << 8);
+                (uint16_t)ui->m.reg[AY_AFINE + ch * 2] |
+                ((uint16_t)(ui->m.reg[AY_ACOARSE + ch * 2] & 0x0f) << 8);
 
             char hz_fixed[UI_W_HZ + 1];
-            if (ui->mus[ch].is_rest ||
-                ui->mus[ch].note == 0 ||
-                ui->mus[ch].volume == 0 ||
+            if (ui->m.mus[ch].is_rest ||
+                ui->m.mus[ch].note == 0 ||
+                ui->m.mus[ch].volume == 0 ||
                 period == 0 ||
                 noise_only) {
                 fmt_pad(hz_fixed, UI_W_HZ, " -----");
@@ -707,7 +730,7 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
         /* VOL number */
         {
             char vol_fixed[UI_W_VOLN + 1];
-            fmt_u_fixed(vol_fixed, UI_W_VOLN, ui->mus[ch].volume & 0x0f);
+            fmt_u_fixed(vol_fixed, UI_W_VOLN, ui->m.mus[ch].volume & 0x0f);
             ui_put_fixed_if_changed(ui, row, COL_VOLN, UI_W_VOLN, vol_fixed,
               ui->cache_voln[ch]);
         }
@@ -716,15 +739,15 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
         {
             char bar_fixed[UI_W_BAR + 1];
             fmt_vol_bar_fixed(bar_fixed, UI_W_BAR,
-              ui->mus[ch].volume & 0x0f, ui->reg[AY_AVOL + ch] & 0x0f);
+              ui->m.mus[ch].volume & 0x0f, ui->m.reg[AY_AVOL + ch] & 0x0f);
             ui_put_fixed_if_changed(ui, row, COL_BAR, UI_W_BAR, bar_fixed,
               ui->cache_bar[ch]);
         }
 
         /* TONE / NOISE fixed ("ON " or "OFF") */
         {
-            const char *tone_s  = ui->tone_enable[ch]  ? "ON " : "OFF";
-            const char *noise_s = ui->noise_enable[ch] ? "ON " : "OFF";
+            const char *tone_s  = ui->m.tone_enable[ch]  ? "ON " : "OFF";
+            const char *noise_s = ui->m.noise_enable[ch] ? "ON " : "OFF";
             ui_put_fixed_if_changed(ui, row, COL_TONE,  3, tone_s,
               ui->cache_tone[ch]);
             ui_put_fixed_if_changed(ui, row, COL_NOISE, 3, noise_s,
@@ -733,17 +756,17 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
 
         /* piano marker: only if audible-ish, else clear */
         {
-            int audible = ui->mus[ch].is_rest == 0 &&
-                          ui->mus[ch].note != 0 &&
-                          ui->mus[ch].volume != 0;
+            int audible = ui->m.mus[ch].is_rest == 0 &&
+                          ui->m.mus[ch].note != 0 &&
+                          ui->m.mus[ch].volume != 0;
             int want = audible;
 
             int x = -1;
             if (want) {
                 if (noise_only) {
-                    x = piano_plot_col_noise(ui->noise_period);
+                    x = piano_plot_col_noise(ui->m.noise_period);
                 } else {
-                    x = piano_plot_col(ui->mus[ch].octave, ui->mus[ch].note);
+                    x = piano_plot_col(ui->m.mus[ch].octave, ui->m.mus[ch].note);
                 }
                 if (x < 0)
                     want = 0;
@@ -757,7 +780,7 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
     /* 4) registers display (xxh fields) */
     {
         if (!ui->cache_reg_valid) {
-            memcpy(ui->cache_reg, ui->reg, sizeof(ui->cache_reg));
+            memcpy(ui->cache_reg, ui->m.reg, sizeof(ui->cache_reg));
             ui->cache_reg_valid = 1;
             /* force a write on first render after init */
             for (int i = 0; i < 16; i++)
@@ -789,13 +812,15 @@ ui_render(UI_state *ui, uint64_t now_ns, const char *title)
 void
 ui_on_reg_write(UI_state *ui, uint8_t reg, uint8_t val)
 {
+    UI_model *md = &ui->live;
+
     reg &= 0x0f;
-    ui->reg[reg] = val;
+    md->reg[reg] = val;
 
     if (reg == AY_NOISEPER) {
-        ui->noise_period = ui->reg[AY_NOISEPER] & 0x1f;
+        md->noise_period = md->reg[AY_NOISEPER] & 0x1f;
     } else if (reg == AY_ENABLE) {
-        ui_update_mixer(ui);
+        ui_update_mixer(md);
     }
 }
 
@@ -807,7 +832,7 @@ ui_on_note_event(UI_state *ui, uint64_t now_ns, int ch,
 {
     if (ch < 0 || ch >= 3)
         return;
-    UI_music_ch *m = &ui->mus[ch];
+    UI_music_ch *m = &ui->live.mus[ch];
     m->t_ns   = now_ns;
     m->octave = octave;
     m->note   = note;
@@ -815,18 +840,90 @@ ui_on_note_event(UI_state *ui, uint64_t now_ns, int ch,
     m->len    = len;
     m->is_rest = is_rest ? 1 : 0;
 
-    ui->bpm_x10 = bpm_x10;
+    ui->live.bpm_x10 = bpm_x10;
+}
+
+/* seqlock: the player is the only writer of pub, the UI thread reads it */
+static void
+ui_publish(UI_state *ui)
+{
+    uint32_t seq = atomic_load_explicit(&ui->pub_seq, memory_order_relaxed);
+
+    atomic_store_explicit(&ui->pub_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    ui->pub = ui->live;
+    atomic_store_explicit(&ui->pub_seq, seq + 2, memory_order_release);
+}
+
+static void
+ui_snapshot(UI_state *ui)
+{
+    for (;;) {
+        uint32_t seq = atomic_load_explicit(&ui->pub_seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        ui->m = ui->pub;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&ui->pub_seq, memory_order_relaxed) == seq)
+            return;
+    }
+}
+
+static void
+ui_sleep_until_ns(uint64_t t)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(t / 1000000000ull);
+    ts.tv_nsec = (long)(t % 1000000000ull);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        continue;
+}
+
+static uint64_t
+ui_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *
+ui_thread(void *arg)
+{
+    UI_state *ui = arg;
+
+    /* the write(2) that has to wait for wsdisplay now waits here */
+    ui_draw_template_once(ui);
+
+    uint64_t next = ui_now_ns();
+    while (atomic_load_explicit(&ui->thread_running, memory_order_acquire)) {
+        next += ui->ui_period_ns;
+        uint64_t now = ui_now_ns();
+        if (next < now)
+            next = now;     /* console was slow; skip the missed frames */
+        ui_sleep_until_ns(next);
+
+        ui_snapshot(ui);
+        ui_render(ui, ui_now_ns(), ui->title);
+    }
+    return NULL;
 }
 
 /* ANSI UI init/shutdown/render entry points */
 
-void
-ui_init(UI_state *ui, uint64_t now_ns)
+static void
+ui_setup(UI_state *ui, uint64_t now_ns)
 {
     memset(ui, 0, sizeof(*ui));
     ui->ui_period_ns = 33333333ull; /* 33.3ms (30 fps) */
-    ui->start_ns     = now_ns;
+    ui->live.start_ns = now_ns;
     ui->next_ui_ns   = now_ns + ui->ui_period_ns;
+    atomic_init(&ui->pub_seq, 0);
+    atomic_init(&ui->thread_running, 0);
 
     /* caches: mark as invalid */
     ui_cache_clear(ui);
@@ -839,6 +936,12 @@ ui_init(UI_state *ui, uint64_t now_ns)
 
     /* 曲タイトル UTF-8 表示用の utf8_fit_cols() で必要 */
     setlocale(LC_CTYPE, "");
+}
+
+void
+ui_init(UI_state *ui, uint64_t now_ns)
+{
+    ui_setup(ui, now_ns);
 
     /* draw template now (once) */
     ui_draw_template_once(ui);
@@ -854,12 +957,61 @@ ui_init(UI_state *ui, uint64_t now_ns)
     ui->initialized = 1;
 }
 
+int
+ui_init_thread(UI_state *ui, uint64_t now_ns, const char *title)
+{
+    pthread_attr_t attr;
+    struct sched_param sp;
+    int policy, error;
+
+    ui_setup(ui, now_ns);
+    ui->initialized = 1;
+    ui->title = title;
+    ui_publish(ui);
+
+    /*
+     * 描画スレッドは演奏側が SCHED_FIFO (-R) でも通常優先度で動かす
+     * (作成元のポリシーを継承させない)
+     */
+    if ((error = pthread_attr_init(&attr)) != 0)
+        return 0;
+    if (pthread_getschedparam(pthread_self(), &policy, &sp) == 0 &&
+        policy != SCHED_OTHER) {
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = sched_get_priority_min(SCHED_OTHER);
+        error = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        if (error == 0)
+            error = pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+        if (error == 0)
+            error = pthread_attr_setschedparam(&attr, &sp);
+    }
+    if (error == 0) {
+        atomic_store(&ui->thread_running, 1);
+        error = pthread_create(&ui->thread, &attr, ui_thread, ui);
+        if (error != 0)
+            atomic_store(&ui->thread_running, 0);
+    }
+    pthread_attr_destroy(&attr);
+    if (error != 0)
+        return 0;
+
+    ui->threaded = 1;
+    return 1;
+}
+
 void
 ui_shutdown(UI_state *ui)
 {
     if (ui == NULL || ui->initialized == 0)
         return;
 
+    if (ui->threaded) {
+        /* the frame in progress is finished first */
+        atomic_store_explicit(&ui->thread_running, 0, memory_order_release);
+        pthread_join(ui->thread, NULL);
+        ui->threaded = 0;
+    }
+
     /* leave alternate screen */
     fputs("\033[?1049l", stdout);
 
@@ -875,17 +1027,51 @@ ui_shutdown(UI_state *ui)
 void
 ui_maybe_render(UI_state *ui, uint64_t now_ns, const char *title)
 {
+    if (ui->threaded) {
+        /* the UI thread keeps its own frame clock; hand over every update */
+        ui_publish(ui);
+        if (now_ns >= ui->next_ui_ns)
+            ui->next_ui_ns = now_ns + ui->ui_period_ns;
+        return;
+    }
     if (now_ns < ui->next_ui_ns)
         return;
+    ui->m = ui->live;
     ui_render(ui, now_ns, title);
     ui->next_ui_ns = now_ns + ui->ui_period_ns;
 }
 
+uint64_t
+ui_next_render_ns(const UI_state *ui)
+{
+    return ui->next_ui_ns;
+}
+
+void
+ui_set_song_length(UI_state *ui, uint64_t intro_ns, uint64_t loop_ns)
+{
+    if (ui == NULL)
+        return;
+
+    ui->live.intro_ns = intro_ns;
+    ui->live.loop_ns = loop_ns;
+    ui->live.redraw_seq++;
+}
+
+void
+ui_set_position(UI_state *ui, uint64_t now_ns, uint64_t pos_ns)
+{
+    if (ui == NULL)
+        return;
+
+    ui->live.start_ns = now_ns - pos_ns;
+}
+
 void
 ui_request_redraw(UI_state *ui)
 {
     if (ui == NULL)
         return;
 
-    ui->redraw = 1;
+    ui->live.redraw_seq++;
 }
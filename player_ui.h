@@ -4,6 +4,8 @@
  */
 
 #include <termios.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -34,6 +36,7 @@ typedef struct {
     uint8_t is_rest;   /* current note is rest */
 } UI_music_ch;
 
+/* what the screen shows; written by the player, drawn by ui_render() */
 typedef struct {
     /* music state per channel (from driver) */
     UI_music_ch mus[3];
@@ -47,11 +50,41 @@ typedef struct {
     uint8_t tone_enable[3];    /* from reg[7] */
     uint8_t noise_enable[3];   /* from reg[7] */
 
-    /* ui timing */
+    /* song length from the analyzer (0: unknown) */
+    uint64_t intro_ns;
+    uint64_t loop_ns;
+
+    /* elapsed time origin */
     uint64_t start_ns;
+
+    /* bumped on each redraw request */
+    uint32_t redraw_seq;
+} UI_model;
+
+typedef struct {
+    /* updated by the player (callbacks and setters below) */
+    UI_model live;
+
+    /* the copy being drawn */
+    UI_model m;
+    uint32_t redraw_seen;
+
+    /* ui timing */
     uint64_t next_ui_ns;
     uint64_t ui_period_ns;
 
+    /*
+     * ui_init_thread(): a rendering thread draws from pub, which the
+     * player copies live into under a seqlock (pub_seq odd while it
+     * is written), so a slow console never holds up the player.
+     */
+    UI_model pub;
+    _Alignas(64) _Atomic uint32_t pub_seq;
+    _Alignas(64) _Atomic int thread_running;
+    int threaded;
+    pthread_t thread;
+    const char *title;
+
     int initialized;
 
     /* screen output buffer */
@@ -65,7 +98,6 @@ typedef struct {
 
     /* --- incremental field caches --- */
     int template_drawn;
-    int redraw;
 
     /* fixed-width cached strings (byte-wise compare) */
     char cache_title[UI_W_TITLE * 4 + 1]; /* UTF-8 can be wider in bytes */
@@ -101,8 +133,25 @@ void ui_on_note_event(UI_state *ui, uint64_t now_ns, int ch,
 void ui_init(UI_state *ui, uint64_t now_ns);
 void ui_shutdown(UI_state *ui);
 
-/* UI rendering */
+/*
+ * ANSI UI init with rendering on its own thread (SCHED_OTHER even if
+ * the caller runs real-time); ui_maybe_render() then only publishes
+ * the state.  Returns 0 with the UI left inline if the thread could
+ * not be started.
+ */
+int ui_init_thread(UI_state *ui, uint64_t now_ns, const char *title);
+
+/* UI rendering (or publishing, with the rendering thread) */
 void ui_maybe_render(UI_state *ui, uint64_t now_ns, const char *title);
 
+/* time of the next frame ui_maybe_render() will draw */
+uint64_t ui_next_render_ns(const UI_state *ui);
+
+/* set song length (intro + loop) shown next to the title */
+void ui_set_song_length(UI_state *ui, uint64_t intro_ns, uint64_t loop_ns);
+
+/* set elapsed time display to pos_ns (after a seek) */
+void ui_set_position(UI_state *ui, uint64_t now_ns, uint64_t pos_ns);
+
 /* request a redraw on next render */
 void ui_request_redraw(UI_state *ui);
\ No newline at end of file
@@ -0,0 +1,248 @@
+/*
+ * psg_analyze.c
+ *  演奏データの曲長／ループ位置解析
+ *
+ *  J コマンドとエンドマークでチャンネル毎に無限ループするデータについて、
+ *  各チャンネルが最初に J を通過した tick と、エンドマークから J 位置に
+ *  最初に戻った tick を記録する。
+ *  テンポは全チャンネル共通なので (どのチャンネルの T でも変わる)
+ *  チャンネル単体のループ長の最小公倍数は曲全体の周期にならない。
+ *  曲全体のループは、いずれかのチャンネルが J 位置に戻った時点の
+ *  演奏状態 (全チャンネルの演奏位置と音長、テンポなど) を記録しておき、
+ *  同じ状態に戻ったところで求める。max_ticks 内に同じ状態に戻らなければ
+ *  曲全体のループは不明とする (チャンネル毎の結果は分かった分だけ返す)。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "psg_analyze.h"
+
+/* 記録する J 折り返し時点の状態数 (超えたら解析未完了) */
+#define ANALYZE_KEYS_MAX    1024
+
+/*
+ * 以後の進行 (タイミングと音符) を決める状態
+ *  ビブラート／EG のワーク (+/- フラグ、EG の音量補正値含む) は飛ばし中に
+ *  崩れるうえタイミングに関係しないので含めない。
+ *  比較は memcmp なので必ず memset してから詰める。
+ */
+typedef struct {
+    struct {
+        uint16_t data_offset;
+        uint16_t wait_counter;
+        uint16_t j_return_offset;
+        uint8_t  active;
+        uint8_t  flags;
+        uint8_t  nest_flag[4];
+        uint8_t  l_default;
+        uint8_t  lplus_default;
+        uint8_t  l_backup;
+        uint8_t  lplus_backup;
+        uint8_t  q_default;
+        uint8_t  volume;
+        uint8_t  octave;
+        uint8_t  octave_backup;
+        uint8_t  detune;
+    } ch[3];
+    uint8_t tempo_val;
+    uint8_t tempo_counter;
+    uint8_t fade_value;
+    int8_t  fade_step;
+    uint8_t fade_active;
+} AnalyzeKey;
+
+typedef struct {
+    AnalyzeKey key;
+    uint32_t   tick;                /* この状態になった tick */
+} AnalyzeMark;
+
+static void
+analyze_key(const PSGDriver *drv, AnalyzeKey *k)
+{
+    memset(k, 0, sizeof(*k));
+    for (int i = 0; i < 3; i++) {
+        const PSGChannel *ch = &drv->ch[i];
+        k->ch[i].data_offset     = ch->data_offset;
+        k->ch[i].wait_counter    = ch->wait_counter;
+        k->ch[i].j_return_offset = ch->j_return_offset;
+        k->ch[i].active          = ch->active;
+        k->ch[i].flags           = ch->flags & ~CH_F_VIB_PM;
+        memcpy(k->ch[i].nest_flag, ch->nest_flag, sizeof(ch->nest_flag));
+        k->ch[i].l_default       = ch->l_default;
+        k->ch[i].lplus_default   = ch->lplus_default;
+        k->ch[i].l_backup        = ch->l_backup;
+        k->ch[i].lplus_backup    = ch->lplus_backup;
+        k->ch[i].q_default       = ch->q_default;
+        k->ch[i].volume          = ch->volume;
+        k->ch[i].octave          = ch->octave;
+        k->ch[i].octave_backup   = ch->octave_backup;
+        k->ch[i].detune          = ch->detune;
+    }
+    k->tempo_val     = drv->main.tempo_val;
+    k->tempo_counter = drv->main.tempo_counter;
+    k->fade_value    = drv->main.fade_value;
+    k->fade_step     = drv->main.fade_step;
+    k->fade_active   = drv->main.fade_active;
+}
+
+/* 解析開始から n tick 後まで進める (音符境界の間は飛ばす) */
+static void
+analyze_run_to(PSGDriver *drv, uint32_t t0, uint32_t n)
+{
+    while (drv->tick_count - t0 < n) {
+        uint32_t left = n - (drv->tick_count - t0);
+        uint32_t idle = psg_driver_ticks_to_note(drv);
+        if (idle > left)
+            idle = left;
+        if (idle > 0)
+            psg_driver_skip_ticks(drv, idle);
+        else
+            psg_driver_tick(drv);
+    }
+}
+
+/* 出力なしのコピーを作る */
+static void
+analyze_copy(PSGDriver *drv, const PSGDriver *start)
+{
+    *drv = *start;
+    drv->write_reg  = NULL;
+    drv->write_regs = NULL;
+    drv->note_event = NULL;
+    drv->opaque     = NULL;
+    psg_driver_set_mute(drv, 1);
+}
+
+/* 解析 */
+int
+psg_analyze(const PSGDriver *start, uint32_t max_ticks, PSGAnalysis *a)
+{
+    PSGDriver drv;
+    AnalyzeMark *marks;
+    AnalyzeKey key;
+    int done[3];
+    int looping = 0;                /* J でループするチャンネルがある */
+    uint32_t nmarks = 0;
+    uint32_t match = PSG_ANALYZE_NONE;  /* 同じ状態だった tick */
+    uint32_t period = 0;
+
+    memset(a, 0, sizeof(*a));
+    for (int i = 0; i < 3; i++) {
+        a->ch[i].j_tick = PSG_ANALYZE_NONE;
+        a->ch[i].end_tick = PSG_ANALYZE_NONE;
+        done[i] = !start->ch[i].active;
+        if (done[i])
+            a->ch[i].end_tick = 0;
+    }
+    a->intro_ticks = PSG_ANALYZE_NONE;
+    a->loop_ticks = PSG_ANALYZE_NONE;
+    a->total_ticks = PSG_ANALYZE_NONE;
+
+    marks = malloc(ANALYZE_KEYS_MAX * sizeof(*marks));
+    if (marks == NULL)
+        return 0;
+
+    /* コールバックなし、出力なしで回す */
+    analyze_copy(&drv, start);
+
+    const uint32_t t0 = drv.tick_count;
+    for (;;) {
+        if (done[0] && done[1] && done[2] &&
+            (match != PSG_ANALYZE_NONE || !looping)) {
+            a->complete = 1;
+            break;
+        }
+        uint32_t elapsed = drv.tick_count - t0;
+        if (elapsed >= max_ticks)
+            break;
+
+        /* 音符境界の直前まで飛ばす */
+        uint32_t idle = psg_driver_ticks_to_note(&drv);
+        if (idle > max_ticks - elapsed)
+            idle = max_ticks - elapsed;
+        if (idle > 0) {
+            psg_driver_skip_ticks(&drv, idle);
+            continue;
+        }
+
+        uint32_t t = drv.tick_count - t0;
+        uint16_t loops[3];
+        for (int i = 0; i < 3; i++)
+            loops[i] = drv.ch[i].loop_count;
+        psg_driver_tick(&drv);
+
+        int wrapped = 0;
+        for (int i = 0; i < 3; i++) {
+            const PSGChannel *ch = &drv.ch[i];
+            if (ch->loop_count != loops[i])
+                wrapped = 1;
+            if (done[i])
+                continue;
+            if (a->ch[i].j_tick == PSG_ANALYZE_NONE &&
+                ch->j_return_offset != 0)
+                a->ch[i].j_tick = t;
+            if (ch->loop_count != 0) {
+                a->ch[i].loop_ticks = t - a->ch[i].j_tick;
+                done[i] = 1;
+                looping = 1;
+            } else if (!ch->active) {
+                a->ch[i].end_tick = t;
+                done[i] = 1;
+            }
+        }
+
+        /* J 位置に戻った時点の状態が前にもあれば、そこからが周期 */
+        if (!wrapped || match != PSG_ANALYZE_NONE)
+            continue;
+        analyze_key(&drv, &key);
+        for (uint32_t m = nmarks; m-- > 0; ) {
+            if (memcmp(&marks[m].key, &key, sizeof(key)) == 0) {
+                match = marks[m].tick;
+                period = t - match;
+                break;
+            }
+        }
+        if (match == PSG_ANALYZE_NONE) {
+            if (nmarks == ANALYZE_KEYS_MAX)
+                break;
+            marks[nmarks].key = key;
+            marks[nmarks].tick = t;
+            nmarks++;
+        }
+    }
+
+    free(marks);
+    if (!a->complete)
+        return 0;       /* 曲全体のループは不明 */
+
+    /*
+     * 曲全体のイントロ: ループしないチャンネルの終了と全チャンネルの
+     * J 通過の遅い方 (それより前は繰り返さない)
+     */
+    uint32_t intro = 0;
+    for (int i = 0; i < 3; i++) {
+        uint32_t e = (a->ch[i].end_tick != PSG_ANALYZE_NONE) ?
+            a->ch[i].end_tick : a->ch[i].j_tick;
+        if (e > intro)
+            intro = e;
+    }
+    /* テンポ変更などでそこからはまだ周期的でなければ一致した時点から */
+    if (match != PSG_ANALYZE_NONE && intro < match) {
+        AnalyzeKey k0;
+        analyze_copy(&drv, start);
+        analyze_run_to(&drv, t0, intro + 1);
+        analyze_key(&drv, &k0);
+        analyze_run_to(&drv, t0, intro + 1 + period);
+        analyze_key(&drv, &key);
+        if (memcmp(&k0, &key, sizeof(key)) != 0)
+            intro = match;
+    }
+    if (period > UINT32_MAX - intro)
+        period = UINT32_MAX - intro;
+    a->intro_ticks = intro;
+    a->loop_ticks = period;
+    a->total_ticks = intro + period;
+
+    return 1;
+}
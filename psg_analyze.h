@@ -0,0 +1,52 @@
+/*
+ * psg_analyze.h
+ *  演奏データの曲長／ループ位置解析定義
+ */
+
+#ifndef PSG_ANALYZE_H
+#define PSG_ANALYZE_H
+
+#include <stdint.h>
+
+#include "psg_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSG_ANALYZE_NONE    UINT32_MAX  /* 該当なし */
+
+/*
+ * 解析結果 (tick は解析開始時点からの 2ms tick 数)
+ *  曲全体の 3 項目は complete でなければ PSG_ANALYZE_NONE (不明)。
+ *  チャンネル毎の項目は max_ticks 内に分かった分だけ入る。
+ */
+typedef struct PSGAnalysis {
+    uint32_t intro_ticks;           /* ループ開始までの長さ (ループ無しは曲長) */
+    uint32_t loop_ticks;            /* 曲全体の周期 (0: ループ無し) */
+    uint32_t total_ticks;           /* intro + 1 ループ分の長さ */
+    int      complete;              /* max_ticks 内で曲全体の解析が完了したか */
+    struct {
+        uint32_t j_tick;            /* 最初に J を通過した tick */
+        uint32_t loop_ticks;        /* チャンネル単体の 1 ループ目の長さ */
+        uint32_t end_tick;          /* 演奏終了 tick (ループするチャンネルは無し) */
+    } ch[3];
+} PSGAnalysis;
+
+/*
+ * ヘッドレスでドライバを回して曲長とループ位置を解析する
+ *  start は psg_driver_start() 直後の状態 (コピーして使うので変更しない)。
+ *  音符境界の間は音長カウンタで一気に飛ばすので 2ms 毎には回さない。
+ *  ループは全チャンネルとテンポを含めた演奏状態が同じに戻るところで
+ *  求めるので、曲中のテンポ変更でチャンネル毎のループ長が周回毎に
+ *  変わっても正しい。max_ticks 内に同じ状態に戻らなければ曲全体の
+ *  ループは不明 (チャンネル毎のループ長の最小公倍数では代用しない)。
+ *  戻り値は a->complete と同じ。
+ */
+int psg_analyze(const PSGDriver *start, uint32_t max_ticks, PSGAnalysis *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PSG_ANALYZE_H */
@@ -7,6 +7,12 @@
 
 typedef struct psg_backend psg_backend_t;
 
+/* register/value pair for batched writes */
+typedef struct {
+    uint8_t reg;
+    uint8_t val;
+} psg_regval_t;
+
 typedef struct {
     const char *id;
 
@@ -21,6 +27,8 @@ typedef struct {
     /* PSG operations (valid only while enabled) */
     int  (*reset)(psg_backend_t *psgbe);
     int  (*write_reg)(psg_backend_t *psgbe, uint8_t reg, uint8_t val);
+    /* optional; use psg_backend_write_regs() to get the generic fallback */
+    int  (*write_regs)(psg_backend_t *psgbe, const psg_regval_t *rv, size_t n);
 } psg_backend_ops_t;
 
 #define PSG_BACKEND_LAST_ERROR_MAXLEN 256
@@ -42,4 +50,76 @@ psg_backend_last_error(const psg_backend_t *psgbe)
     return psgbe->last_error;
 }
 
+/*
+ * write registers in order (a bus backend may reorder them as
+ * psg_backend_order_latch() does); loops over write_reg if write_regs
+ * is NULL
+ */
+static inline int
+psg_backend_write_regs(psg_backend_t *psgbe, const psg_regval_t *rv, size_t n)
+{
+    if (psgbe->ops->write_regs != NULL)
+        return (*psgbe->ops->write_regs)(psgbe, rv, n);
+
+    for (size_t i = 0; i < n; i++) {
+        if ((*psgbe->ops->write_reg)(psgbe, rv[i].reg, rv[i].val) == 0)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Writes to registers of one group keep their order when a bus backend
+ * reorders a batch: the tone fine / coarse pairs (the driver writes
+ * them in either order on purpose) and the envelope period / shape.
+ */
+static inline unsigned int
+psg_reg_order_group(uint8_t reg)
+{
+    reg &= 0x0f;
+    if (reg < 6)
+        return reg & ~1u;       /* R0/R1, R2/R3, R4/R5 */
+    if (reg >= 11 && reg <= 13)
+        return 11;              /* R11..R13 */
+    return reg;
+}
+
+/*
+ * Reorder a batch (n <= 32) so that writes to the register the chip
+ * has latched come first and writes to the same register follow each
+ * other, letting the bus backend skip address latch cycles.  The order
+ * within each psg_reg_order_group() is kept; otherwise the batch stays
+ * in its original order.  latched: register latched before the batch,
+ * -1 if unknown.
+ */
+static inline void
+psg_backend_order_latch(psg_regval_t *dst, const psg_regval_t *src, size_t n,
+    int latched)
+{
+    uint32_t left = (n >= 32) ? 0xffffffffu : (1u << n) - 1u;
+
+    for (size_t k = 0; k < n; k++) {
+        uint32_t blocked = 0;
+        size_t pick = n;
+
+        for (size_t i = 0; i < n; i++) {
+            if ((left & (1u << i)) == 0)
+                continue;
+            uint32_t g = 1u << psg_reg_order_group(src[i].reg);
+            if ((blocked & g) != 0)
+                continue;       /* an earlier write of its group is left */
+            blocked |= g;
+            if (pick == n)
+                pick = i;
+            if ((src[i].reg & 0x0f) == latched) {
+                pick = i;
+                break;
+            }
+        }
+        dst[k] = src[pick];
+        left &= ~(1u << pick);
+        latched = src[pick].reg & 0x0f;
+    }
+}
+
 #endif /* PSG_BACKEND_H */
@@ -0,0 +1,205 @@
+/*
+ * psg_backend_emu.c
+ *
+ * Software emulation backend: register writes go to a PSGEmu instance
+ * (psg_emu.c) and the caller pulls PCM with psg_backend_emu_render().
+ * No hardware is touched, so this runs on any host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "psg_backend.h"
+#include "psg_backend_emu.h"
+#include "psg_emu.h"
+#include "ym2149f.h"
+
+typedef struct {
+    PSGEmu emu;
+    int enabled;
+} emu_backend_t;
+
+/* ---- backend ops ---- */
+
+static int
+emu_init(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    psgbe->last_error[0] = '\0';
+
+    /* PSGEmu holds 16-byte vectors; calloc() may not align them */
+    emu_backend_t *eb;
+    if (posix_memalign((void **)&eb, 16, sizeof(*eb)) != 0) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "posix_memalign(ctx): out of memory");
+        return 0;
+    }
+    memset(eb, 0, sizeof(*eb));
+
+    psg_emu_init(&eb->emu, PSG_EMU_CLOCK_DEFAULT, PSG_EMU_RATE_DEFAULT);
+    eb->enabled = 0;
+    psgbe->ctx = eb;
+    return 1;
+}
+
+static void
+emu_fini(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return;
+
+    free(psgbe->ctx);
+    psgbe->ctx = NULL;
+}
+
+static int
+emu_enable(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "enable: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    emu_backend_t *eb = psgbe->ctx;
+    eb->enabled = 1;
+    return 1;
+}
+
+static void
+emu_disable(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return;
+
+    emu_backend_t *eb = psgbe->ctx;
+
+    if (eb->enabled != 0) {
+        /* silence, same as the hardware backend */
+        psg_emu_write(&eb->emu, AY_ENABLE, 0x3f);
+        psg_emu_write(&eb->emu, AY_AVOL, 0x00);
+        psg_emu_write(&eb->emu, AY_BVOL, 0x00);
+        psg_emu_write(&eb->emu, AY_CVOL, 0x00);
+    }
+    eb->enabled = 0;
+}
+
+static emu_backend_t *
+emu_ctx_enabled(psg_backend_t *psgbe, const char *what)
+{
+    if (psgbe == NULL)
+        return NULL;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "%s: ctx is NULL (not initialized?)", what);
+        return NULL;
+    }
+
+    emu_backend_t *eb = psgbe->ctx;
+    if (eb->enabled == 0) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "%s: backend is disabled", what);
+        return NULL;
+    }
+    return eb;
+}
+
+static int
+emu_reset(psg_backend_t *psgbe)
+{
+    emu_backend_t *eb = emu_ctx_enabled(psgbe, "reset");
+    if (eb == NULL)
+        return 0;
+
+    psg_emu_reset(&eb->emu);
+    return 1;
+}
+
+static int
+emu_write_reg(psg_backend_t *psgbe, uint8_t reg, uint8_t val)
+{
+    emu_backend_t *eb = emu_ctx_enabled(psgbe, "write_reg");
+    if (eb == NULL)
+        return 0;
+
+    psg_emu_write(&eb->emu, reg, val);
+    return 1;
+}
+
+static int
+emu_write_regs(psg_backend_t *psgbe, const psg_regval_t *rv, size_t n)
+{
+    emu_backend_t *eb = emu_ctx_enabled(psgbe, "write_regs");
+    if (eb == NULL)
+        return 0;
+
+    for (size_t i = 0; i < n; i++)
+        psg_emu_write(&eb->emu, rv[i].reg, rv[i].val);
+    return 1;
+}
+
+int
+psg_backend_emu_configure(psg_backend_t *psgbe, uint32_t clock_hz,
+    uint32_t rate, int quality)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: ctx is NULL (not initialized?)");
+        return 0;
+    }
+    if (clock_hz < 8 || rate == 0 || rate > clock_hz / 8) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: invalid clock %u Hz / rate %u Hz", clock_hz, rate);
+        return 0;
+    }
+
+    emu_backend_t *eb = psgbe->ctx;
+    psg_emu_init(&eb->emu, clock_hz, rate);
+    if (psg_emu_set_quality(&eb->emu, quality) == 0) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: cannot set quality %d", quality);
+        return 0;
+    }
+    return 1;
+}
+
+int
+psg_backend_emu_render(psg_backend_t *psgbe, int16_t *buf, size_t n)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "render: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    emu_backend_t *eb = psgbe->ctx;
+    psg_emu_render(&eb->emu, buf, n);
+    return 1;
+}
+
+void
+psg_backend_emu_bind(psg_backend_ops_t *ops)
+{
+    memset(ops, 0, sizeof(*ops));
+    ops->id        = "emu";
+    ops->init      = emu_init;
+    ops->fini      = emu_fini;
+    ops->enable    = emu_enable;
+    ops->disable   = emu_disable;
+    ops->reset     = emu_reset;
+    ops->write_reg = emu_write_reg;
+    ops->write_regs = emu_write_regs;
+}
@@ -0,0 +1,24 @@
+/* psg_backend_emu.h */
+
+#ifndef PSG_BACKEND_EMU_H
+#define PSG_BACKEND_EMU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "psg_backend.h"
+
+void psg_backend_emu_bind(psg_backend_ops_t *ops);
+
+/*
+ * Set chip clock, output sample rate and filter quality (defaults:
+ * PSG_EMU_CLOCK_DEFAULT, PSG_EMU_RATE_DEFAULT, PSG_EMU_QUALITY_FAST).
+ * Valid after init; resets the chip.
+ */
+int psg_backend_emu_configure(psg_backend_t *psgbe, uint32_t clock_hz,
+    uint32_t rate, int quality);
+
+/* render n mono 16-bit samples with the registers written so far */
+int psg_backend_emu_render(psg_backend_t *psgbe, int16_t *buf, size_t n);
+
+#endif /* PSG_BACKEND_EMU_H */
@@ -0,0 +1,395 @@
+/*
+ * psg_backend_null.c
+ *
+ * Null backend: register writes are discarded, only counted.  Each
+ * write is charged the GPIO bus time that psg_backend_rpi_gpio.c would
+ * spend on it: the same bus cycles (psg_bus.h) run on a port that
+ * counts the stores, reads and barriers, with the waits derived from
+ * the chip's setup times, and a per-operation cost model prices them.
+ * This way a song can be played on any machine to see how much of
+ * each tick the real board would keep the bus busy.  Optionally the
+ * writes are logged to a text file with their times.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "psg_backend.h"
+#include "psg_backend_null.h"
+#include "psg_bus.h"
+
+typedef struct {
+    psg_bus_cost_t cost;
+    uint32_t nread_addr;        /* modeled wait loop counts */
+    uint32_t nread_data;
+    psg_bus_t bs;               /* modeled bus state */
+    char *trace_path;
+    FILE *trace;
+    uint64_t t_enable;
+    psg_backend_null_stats_t st;
+    int enabled;
+} null_backend_t;
+
+/* --- timing helpers --- */
+static inline uint64_t
+nsec_now_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* --- bus cost model --- */
+
+/* MMIO operations of one bus sequence */
+typedef struct {
+    uint32_t stores;
+    uint32_t reads;
+    uint32_t barriers;
+    uint32_t latches;
+} null_ops_t;
+
+/* port of the bus cycles: count instead of MMIO */
+typedef struct {
+    null_backend_t *nb;
+    null_ops_t o;
+} null_port_ctx_t;
+
+static void
+port_clr(void *ctx, uint8_t fall)
+{
+    (void)fall;
+    ((null_port_ctx_t *)ctx)->o.stores++;
+}
+
+static void
+port_set(void *ctx, uint8_t v, int cycle)
+{
+    null_ops_t *o = &((null_port_ctx_t *)ctx)->o;
+
+    (void)v;
+    o->stores++;
+    if (cycle == PSG_BUS_LATCH)
+        o->latches++;
+}
+
+/* gpio_wait(): two reads per loop, then a barrier */
+static void
+port_wait(void *ctx, int cycle)
+{
+    null_port_ctx_t *pc = ctx;
+
+    pc->o.reads += 2 * ((cycle == PSG_BUS_LATCH) ?
+        pc->nb->nread_addr : pc->nb->nread_data);
+    pc->o.barriers++;
+}
+
+static void
+port_end(void *ctx)
+{
+    ((null_port_ctx_t *)ctx)->o.stores++;
+}
+
+static void
+port_barrier(void *ctx)
+{
+    ((null_port_ctx_t *)ctx)->o.barriers++;
+}
+
+static const psg_bus_port_t g_port = {
+    port_clr, port_set, port_wait, port_end, port_barrier
+};
+
+/*
+ * wait loop counts of the chip, as calibration on the board would set
+ * them with a wait loop iteration of two reads
+ */
+static void
+null_set_cost(null_backend_t *nb, const psg_bus_cost_t *cost)
+{
+    uint32_t pair_ps = 2 * cost->read_ns * 1000u;
+
+    if (pair_ps == 0)
+        pair_ps = 1;
+    nb->cost = *cost;
+    nb->nread_addr = psg_bus_nread_for_ns(
+        psg_bus_chip_timing[cost->chip].addr_ns, pair_ps);
+    nb->nread_data = psg_bus_nread_for_ns(
+        psg_bus_chip_timing[cost->chip].data_ns, pair_ps);
+}
+
+static void
+null_account(null_backend_t *nb, const null_ops_t *o, size_t n)
+{
+    const psg_bus_cost_t *c = &nb->cost;
+    psg_backend_null_stats_t *st = &nb->st;
+
+    uint64_t ns = (uint64_t)o->stores * c->store_ns +
+        (uint64_t)o->reads * c->read_ns +
+        (uint64_t)o->barriers * c->barrier_ns;
+
+    st->stores += o->stores;
+    st->reads += o->reads;
+    st->barriers += o->barriers;
+    st->latches += o->latches;
+    st->bus_ns += ns;
+    if (ns > st->bus_max_ns)
+        st->bus_max_ns = ns;
+
+    st->batches++;
+    st->batch_hist[(n < PSG_BACKEND_NULL_HIST) ?
+        n : PSG_BACKEND_NULL_HIST - 1]++;
+    if (n > st->batch_max)
+        st->batch_max = (uint32_t)n;
+}
+
+static void
+null_record(null_backend_t *nb, uint64_t t, uint8_t reg, uint8_t val)
+{
+    nb->st.writes++;
+    nb->st.reg_writes[reg & 0x0f]++;
+    if (nb->trace != NULL) {
+        fprintf(nb->trace, "%llu %u %u\n",
+            (unsigned long long)(t - nb->t_enable), reg & 0x0f, val);
+    }
+}
+
+/* ---- backend ops ---- */
+
+static int
+null_init(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    psgbe->last_error[0] = '\0';
+
+    null_backend_t *nb = calloc(1, sizeof(*nb));
+    if (nb == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "calloc(ctx): out of memory");
+        return 0;
+    }
+
+    psg_bus_cost_t cost = {
+        PSG_BUS_STORE_NS_DEFAULT, PSG_BUS_READ_NS_DEFAULT,
+        PSG_BUS_BARRIER_NS_DEFAULT, PSG_RPI_GPIO_CHIP_YM2149
+    };
+    null_set_cost(nb, &cost);
+    nb->bs.bus = 0x00;          /* the safe default on enable */
+    nb->bs.latch = -1;
+    psgbe->ctx = nb;
+    return 1;
+}
+
+static void
+null_fini(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return;
+
+    null_backend_t *nb = psgbe->ctx;
+    free(nb->trace_path);
+    free(nb);
+    psgbe->ctx = NULL;
+}
+
+static int
+null_enable(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "enable: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    null_backend_t *nb = psgbe->ctx;
+    if (nb->enabled)
+        return 1;
+
+    if (nb->trace_path != NULL) {
+        nb->trace = fopen(nb->trace_path, "w");
+        if (nb->trace == NULL) {
+            snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+                "enable: %s: %s", nb->trace_path, strerror(errno));
+            return 0;
+        }
+        fprintf(nb->trace, "# nsec reg val\n");
+    }
+
+    memset(&nb->st, 0, sizeof(nb->st));
+    nb->t_enable = nsec_now_monotonic();
+    nb->enabled = 1;
+    return 1;
+}
+
+static void
+null_disable(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return;
+
+    null_backend_t *nb = psgbe->ctx;
+    if (nb->enabled == 0)
+        return;
+
+    nb->st.elapsed_ns = nsec_now_monotonic() - nb->t_enable;
+    if (nb->trace != NULL) {
+        if (fclose(nb->trace) != 0) {
+            snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+                "disable: %s: %s", nb->trace_path, strerror(errno));
+        }
+        nb->trace = NULL;
+    }
+    nb->enabled = 0;
+}
+
+static null_backend_t *
+null_ctx_enabled(psg_backend_t *psgbe, const char *what)
+{
+    if (psgbe == NULL)
+        return NULL;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "%s: ctx is NULL (not initialized?)", what);
+        return NULL;
+    }
+
+    null_backend_t *nb = psgbe->ctx;
+    if (nb->enabled == 0) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "%s: backend is disabled", what);
+        return NULL;
+    }
+    return nb;
+}
+
+static int
+null_reset(psg_backend_t *psgbe)
+{
+    null_backend_t *nb = null_ctx_enabled(psgbe, "reset");
+    if (nb == NULL)
+        return 0;
+
+    /* the reset pulse is a one-off and not charged to the bus */
+    nb->bs.bus = 0x00;
+    nb->bs.latch = -1;
+    return 1;
+}
+
+static int
+null_write_reg(psg_backend_t *psgbe, uint8_t reg, uint8_t val)
+{
+    null_backend_t *nb = null_ctx_enabled(psgbe, "write_reg");
+    if (nb == NULL)
+        return 0;
+
+    /* ym_write_reg_raw() */
+    null_port_ctx_t pc = { nb, { 0, 0, 0, 0 } };
+    psg_bus_write(&g_port, &pc, &nb->bs, reg, val, 1);
+    null_account(nb, &pc.o, 1);
+    null_record(nb, nsec_now_monotonic(), reg, val);
+    return 1;
+}
+
+static int
+null_write_regs(psg_backend_t *psgbe, const psg_regval_t *rv, size_t n)
+{
+    null_backend_t *nb = null_ctx_enabled(psgbe, "write_regs");
+    if (nb == NULL)
+        return 0;
+
+    /*
+     * ym_write_regs_raw() with the same reordering as
+     * psg_backend_rpi_gpio.c: a barrier at the end of each chunk
+     */
+    null_port_ctx_t pc = { nb, { 0, 0, 0, 0 } };
+    psg_regval_t ord[PSG_BUS_ORDER_MAX];
+    for (size_t i = 0; i < n; i += PSG_BUS_ORDER_MAX) {
+        size_t k = (n - i < PSG_BUS_ORDER_MAX) ? n - i : PSG_BUS_ORDER_MAX;
+        psg_backend_order_latch(ord, rv + i, k, nb->bs.latch);
+        for (size_t j = 0; j < k; j++)
+            psg_bus_write(&g_port, &pc, &nb->bs, ord[j].reg, ord[j].val, 0);
+        pc.o.barriers++;
+    }
+    null_account(nb, &pc.o, n);
+    uint64_t t = nsec_now_monotonic();
+    for (size_t i = 0; i < n; i++)
+        null_record(nb, t, rv[i].reg, rv[i].val);
+    return 1;
+}
+
+int
+psg_backend_null_configure(psg_backend_t *psgbe,
+    const psg_bus_cost_t *cost, const char *trace_path)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    null_backend_t *nb = psgbe->ctx;
+    if (nb->enabled) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: backend is enabled");
+        return 0;
+    }
+
+    if (cost != NULL &&
+        (cost->chip < 0 || cost->chip >= PSG_RPI_GPIO_CHIP_COUNT)) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: invalid chip %d", cost->chip);
+        return 0;
+    }
+
+    char *p = NULL;
+    if (trace_path != NULL && (p = strdup(trace_path)) == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: out of memory");
+        return 0;
+    }
+    free(nb->trace_path);
+    nb->trace_path = p;
+    if (cost != NULL)
+        null_set_cost(nb, cost);
+    return 1;
+}
+
+int
+psg_backend_null_stats(psg_backend_t *psgbe, psg_backend_null_stats_t *st)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return 0;
+
+    null_backend_t *nb = psgbe->ctx;
+    *st = nb->st;
+    if (nb->enabled)
+        st->elapsed_ns = nsec_now_monotonic() - nb->t_enable;
+    return 1;
+}
+
+void
+psg_backend_null_bind(psg_backend_ops_t *ops)
+{
+    memset(ops, 0, sizeof(*ops));
+    ops->id        = "null";
+    ops->init      = null_init;
+    ops->fini      = null_fini;
+    ops->enable    = null_enable;
+    ops->disable   = null_disable;
+    ops->reset     = null_reset;
+    ops->write_reg = null_write_reg;
+    ops->write_regs = null_write_regs;
+}
@@ -0,0 +1,61 @@
+/* psg_backend_null.h */
+
+#ifndef PSG_BACKEND_NULL_H
+#define PSG_BACKEND_NULL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "psg_backend.h"
+
+/*
+ * GPIO bus cost model (ns per MMIO operation).  The defaults are rough
+ * figures for a BCM2835/2836 peripheral bus, not measurements: stores
+ * are posted, reads wait for the bus round trip.  The wait loop counts
+ * follow from read_ns and the chip's setup times, as calibrated on the
+ * board.
+ */
+typedef struct {
+    uint32_t store_ns;          /* GPSET0 / GPCLR0 store */
+    uint32_t read_ns;           /* GPIO register read (gpio_wait()) */
+    uint32_t barrier_ns;        /* mmio_barrier() */
+    int      chip;              /* PSG_RPI_GPIO_CHIP_xxx */
+} psg_bus_cost_t;
+
+#define PSG_BUS_STORE_NS_DEFAULT    20u
+#define PSG_BUS_READ_NS_DEFAULT     100u
+#define PSG_BUS_BARRIER_NS_DEFAULT  10u
+
+/* batch size histogram: 0..32 writes, larger batches in the last bin */
+#define PSG_BACKEND_NULL_HIST   33
+
+typedef struct {
+    uint64_t writes;            /* register writes */
+    uint64_t reg_writes[16];    /* per register */
+    uint64_t batches;           /* write_regs calls (one per tick) */
+    uint32_t batch_max;         /* most writes in one batch */
+    uint64_t batch_hist[PSG_BACKEND_NULL_HIST]; /* batches by size */
+    uint64_t stores;            /* modeled MMIO operations */
+    uint64_t reads;
+    uint64_t barriers;
+    uint64_t latches;           /* address latch cycles (others reuse one) */
+    uint64_t bus_ns;            /* modeled bus time, total */
+    uint64_t bus_max_ns;        /* most bus time in one call (tick) */
+    uint64_t elapsed_ns;        /* time enabled */
+} psg_backend_null_stats_t;
+
+void psg_backend_null_bind(psg_backend_ops_t *ops);
+
+/*
+ * Optional settings, valid after init: bus cost model (NULL: defaults)
+ * and a trace file of the writes ("nsec reg val" lines, NULL: none),
+ * which is opened on enable.
+ */
+int psg_backend_null_configure(psg_backend_t *psgbe,
+    const psg_bus_cost_t *cost, const char *trace_path);
+
+/* statistics so far */
+int psg_backend_null_stats(psg_backend_t *psgbe,
+    psg_backend_null_stats_t *st);
+
+#endif /* PSG_BACKEND_NULL_H */
@@ -0,0 +1,492 @@
+/*
+ * psg_backend_pcm.c
+ *
+ * Real-time PCM stream backend: register writes are emulated
+ * (psg_emu.c) and the sound is streamed as WAV to stdout or a named
+ * pipe, e.g. `psg_play -P - song.bin | aplay -`.  For monitoring on
+ * machines without the YM2149 board.
+ *
+ * The tick thread only timestamps each write and puts it into a
+ * single-producer single-consumer ring.  A render thread runs
+ * latency_ns behind real time: it renders fixed blocks of samples and
+ * applies every write at the sample that corresponds to its timestamp,
+ * so the timing of the writes is kept no matter how the two threads
+ * are scheduled.  The stream starts with latency_ns of silence, which
+ * is what the consumer has buffered while each block is being made;
+ * a block that is not written by its play time is an underrun.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "psg_backend.h"
+#include "psg_backend_pcm.h"
+#include "psg_emu.h"
+#include "psg_wav.h"
+#include "ym2149f.h"
+
+#define PCM_RING_SIZE   4096u           /* entries, power of 2 */
+#define PCM_RING_MASK   (PCM_RING_SIZE - 1)
+#define PCM_BLOCK       128             /* samples per render block */
+#define PCM_MARGIN_NS   1000000ull      /* wait for writes in flight */
+#define PCM_RETRY_NS    100000ull       /* ring full: retry interval */
+
+#define PCM_REG_RESET   0xff            /* ring entry: chip reset */
+
+typedef struct {
+    uint64_t t_ns;              /* CLOCK_MONOTONIC time of the write */
+    uint8_t reg;
+    uint8_t val;
+} pcm_ent_t;
+
+typedef struct {
+    PSGEmu emu;                 /* render thread only */
+
+    /* SPSC ring; head is written by the tick thread, tail by render */
+    pcm_ent_t ring[PCM_RING_SIZE];
+    _Alignas(64) _Atomic uint32_t head;
+    _Alignas(64) _Atomic uint32_t tail;
+
+    /* producer side statistics */
+    _Alignas(64) uint64_t ring_full;
+    uint32_t ring_max;
+
+    char *path;
+    uint32_t rate;
+    int quality;
+    uint64_t latency_ns;
+
+    psg_wav_t wav;
+    pthread_t thread;
+    _Atomic int running;
+    _Atomic int failed;
+    uint64_t t_start;           /* time of sample 0 */
+    psg_backend_pcm_stats_t st; /* render thread side */
+    int enabled;
+} pcm_backend_t;
+
+/* --- timing helpers --- */
+static inline uint64_t
+nsec_now_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void
+sleep_ns(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ns / 1000000000ull);
+    ts.tv_nsec = (long)(ns % 1000000000ull);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        continue;
+}
+
+/* ---- ring ---- */
+
+static int
+pcm_push(pcm_backend_t *pb, uint64_t t, uint8_t reg, uint8_t val)
+{
+    uint32_t head = atomic_load_explicit(&pb->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&pb->tail, memory_order_acquire);
+
+    if (head - tail >= PCM_RING_SIZE) {
+        /* render thread stalled; wait rather than lose a write */
+        pb->ring_full++;
+        do {
+            if (atomic_load(&pb->failed) || !atomic_load(&pb->running))
+                return 0;
+            sleep_ns(PCM_RETRY_NS);
+            tail = atomic_load_explicit(&pb->tail, memory_order_acquire);
+        } while (head - tail >= PCM_RING_SIZE);
+    }
+
+    pcm_ent_t *e = &pb->ring[head & PCM_RING_MASK];
+    e->t_ns = t;
+    e->reg = reg;
+    e->val = val;
+    atomic_store_explicit(&pb->head, head + 1, memory_order_release);
+
+    if (head + 1 - tail > pb->ring_max)
+        pb->ring_max = head + 1 - tail;
+    return 1;
+}
+
+/* ---- render thread ---- */
+
+static int
+pcm_write(pcm_backend_t *pb, const int16_t *buf, size_t n)
+{
+    if (psg_wav_write(&pb->wav, buf, n) == 0 || fflush(pb->wav.fp) != 0)
+        return 0;
+    pb->st.samples += n;
+    return 1;
+}
+
+static void *
+pcm_thread(void *arg)
+{
+    pcm_backend_t *pb = arg;
+    psg_backend_pcm_stats_t *st = &pb->st;
+    int16_t buf[PCM_BLOCK];
+    uint64_t s = 0;             /* first sample of the block */
+
+    while (atomic_load(&pb->running)) {
+        uint64_t te = pb->t_start +
+            (s + PCM_BLOCK) * 1000000000ull / pb->rate;
+        uint64_t now = nsec_now_monotonic();
+
+        /* the block is complete once its end time has passed */
+        if (now < te + PCM_MARGIN_NS) {
+            sleep_ns(te + PCM_MARGIN_NS - now);
+            continue;
+        }
+
+        /* apply the writes made during the block at their samples */
+        size_t done = 0;
+        uint64_t nw = 0, tsum = 0, tmin = UINT64_MAX;
+        for (;;) {
+            uint32_t tail = atomic_load_explicit(&pb->tail,
+                memory_order_relaxed);
+            uint32_t head = atomic_load_explicit(&pb->head,
+                memory_order_acquire);
+            if (tail == head)
+                break;
+            const pcm_ent_t *e = &pb->ring[tail & PCM_RING_MASK];
+            if (e->t_ns >= te)
+                break;
+
+            uint64_t pos = (e->t_ns > pb->t_start) ?
+                (e->t_ns - pb->t_start) * pb->rate / 1000000000ull : 0;
+            if (pos < s) {
+                st->late_writes++;
+                pos = s;
+            }
+            if (pos > s + done) {
+                psg_emu_render(&pb->emu, buf + done, (size_t)(pos - s - done));
+                done = (size_t)(pos - s);
+            }
+            if (e->reg == PCM_REG_RESET)
+                psg_emu_reset(&pb->emu);
+            else
+                psg_emu_write(&pb->emu, e->reg, e->val);
+            nw++;
+            tsum += e->t_ns;
+            if (e->t_ns < tmin)
+                tmin = e->t_ns;
+
+            atomic_store_explicit(&pb->tail, tail + 1, memory_order_release);
+        }
+        psg_emu_render(&pb->emu, buf + done, PCM_BLOCK - done);
+
+        if (pcm_write(pb, buf, PCM_BLOCK) == 0) {
+            atomic_store(&pb->failed, 1);
+            break;
+        }
+
+        /* the consumer plays this block latency_ns after te */
+        now = nsec_now_monotonic();
+        int64_t lead = (int64_t)(te + pb->latency_ns - now);
+        if (lead < 0)
+            st->underruns++;
+        if (lead < st->lead_min_ns)
+            st->lead_min_ns = lead;
+        if (nw > 0) {
+            st->writes += nw;
+            st->lat_sum_ns += nw * now - tsum;
+            if (now - tmin > st->lat_max_ns)
+                st->lat_max_ns = now - tmin;
+        }
+        s += PCM_BLOCK;
+    }
+    return NULL;
+}
+
+/* ---- backend ops ---- */
+
+static int
+pcm_init(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    psgbe->last_error[0] = '\0';
+
+    /* PSGEmu vectors and the ring indices need alignment */
+    pcm_backend_t *pb;
+    if (posix_memalign((void **)&pb, 64, sizeof(*pb)) != 0) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "posix_memalign(ctx): out of memory");
+        return 0;
+    }
+    memset(pb, 0, sizeof(*pb));
+
+    pb->rate = PSG_EMU_RATE_DEFAULT;
+    pb->quality = PSG_EMU_QUALITY_FAST;
+    pb->latency_ns = PSG_BACKEND_PCM_LATENCY_DEFAULT * 1000000ull;
+    atomic_init(&pb->head, 0);
+    atomic_init(&pb->tail, 0);
+    atomic_init(&pb->running, 0);
+    atomic_init(&pb->failed, 0);
+    psgbe->ctx = pb;
+    return 1;
+}
+
+static void
+pcm_fini(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return;
+
+    pcm_backend_t *pb = psgbe->ctx;
+    free(pb->path);
+    free(pb);
+    psgbe->ctx = NULL;
+}
+
+static int
+pcm_enable(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "enable: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    pcm_backend_t *pb = psgbe->ctx;
+    if (pb->enabled)
+        return 1;
+    if (pb->path == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "enable: no output configured");
+        return 0;
+    }
+
+    psg_emu_init(&pb->emu, PSG_EMU_CLOCK_DEFAULT, pb->rate);
+    if (psg_emu_set_quality(&pb->emu, pb->quality) == 0) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "enable: cannot set quality %d", pb->quality);
+        return 0;
+    }
+
+    /* opening a named pipe waits for the reader */
+    FILE *fp;
+    if (strcmp(pb->path, "-") == 0) {
+        int fd = dup(STDOUT_FILENO);
+        fp = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+        if (fp == NULL && fd >= 0) {
+            int error = errno;
+            close(fd);
+            errno = error;
+        }
+    } else {
+        fp = fopen(pb->path, "wb");
+    }
+    if (fp == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "enable: %s: %s", pb->path, strerror(errno));
+        return 0;
+    }
+    /* psg_wav_open_fp() closes fp itself on failure */
+    if (psg_wav_open_fp(&pb->wav, fp, pb->rate, 1) == 0) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "enable: %s: %s", pb->path, strerror(errno));
+        return 0;
+    }
+
+    memset(&pb->st, 0, sizeof(pb->st));
+    pb->st.lead_min_ns = INT64_MAX;
+    pb->ring_full = 0;
+    pb->ring_max = 0;
+    atomic_store(&pb->head, 0);
+    atomic_store(&pb->tail, 0);
+    atomic_store(&pb->failed, 0);
+
+    /* what the consumer holds while the first block is rendered */
+    int16_t zero[PCM_BLOCK] = { 0 };
+    uint64_t fill = pb->latency_ns * pb->rate / 1000000000ull;
+    while (fill > 0) {
+        size_t n = (fill > PCM_BLOCK) ? PCM_BLOCK : (size_t)fill;
+        if (pcm_write(pb, zero, n) == 0) {
+            snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+                "enable: %s: write error", pb->path);
+            (void)psg_wav_close(&pb->wav);
+            return 0;
+        }
+        fill -= n;
+    }
+
+    pb->t_start = nsec_now_monotonic();
+    atomic_store(&pb->running, 1);
+    int error = pthread_create(&pb->thread, NULL, pcm_thread, pb);
+    if (error != 0) {
+        atomic_store(&pb->running, 0);
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "enable: pthread_create: %s", strerror(error));
+        (void)psg_wav_close(&pb->wav);
+        return 0;
+    }
+    pb->enabled = 1;
+    return 1;
+}
+
+static void
+pcm_disable(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return;
+
+    pcm_backend_t *pb = psgbe->ctx;
+    if (pb->enabled == 0)
+        return;
+
+    atomic_store(&pb->running, 0);
+    pthread_join(pb->thread, NULL);
+    (void)psg_wav_close(&pb->wav);
+    pb->enabled = 0;
+}
+
+static pcm_backend_t *
+pcm_ctx_enabled(psg_backend_t *psgbe, const char *what)
+{
+    if (psgbe == NULL)
+        return NULL;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "%s: ctx is NULL (not initialized?)", what);
+        return NULL;
+    }
+
+    pcm_backend_t *pb = psgbe->ctx;
+    if (pb->enabled == 0) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "%s: backend is disabled", what);
+        return NULL;
+    }
+    if (atomic_load(&pb->failed)) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "%s: %s: write error", what, pb->path);
+        return NULL;
+    }
+    return pb;
+}
+
+static int
+pcm_reset(psg_backend_t *psgbe)
+{
+    pcm_backend_t *pb = pcm_ctx_enabled(psgbe, "reset");
+    if (pb == NULL)
+        return 0;
+
+    return pcm_push(pb, nsec_now_monotonic(), PCM_REG_RESET, 0);
+}
+
+static int
+pcm_write_reg(psg_backend_t *psgbe, uint8_t reg, uint8_t val)
+{
+    pcm_backend_t *pb = pcm_ctx_enabled(psgbe, "write_reg");
+    if (pb == NULL)
+        return 0;
+
+    return pcm_push(pb, nsec_now_monotonic(), reg & 0x0f, val);
+}
+
+static int
+pcm_write_regs(psg_backend_t *psgbe, const psg_regval_t *rv, size_t n)
+{
+    pcm_backend_t *pb = pcm_ctx_enabled(psgbe, "write_regs");
+    if (pb == NULL)
+        return 0;
+
+    /* one tick's batch lands on one sample */
+    uint64_t t = nsec_now_monotonic();
+    for (size_t i = 0; i < n; i++) {
+        if (pcm_push(pb, t, rv[i].reg & 0x0f, rv[i].val) == 0)
+            return 0;
+    }
+    return 1;
+}
+
+int
+psg_backend_pcm_configure(psg_backend_t *psgbe, const char *path,
+    uint32_t rate, int quality, uint32_t latency_ms)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    pcm_backend_t *pb = psgbe->ctx;
+    if (pb->enabled) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: backend is enabled");
+        return 0;
+    }
+    if (rate == 0 || rate > PSG_EMU_CLOCK_DEFAULT / 8 ||
+        quality < 0 || quality >= PSG_EMU_QUALITY_COUNT) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: invalid rate %u Hz / quality %d", rate, quality);
+        return 0;
+    }
+
+    char *p = strdup(path);
+    if (p == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: out of memory");
+        return 0;
+    }
+    free(pb->path);
+    pb->path = p;
+    pb->rate = rate;
+    pb->quality = quality;
+    pb->latency_ns = (uint64_t)latency_ms * 1000000ull;
+    return 1;
+}
+
+int
+psg_backend_pcm_stats(psg_backend_t *psgbe, psg_backend_pcm_stats_t *st)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return 0;
+
+    pcm_backend_t *pb = psgbe->ctx;
+    *st = pb->st;
+    st->ring_full = pb->ring_full;
+    st->ring_size = PCM_RING_SIZE;
+    st->ring_max = pb->ring_max;
+    st->latency_ns = pb->latency_ns;
+    st->failed = atomic_load(&pb->failed);
+    return 1;
+}
+
+void
+psg_backend_pcm_bind(psg_backend_ops_t *ops)
+{
+    memset(ops, 0, sizeof(*ops));
+    ops->id        = "pcm";
+    ops->init      = pcm_init;
+    ops->fini      = pcm_fini;
+    ops->enable    = pcm_enable;
+    ops->disable   = pcm_disable;
+    ops->reset     = pcm_reset;
+    ops->write_reg = pcm_write_reg;
+    ops->write_regs = pcm_write_regs;
+}
@@ -0,0 +1,44 @@
+/* psg_backend_pcm.h */
+
+#ifndef PSG_BACKEND_PCM_H
+#define PSG_BACKEND_PCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "psg_backend.h"
+
+#define PSG_BACKEND_PCM_LATENCY_DEFAULT 50u     /* ms */
+
+/* real-time stream statistics */
+typedef struct {
+    uint64_t samples;           /* samples written, including the pre-fill */
+    uint64_t writes;            /* register writes rendered */
+    uint64_t late_writes;       /* writes that missed their sample */
+    uint64_t underruns;         /* blocks written after their play time */
+    uint64_t ring_full;         /* writes that waited for ring space */
+    uint32_t ring_size;
+    uint32_t ring_max;          /* highest ring fill (entries) */
+    uint64_t lat_sum_ns;        /* register write to sink, summed */
+    uint64_t lat_max_ns;
+    int64_t  lead_min_ns;       /* smallest margin before play time */
+    uint64_t latency_ns;        /* configured output latency */
+    int      failed;            /* sink write error; output stopped */
+} psg_backend_pcm_stats_t;
+
+void psg_backend_pcm_bind(psg_backend_ops_t *ops);
+
+/*
+ * Set the output ("-": stdout, or a file / named pipe), sample rate,
+ * emulator filter quality and output latency (ms).  Valid after init,
+ * before enable.  The output is a WAV stream (sizes left open) that is
+ * opened on enable; stdout is dup()ed so that the caller may reuse
+ * descriptor 1 afterwards.
+ */
+int psg_backend_pcm_configure(psg_backend_t *psgbe, const char *path,
+    uint32_t rate, int quality, uint32_t latency_ms);
+
+/* statistics; exact once disabled */
+int psg_backend_pcm_stats(psg_backend_t *psgbe, psg_backend_pcm_stats_t *st);
+
+#endif /* PSG_BACKEND_PCM_H */
@@ -6,6 +6,8 @@
  * - Raspberry Pi 2/3 (BCM2836/7):  PERI_BASE = 0x3F000000
  * - Raspberry Pi 4 (BCM2711):      PERI_BASE = 0xFE000000
  * - /dev/mem mmap GPIO and CM
+ *   (off-Pi: a plain file or anonymous memory, with an optional trace
+ *    of every MMIO operation; see psg_backend_rpi_gpio_configure())
  * - Wiring (BC2=H fixed, A8=H A9=L fixed):
  *     GPIO20..27 -> DA0..7 (LSB=GPIO20)
  *     GPIO12     -> BDIR
@@ -23,16 +25,22 @@
 
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__NetBSD__)
 #include <sys/sysctl.h>
+#endif
 
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "psg_backend_rpi_gpio.h"
+#include "psg_bus.h"
 #include "ym2149f.h"
 
 /* ---- BCM2835 (Raspberry Pi Zero/1) fixed addresses ---- */
@@ -118,8 +126,21 @@ enum {
 #define MASK_CTRL      (MASK_BDIR | MASK_BC1)
 #define MASK_RESET     (1u << PIN_RESET)
 
-/* Wait loop: dummy reads count (tuned for AY-3-8910 worst case) */
-#define NREAD_WAIT     3u
+/* Wait loop calibration: fastest of WAIT_CAL_RUNS runs of WAIT_CAL_ITER */
+#define WAIT_CAL_ITER   256u
+#define WAIT_CAL_RUNS   8
+
+/*
+ * The clocks may still go up after calibration (cpufreq, e.g. the
+ * ondemand governor), which shortens each read: the loop is kept busy
+ * for WAIT_CAL_WARMUP_NS first so that it is timed at the raised
+ * clock, and the counts cover the setup times plus PSG_BUS_WAIT_MARGIN_PCT
+ * and one more read.
+ */
+#define WAIT_CAL_WARMUP_NS  50000000ull
+
+/* write rate measurement (R14 / R15 writes) */
+#define WRITE_CAL_N     32u
 
 typedef struct {
     const char *name;
@@ -132,7 +153,23 @@ typedef struct {
     const rpi_soc_profile_t *soc;
     volatile uint32_t *gpio;
     volatile uint32_t *cm;   /* clock manager */
+    int mapped;
     int enabled;
+
+    psg_bus_t bs;            /* bus state left by the last cycle */
+
+    /* bus timing (psg_backend_rpi_gpio_set_timing()) */
+    uint32_t nread_fixed;    /* 0: calibrate on enable */
+    psg_rpi_gpio_timing_t timing;
+
+    /* MMIO source (psg_backend_rpi_gpio_configure()) */
+    char *path;              /* NULL: anonymous memory */
+    int create;              /* path is a plain file that may be created */
+    psg_rpi_gpio_trace_fn trace;
+    void *trace_opaque;
+
+    /* latency histograms (psg_backend_rpi_gpio_set_hist()), NULL: off */
+    psg_rpi_gpio_hist_t *hist;
 } rpi_gpio_t;
 
 enum {
@@ -148,15 +185,88 @@ static const rpi_soc_profile_t g_soc_profiles[SOC_IDX_COUNT] = {
     [SOC_IDX_BCM2711] = { "BCM2711", PERI_BASE_BCM2711, 750000000u },
 };
 
+/* names accepted by psg_backend_rpi_gpio_configure() */
+static const struct {
+    const char *name;
+    int idx;
+} g_soc_names[] = {
+    { "BCM2835", SOC_IDX_BCM2835 },
+    { "BCM2836", SOC_IDX_BCM2836 },
+    { "BCM2837", SOC_IDX_BCM2836 },
+    { "BCM2711", SOC_IDX_BCM2711 },
+};
+
+/* --- timing helpers --- */
+static inline uint64_t
+nsec_now_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void
+mmio_trace(rpi_gpio_t *rg, uint8_t op, uint8_t blk, uint32_t off, uint32_t val)
+{
+    psg_rpi_gpio_op_t o;
+
+    o.op = op;
+    o.blk = blk;
+    o.off = (uint16_t)off;
+    o.val = val;
+    (*rg->trace)(rg->trace_opaque, &o);
+}
+
 /* Minimal memory barrier (ordering for MMIO) */
 static inline void
-mmio_barrier(void)
+mmio_barrier(rpi_gpio_t *rg)
 {
 #if (defined(__arm__) && __ARM_ARCH >= 7) || defined(__aarch64__)
     __asm__ volatile("dmb ish" ::: "memory");
 #else
     __sync_synchronize();
 #endif
+    if (__builtin_expect(rg->trace != NULL, 0))
+        mmio_trace(rg, PSG_RPI_GPIO_OP_BARRIER, PSG_RPI_GPIO_BLK_GPIO, 0, 0);
+}
+
+/*
+ * Register accessors.  The trace hook is only for running off-Pi; on
+ * the board it is NULL and costs one predictable branch per access.
+ */
+static inline void
+gpio_store(rpi_gpio_t *rg, uint32_t off, uint32_t val)
+{
+    rg->gpio[off / 4] = val;
+    if (__builtin_expect(rg->trace != NULL, 0))
+        mmio_trace(rg, PSG_RPI_GPIO_OP_STORE, PSG_RPI_GPIO_BLK_GPIO, off, val);
+}
+
+static inline uint32_t
+gpio_load(rpi_gpio_t *rg, uint32_t off)
+{
+    uint32_t val = rg->gpio[off / 4];
+    if (__builtin_expect(rg->trace != NULL, 0))
+        mmio_trace(rg, PSG_RPI_GPIO_OP_LOAD, PSG_RPI_GPIO_BLK_GPIO, off, val);
+    return val;
+}
+
+static inline void
+cm_store(rpi_gpio_t *rg, uint32_t off, uint32_t val)
+{
+    rg->cm[off / 4] = val;
+    if (__builtin_expect(rg->trace != NULL, 0))
+        mmio_trace(rg, PSG_RPI_GPIO_OP_STORE, PSG_RPI_GPIO_BLK_CM, off, val);
+}
+
+static inline uint32_t
+cm_load(rpi_gpio_t *rg, uint32_t off)
+{
+    uint32_t val = rg->cm[off / 4];
+    if (__builtin_expect(rg->trace != NULL, 0))
+        mmio_trace(rg, PSG_RPI_GPIO_OP_LOAD, PSG_RPI_GPIO_BLK_CM, off, val);
+    return val;
 }
 
 static const rpi_soc_profile_t *
@@ -166,10 +276,27 @@ detect_soc_profile(void)
     size_t len = sizeof(model);
 
     /* Check Raspberry Pi model strings */
+#if defined(__NetBSD__)
     if (sysctlbyname("hw.model", model, &len, NULL, 0) != 0) {
         /* assume Pi2/3 as default */
         return &g_soc_profiles[SOC_IDX_BCM2836];
     }
+#else
+    /* Linux: the same dts strings, NUL separated */
+    int fd = open("/proc/device-tree/compatible", O_RDONLY);
+    ssize_t r = (fd >= 0) ? read(fd, model, sizeof(model)) : -1;
+    if (fd >= 0)
+        close(fd);
+    if (r <= 0) {
+        /* assume Pi2/3 as default */
+        return &g_soc_profiles[SOC_IDX_BCM2836];
+    }
+    len = (size_t)r;
+    for (size_t i = 0; i < len - 1; i++) {
+        if (model[i] == '\0')
+            model[i] = ' ';
+    }
+#endif
     model[len - 1] = '\0';
 
     /* model strings are taken from dts files */
@@ -198,13 +325,13 @@ gpio_config_output(rpi_gpio_t *rg, int pin)
 {
     uint32_t reg = pin / 10;          /* each GPFSEL covers 10 pins */
     uint32_t shift = (pin % 10) * 3;
-    volatile uint32_t *fsel = &rg->gpio[GPFSEL0 / 4 + reg];
+    uint32_t fsel = GPFSEL0 + reg * 4;
 
-    uint32_t v = *fsel;
+    uint32_t v = gpio_load(rg, fsel);
     v &= ~(7u << shift);
     v |=  (1u << shift); /* 001 = output */
-    *fsel = v;
-    mmio_barrier();
+    gpio_store(rg, fsel, v);
+    mmio_barrier(rg);
 }
 
 /* Set GPIO function to output: fsel=001 */
@@ -213,20 +340,20 @@ gpio_config_alt(rpi_gpio_t *rg, int pin, uint32_t fsel_bits)
 {
     uint32_t reg = pin / 10;          /* each GPFSEL covers 10 pins */
     uint32_t shift = (pin % 10) * 3;
-    volatile uint32_t *fsel = &rg->gpio[GPFSEL0 / 4 + reg];
+    uint32_t fsel = GPFSEL0 + reg * 4;
 
-    uint32_t v = *fsel;
+    uint32_t v = gpio_load(rg, fsel);
     v &= ~(7u << shift);
     v |= (fsel_bits << shift);
-    *fsel = v;
-    mmio_barrier();
+    gpio_store(rg, fsel, v);
+    mmio_barrier(rg);
 }
 
 static inline void
-cm_wait_not_busy(volatile uint32_t *cm_ctl)
+cm_wait_not_busy(rpi_gpio_t *rg)
 {
     for (int i = 0; i < 10000; i++) {
-        if ((*cm_ctl & CM_CTL_BUSY) == 0)
+        if ((cm_load(rg, CM_GP0CTL) & CM_CTL_BUSY) == 0)
             return;
     }
 }
@@ -234,13 +361,10 @@ cm_wait_not_busy(volatile uint32_t *cm_ctl)
 static int
 rpi_gpclk0_set_hz(rpi_gpio_t *rg, uint32_t hz, uint32_t src, uint32_t mash)
 {
-    volatile uint32_t *ctl = &rg->cm[CM_GP0CTL / 4];
-    volatile uint32_t *div = &rg->cm[CM_GP0DIV / 4];
-
     /* 1) disable */
-    *ctl = CM_PASSWD | (*ctl & ~CM_CTL_ENAB);
-    mmio_barrier();
-    cm_wait_not_busy(ctl);
+    cm_store(rg, CM_GP0CTL, CM_PASSWD | (cm_load(rg, CM_GP0CTL) & ~CM_CTL_ENAB));
+    mmio_barrier(rg);
+    cm_wait_not_busy(rg);
 
     /* 2) choose divisor by source clock profile */
     if (hz == 0 || rg->soc == NULL || rg->soc->plld_hz == 0) {
@@ -259,8 +383,9 @@ rpi_gpclk0_set_hz(rpi_gpio_t *rg, uint32_t hz, uint32_t src, uint32_t mash)
         mash = 0;
     }
 
-    *div = CM_PASSWD | ((divi & 0x0fffu) << 12u) | (divf & 0x0fffu);
-    mmio_barrier();
+    cm_store(rg, CM_GP0DIV,
+        CM_PASSWD | ((divi & 0x0fffu) << 12u) | (divf & 0x0fffu));
+    mmio_barrier(rg);
 
     /* 3) enable with src+mash */
     uint32_t ctlv = 0;
@@ -268,8 +393,8 @@ rpi_gpclk0_set_hz(rpi_gpio_t *rg, uint32_t hz, uint32_t src, uint32_t mash)
     ctlv |= ((mash & 3u) << CM_CTL_MASH_SHIFT);
     ctlv |= CM_CTL_ENAB;
 
-    *ctl = CM_PASSWD | ctlv;
-    mmio_barrier();
+    cm_store(rg, CM_GP0CTL, CM_PASSWD | ctlv);
+    mmio_barrier(rg);
 
     return 1;
 }
@@ -297,12 +422,10 @@ rpi_gpio_clock_enable(rpi_gpio_t *rg, int clock_pin, uint32_t clock_hz)
 static void
 rpi_gpio_clock_disable(rpi_gpio_t *rg)
 {
-    volatile uint32_t *ctl = &rg->cm[CM_GP0CTL / 4];
-
     /* disable */
-    *ctl = CM_PASSWD | (*ctl & ~CM_CTL_ENAB);
-    mmio_barrier();
-    cm_wait_not_busy(ctl);
+    cm_store(rg, CM_GP0CTL, CM_PASSWD | (cm_load(rg, CM_GP0CTL) & ~CM_CTL_ENAB));
+    mmio_barrier(rg);
+    cm_wait_not_busy(rg);
 }
 
 static void
@@ -316,73 +439,55 @@ gpio_config(rpi_gpio_t *rg)
     gpio_config_output(rg, PIN_RESET);
 }
 
-/* Write multiple pins at once: set_mask bits become 1, clr_mask bits become 0 */
+/*
+ * Write multiple pins at once without a trailing barrier.
+ * Stores to the same GPIO block are not reordered against each other,
+ * so the batch path only needs barriers around the wait reads.
+ */
 static inline void
-gpio_write_masks(rpi_gpio_t *rg, uint32_t set_mask, uint32_t clr_mask)
+gpio_write_masks_nb(rpi_gpio_t *rg, uint32_t set_mask, uint32_t clr_mask)
 {
-    volatile uint32_t *gpio = rg->gpio;
     if (clr_mask)
-        gpio[GPCLR0 / 4] = clr_mask;
+        gpio_store(rg, GPCLR0, clr_mask);
     if (set_mask)
-        gpio[GPSET0 / 4] = set_mask;
-    mmio_barrier();
+        gpio_store(rg, GPSET0, set_mask);
+}
+
+/* Write multiple pins at once: set_mask bits become 1, clr_mask bits become 0 */
+static inline void
+gpio_write_masks(rpi_gpio_t *rg, uint32_t set_mask, uint32_t clr_mask)
+{
+    gpio_write_masks_nb(rg, set_mask, clr_mask);
+    mmio_barrier(rg);
 }
 
 /* Dummy GPIO register reads for wait by I/O */
 static inline void
-gpio_wait(rpi_gpio_t *rg)
+gpio_wait(rpi_gpio_t *rg, uint32_t nread)
 {
-    volatile uint32_t *gpio = rg->gpio;
-    volatile uint32_t dummy;
-    for (unsigned int i = 0; i < NREAD_WAIT; i++) {
-        dummy = gpio[GPCLR0 / 4];
-        (void)dummy;
-        dummy = gpio[GPSET0 / 4];
-        (void)dummy;
+    for (uint32_t i = 0; i < nread; i++) {
+        (void)gpio_load(rg, GPCLR0);
+        (void)gpio_load(rg, GPSET0);
     }
-    mmio_barrier();
+    mmio_barrier(rg);
 }
 
-/* Put value on data bus GPIOs in one operation (2 stores: clear then set) */
+/* Put value on data bus GPIOs (clear only the bits that fall, then set) */
 static inline void
 bus_write8(rpi_gpio_t *rg, uint8_t v)
 {
-    uint32_t setm = ((uint32_t)v << PIN_D0) & MASK_DATABUS;
-    uint32_t clrm = MASK_DATABUS & ~setm;
-    gpio_write_masks(rg, setm, clrm);
+    gpio_write_masks(rg, ((uint32_t)v << PIN_D0) & MASK_DATABUS,
+        ((uint32_t)(rg->bs.bus & ~v) << PIN_D0) & MASK_DATABUS);
+    rg->bs.bus = v;
 }
 
-/*
- * YM2149/AY-3-8910 bus control (BC2 fixed HIGH):
- *   BDIR BC1  Function
- *    0    0   Inactive
- *    0    1   Read  (unused here)
- *    1    0   Write (data)
- *    1    1   Latch address
- */
+/* BDIR / BC1 low: every bus cycle ends in inactive */
 static inline void
 ctrl_inactive(rpi_gpio_t *rg)
 {
     gpio_write_masks(rg, 0, MASK_CTRL);
 }
 
-static inline void
-ctrl_latch_addr(rpi_gpio_t *rg)
-{
-    /* set both in one shot (no intermediate state) */
-    gpio_write_masks(rg, MASK_CTRL, 0);
-}
-
-static inline void
-ctrl_write_data(rpi_gpio_t *rg)
-{
-    /*
-     * Ensure BC1=0 first; then set BDIR=1 (can be two stores but very tight).
-     * If we always go through inactive before write, we can do just "set BDIR".
-     */
-    gpio_write_masks(rg, MASK_BDIR, MASK_BC1);
-}
-
 static void
 ym_reset_pulse(rpi_gpio_t *rg)
 {
@@ -393,101 +498,263 @@ ym_reset_pulse(rpi_gpio_t *rg)
     usleep(1000);
     gpio_write_masks(rg, 0, MASK_RESET);      /* deassert = 0 */
     usleep(1000);
+
+    /* リセット後のアドレスラッチは当てにしない */
+    rg->bs.latch = -1;
 }
 
+/* ---- bus cycles (psg_bus.h) ---- */
+
+static inline void
+port_clr(void *ctx, uint8_t fall)
+{
+    gpio_store(ctx, GPCLR0, ((uint32_t)fall << PIN_D0) & MASK_DATABUS);
+}
+
+static inline void
+port_set(void *ctx, uint8_t v, int cycle)
+{
+    gpio_store(ctx, GPSET0, (((uint32_t)v << PIN_D0) & MASK_DATABUS) |
+        ((cycle == PSG_BUS_LATCH) ? MASK_CTRL : MASK_BDIR));
+}
+
+/* address setup / write pulse time of the chip */
+static inline void
+port_wait(void *ctx, int cycle)
+{
+    rpi_gpio_t *rg = ctx;
+
+    gpio_wait(rg, (cycle == PSG_BUS_LATCH) ?
+        rg->timing.nread_addr : rg->timing.nread_data);
+}
+
+static inline void
+port_end(void *ctx)
+{
+    gpio_store(ctx, GPCLR0, MASK_CTRL);
+}
+
+static inline void
+port_barrier(void *ctx)
+{
+    mmio_barrier(ctx);
+}
+
+static const psg_bus_port_t g_port = {
+    port_clr, port_set, port_wait, port_end, port_barrier
+};
+
 static void
-ym_latch_addr(rpi_gpio_t *rg, uint8_t reg)
+ym_write_reg_raw(rpi_gpio_t *rg, uint8_t reg, uint8_t val)
 {
-    bus_write8(rg, reg & 0x0f);
-    ctrl_latch_addr(rg);
-    /* Wait address setup time: 300 ns on YM2149F, 400 ns on AY-3-8910 */
-    gpio_wait(rg);
-    ctrl_inactive(rg);
+    psg_bus_write(&g_port, rg, &rg->bs, reg, val, 1);
 }
 
+/*
+ * Pipelined register writes for a whole batch.
+ * Compared to ym_write_reg_raw() this drops the per-store barriers
+ * (gpio_wait() still ends with one).  wh != NULL times each write.
+ */
 static void
-ym_write_data(rpi_gpio_t *rg, uint8_t data)
+ym_write_regs_raw(rpi_gpio_t *rg, const psg_regval_t *rv, size_t n,
+    psg_hist_t *wh)
 {
-    bus_write8(rg, data);
-    /* recommended: always start from inactive so only BDIR needs to be raised */
-    ctrl_inactive(rg);
-    ctrl_write_data(rg);
-    /* Wait write signal time: 300 ns on YM2149F, 500 ns on AY-3-8910 */
-    gpio_wait(rg);
-    ctrl_inactive(rg);
+    uint64_t tw = (wh != NULL) ? nsec_now_monotonic() : 0;
+
+    for (size_t i = 0; i < n; i++) {
+        psg_bus_write(&g_port, rg, &rg->bs, rv[i].reg, rv[i].val, 0);
+
+        if (__builtin_expect(wh != NULL, 0)) {
+            uint64_t t = nsec_now_monotonic();
+            psg_hist_add(wh, t - tw);
+            tw = t;
+        }
+    }
+    mmio_barrier(rg);
 }
 
+/* ---- bus timing calibration ---- */
+
+/*
+ * Time the wait loop and derive the counts for the chip.  The fastest
+ * run is used so that the waits are long enough even when nothing
+ * else slows the bus down; the stores around the wait only add to it.
+ */
 static void
-ym_write_reg_raw(rpi_gpio_t *rg, uint8_t reg, uint8_t val)
+rpi_gpio_calibrate(rpi_gpio_t *rg)
 {
-    ym_latch_addr(rg, reg);
-    ym_write_data(rg, val);
+    psg_rpi_gpio_timing_t *tm = &rg->timing;
+    uint64_t best = UINT64_MAX;
+
+    uint64_t warm = nsec_now_monotonic() + WAIT_CAL_WARMUP_NS;
+    while (nsec_now_monotonic() < warm)
+        gpio_wait(rg, WAIT_CAL_ITER);
+
+    for (int run = 0; run < WAIT_CAL_RUNS; run++) {
+        uint64_t t0 = nsec_now_monotonic();
+        gpio_wait(rg, WAIT_CAL_ITER);
+        uint64_t t1 = nsec_now_monotonic();
+        if (t1 - t0 < best)
+            best = t1 - t0;
+    }
+    tm->read_pair_ps = (uint32_t)(best * 1000u / WAIT_CAL_ITER);
+    if (tm->read_pair_ps == 0)
+        tm->read_pair_ps = 1;
+
+    tm->margin_pct = PSG_BUS_WAIT_MARGIN_PCT;
+    tm->nread_addr = psg_bus_nread_for_ns(
+        psg_bus_chip_timing[tm->chip].addr_ns, tm->read_pair_ps);
+    tm->nread_data = psg_bus_nread_for_ns(
+        psg_bus_chip_timing[tm->chip].data_ns, tm->read_pair_ps);
+}
+
+/*
+ * writes per second of both write paths, from writes alternating
+ * between R14 and R15 (I/O ports) so that each one needs a latch
+ */
+static void
+rpi_gpio_measure(rpi_gpio_t *rg)
+{
+    psg_rpi_gpio_timing_t *tm = &rg->timing;
+    psg_regval_t rv[WRITE_CAL_N];
+
+    for (size_t i = 0; i < WRITE_CAL_N; i++) {
+        rv[i].reg = (i & 1) ? AY_PORTB : AY_PORTA;
+        rv[i].val = (uint8_t)i;
+    }
+
+    uint64_t t0 = nsec_now_monotonic();
+    ym_write_regs_raw(rg, rv, WRITE_CAL_N, NULL);
+    uint64_t t1 = nsec_now_monotonic();
+    for (size_t i = 0; i < WRITE_CAL_N; i++)
+        ym_write_reg_raw(rg, rv[i].reg, rv[i].val);
+    uint64_t t2 = nsec_now_monotonic();
+
+    tm->writes_per_sec = (t1 > t0) ?
+        (uint32_t)(WRITE_CAL_N * 1000000000ull / (t1 - t0)) : 0;
+    tm->writes_per_sec_single = (t2 > t1) ?
+        (uint32_t)(WRITE_CAL_N * 1000000000ull / (t2 - t1)) : 0;
 }
 
 /* ---- backend ops ---- */
 
+/*
+ * Map the GPIO and CM blocks.  /dev/mem (or another character device)
+ * is mapped at the peripheral base; a plain file or anonymous memory
+ * stands in for the registers when the bus logic runs off-Pi.
+ */
 static int
-rpi_gpio_init(psg_backend_t *psgbe)
+rpi_gpio_map(psg_backend_t *psgbe, rpi_gpio_t *rg)
 {
-    if (psgbe == NULL)
-        return 0;
-
-    /* エラーメッセージ初期化 */
-    psgbe->last_error[0] = '\0';
-
-    rpi_gpio_t *rg = calloc(1, sizeof(*rg));
-    if (rg == NULL) {
-        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
-            "calloc(ctx): out of memory");
-        return 0;
+    off_t gpio_off = 0, cm_off = GPIO_SIZE;
+    void *p, *cm;
+
+    if (rg->soc == NULL)
+        rg->soc = detect_soc_profile();
+
+    if (rg->path == NULL) {
+        p = mmap(NULL, GPIO_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANON, -1, 0);
+        cm = mmap(NULL, CM_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANON, -1, 0);
+        if (p == MAP_FAILED || cm == MAP_FAILED) {
+            snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+                "mmap(anonymous): %s", strerror(errno));
+            if (p != MAP_FAILED)
+                munmap(p, GPIO_SIZE);
+            if (cm != MAP_FAILED)
+                munmap(cm, CM_SIZE);
+            return 0;
+        }
+        rg->gpio = (volatile uint32_t *)p;
+        rg->cm = (volatile uint32_t *)cm;
+        return 1;
     }
 
-    rg->fd = open("/dev/mem", O_RDWR | O_SYNC);
+    /* a missing device must fail, not turn into a file */
+    rg->fd = open(rg->path, O_RDWR | O_SYNC | (rg->create ? O_CREAT : 0),
+        0644);
     if (rg->fd == -1) {
         snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
-            "open(/dev/mem): %s", strerror(errno));
-        free(rg);
+            "open(%s): %s", rg->path, strerror(errno));
         return 0;
     }
 
-    rg->soc = detect_soc_profile();
+    struct stat sb;
+    if (fstat(rg->fd, &sb) == -1) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "fstat(%s): %s", rg->path, strerror(errno));
+        goto fail;
+    }
+    if (S_ISCHR(sb.st_mode)) {
+        gpio_off = rg->soc->peri_base + GPIO_OFFSET;
+        cm_off = rg->soc->peri_base + CM_OFFSET;
+    } else if (!rg->create || !S_ISREG(sb.st_mode)) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "%s: not a memory device", rg->path);
+        goto fail;
+    } else if (sb.st_size < (off_t)(GPIO_SIZE + CM_SIZE) &&
+        ftruncate(rg->fd, GPIO_SIZE + CM_SIZE) == -1) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "ftruncate(%s): %s", rg->path, strerror(errno));
+        goto fail;
+    }
 
-    void *p = mmap(NULL, GPIO_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
-                   rg->fd, rg->soc->peri_base + GPIO_OFFSET);
+    p = mmap(NULL, GPIO_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+             rg->fd, gpio_off);
     if (p == MAP_FAILED) {
         snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
-            "mmap(GPIO @0x%08x): %s",
-            (unsigned int)(rg->soc->peri_base + GPIO_OFFSET), strerror(errno));
-        close(rg->fd);
-        free(rg);
-        return 0;
+            "mmap(GPIO @0x%08x): %s", (unsigned int)gpio_off, strerror(errno));
+        goto fail;
     }
     rg->gpio = (volatile uint32_t *)p;
 
-    gpio_config(rg);
-
-    void *cm = mmap(NULL, CM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
-                   rg->fd, rg->soc->peri_base + CM_OFFSET);
+    cm = mmap(NULL, CM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+              rg->fd, cm_off);
     if (cm == MAP_FAILED) {
         snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
-            "mmap(CM @0x%08x): %s",
-            (unsigned int)(rg->soc->peri_base + CM_OFFSET), strerror(errno));
+            "mmap(CM @0x%08x): %s", (unsigned int)cm_off, strerror(errno));
         munmap((void *)rg->gpio, GPIO_SIZE);
-        close(rg->fd);
-        free(rg);
-        return 0;
+        rg->gpio = NULL;
+        goto fail;
     }
     rg->cm = (volatile uint32_t *)cm;
+    return 1;
 
-    /* enable clock by CM */
-    uint32_t psgclock = 2000000;
-    rpi_gpio_clock_enable(rg, PIN_CLOCK, psgclock);
+ fail:
+    close(rg->fd);
+    rg->fd = -1;
+    return 0;
+}
 
-    /* Safe default: inactive bus, deassert reset, clear data bus */
-    ctrl_inactive(rg);
-    bus_write8(rg, 0x00);
-    gpio_write_masks(rg, 0, MASK_RESET);
+static int
+rpi_gpio_init(psg_backend_t *psgbe)
+{
+    if (psgbe == NULL)
+        return 0;
 
+    /* エラーメッセージ初期化 */
+    psgbe->last_error[0] = '\0';
+
+    rpi_gpio_t *rg = calloc(1, sizeof(*rg));
+    if (rg == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "calloc(ctx): out of memory");
+        return 0;
+    }
+    rg->path = strdup("/dev/mem");
+    if (rg->path == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "strdup(path): out of memory");
+        free(rg);
+        return 0;
+    }
+    rg->fd = -1;
+    rg->bs.bus = 0xff;
+    rg->bs.latch = -1;
+    rg->timing.chip = PSG_RPI_GPIO_CHIP_YM2149;
+
+    /* レジスタの mmap と GPIO / クロックの設定は最初の enable で行う */
     rg->enabled = 0;
     psgbe->ctx = rg;
     return 1;
@@ -501,11 +768,13 @@ rpi_gpio_fini(psg_backend_t *psgbe)
 
     rpi_gpio_t *rg = psgbe->ctx;
 
-    ctrl_inactive(rg);
-    gpio_write_masks(rg, 0, MASK_RESET);
+    if (rg->mapped) {
+        ctrl_inactive(rg);
+        gpio_write_masks(rg, 0, MASK_RESET);
 
-    /* disable clock by CM */
-    rpi_gpio_clock_disable(rg);
+        /* disable clock by CM */
+        rpi_gpio_clock_disable(rg);
+    }
 
     if (rg->cm != NULL)
         munmap((void *)rg->cm, CM_SIZE);
@@ -514,6 +783,8 @@ rpi_gpio_fini(psg_backend_t *psgbe)
     if (rg->fd != -1)
         close(rg->fd);
 
+    free(rg->hist);
+    free(rg->path);
     free(rg);
     psgbe->ctx = NULL;
 }
@@ -532,7 +803,37 @@ rpi_gpio_enable(psg_backend_t *psgbe)
 
     rpi_gpio_t *rg = psgbe->ctx;
 
-    /* GPIO の場合 init で初期化済みなので何もしない */
+    if (rg->mapped == 0) {
+        if (rpi_gpio_map(psgbe, rg) == 0)
+            return 0;
+        rg->mapped = 1;
+
+        gpio_config(rg);
+
+        /* enable clock by CM */
+        uint32_t psgclock = 2000000;
+        rpi_gpio_clock_enable(rg, PIN_CLOCK, psgclock);
+
+        /* Safe default: inactive bus, deassert reset, clear data bus */
+        ctrl_inactive(rg);
+        bus_write8(rg, 0x00);
+        gpio_write_masks(rg, 0, MASK_RESET);
+
+        /* バスのウェイト: 計測して決めるか固定値 */
+        if (rg->nread_fixed == 0) {
+            psg_rpi_gpio_trace_fn trace = rg->trace;
+            rg->trace = NULL;
+            rpi_gpio_calibrate(rg);
+            if (trace == NULL)
+                rpi_gpio_measure(rg);
+            rg->trace = trace;
+        } else {
+            rg->timing.nread_addr = rg->nread_fixed;
+            rg->timing.nread_data = rg->nread_fixed;
+            rg->timing.margin_pct = 0;
+        }
+    }
+
     rg->enabled = 1;
     return 1;
 }
@@ -544,6 +845,8 @@ rpi_gpio_disable(psg_backend_t *psgbe)
         return;
 
     rpi_gpio_t *rg = psgbe->ctx;
+    if (rg->mapped == 0)
+        return;
 
     if (rg->enabled != 0) {
         /* サウンド出力を止める */
@@ -602,10 +905,294 @@ rpi_gpio_write_reg(psg_backend_t *psgbe, uint8_t reg, uint8_t val)
         return 0;
     }
 
+    if (__builtin_expect(rg->hist != NULL, 0)) {
+        uint64_t t0 = nsec_now_monotonic();
+        ym_write_reg_raw(rg, reg, val);
+        psg_hist_add(&rg->hist->write, nsec_now_monotonic() - t0);
+        return 1;
+    }
     ym_write_reg_raw(rg, reg, val);
     return 1;
 }
 
+static int
+rpi_gpio_write_regs(psg_backend_t *psgbe, const psg_regval_t *rv, size_t n)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "write_regs: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    rpi_gpio_t *rg = psgbe->ctx;
+    if (rg->enabled == 0) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "write_regs: backend is disabled");
+        return 0;
+    }
+
+    psg_rpi_gpio_hist_t *hist = rg->hist;
+    uint64_t t0 = (hist != NULL) ? nsec_now_monotonic() : 0;
+
+    /* put writes to the latched register first, in chunks */
+    psg_regval_t ord[PSG_BUS_ORDER_MAX];
+    while (n > 0) {
+        size_t k = (n < PSG_BUS_ORDER_MAX) ? n : PSG_BUS_ORDER_MAX;
+        psg_backend_order_latch(ord, rv, k, rg->bs.latch);
+        ym_write_regs_raw(rg, ord, k, (hist != NULL) ? &hist->write : NULL);
+        rv += k;
+        n -= k;
+    }
+
+    if (hist != NULL)
+        psg_hist_add(&hist->burst, nsec_now_monotonic() - t0);
+    return 1;
+}
+
+int
+psg_backend_rpi_gpio_configure(psg_backend_t *psgbe,
+    const psg_rpi_gpio_mmio_t *mmio)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    rpi_gpio_t *rg = psgbe->ctx;
+    if (rg->mapped) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: registers are already mapped");
+        return 0;
+    }
+
+    const rpi_soc_profile_t *soc = NULL;
+    if (mmio->soc != NULL) {
+        for (size_t i = 0;
+            i < sizeof(g_soc_names) / sizeof(g_soc_names[0]); i++) {
+            if (strcasecmp(g_soc_names[i].name, mmio->soc) == 0) {
+                soc = &g_soc_profiles[g_soc_names[i].idx];
+                break;
+            }
+        }
+        if (soc == NULL) {
+            snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+                "configure: unknown SoC %s", mmio->soc);
+            return 0;
+        }
+    }
+
+    char *p = NULL;
+    if (mmio->path != NULL && (p = strdup(mmio->path)) == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "configure: out of memory");
+        return 0;
+    }
+    free(rg->path);
+    rg->path = p;
+    rg->create = (p != NULL && strncmp(p, "/dev/", 5) != 0);
+    rg->soc = soc;
+    rg->trace = mmio->trace;
+    rg->trace_opaque = mmio->opaque;
+    return 1;
+}
+
+int
+psg_backend_rpi_gpio_set_timing(psg_backend_t *psgbe, int chip,
+    uint32_t nread)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "set_timing: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    rpi_gpio_t *rg = psgbe->ctx;
+    if (rg->mapped) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "set_timing: registers are already mapped");
+        return 0;
+    }
+    if (chip < 0 || chip >= PSG_RPI_GPIO_CHIP_COUNT ||
+        nread > PSG_BUS_NREAD_MAX) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "set_timing: invalid chip %d / wait count %u", chip, nread);
+        return 0;
+    }
+
+    rg->timing.chip = chip;
+    rg->nread_fixed = nread;
+    return 1;
+}
+
+int
+psg_backend_rpi_gpio_timing(psg_backend_t *psgbe,
+    psg_rpi_gpio_timing_t *timing)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return 0;
+
+    rpi_gpio_t *rg = psgbe->ctx;
+    *timing = rg->timing;
+    return 1;
+}
+
+int
+psg_backend_rpi_gpio_set_hist(psg_backend_t *psgbe, int on)
+{
+    if (psgbe == NULL)
+        return 0;
+
+    if (psgbe->ctx == NULL) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "set_hist: ctx is NULL (not initialized?)");
+        return 0;
+    }
+
+    rpi_gpio_t *rg = psgbe->ctx;
+    if (rg->enabled) {
+        snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+            "set_hist: backend is enabled");
+        return 0;
+    }
+
+    if (on && rg->hist == NULL) {
+        rg->hist = calloc(1, sizeof(*rg->hist));
+        if (rg->hist == NULL) {
+            snprintf(psgbe->last_error, PSG_BACKEND_LAST_ERROR_MAXLEN,
+                "set_hist: out of memory");
+            return 0;
+        }
+    } else if (!on) {
+        free(rg->hist);
+        rg->hist = NULL;
+    }
+    return 1;
+}
+
+int
+psg_backend_rpi_gpio_hist(psg_backend_t *psgbe, psg_rpi_gpio_hist_t *hist)
+{
+    if (psgbe == NULL || psgbe->ctx == NULL)
+        return 0;
+
+    rpi_gpio_t *rg = psgbe->ctx;
+    if (rg->hist == NULL)
+        return 0;
+    *hist = *rg->hist;
+    return 1;
+}
+
+/* ---- bus decoder ---- */
+
+/* bus cycles: BDIR << 1 | BC1 (BC2 fixed high) */
+enum {
+    CYCLE_INACTIVE = 0,
+    CYCLE_READ,
+    CYCLE_WRITE,
+    CYCLE_LATCH,
+};
+
+static void
+decode_error(psg_rpi_gpio_decoder_t *dec, const char *what)
+{
+    if (dec->errors++ == 0) {
+        snprintf(dec->error, sizeof(dec->error), "%s (store #%llu)",
+            what, (unsigned long long)dec->stores);
+    }
+}
+
+void
+psg_rpi_gpio_decoder_init(psg_rpi_gpio_decoder_t *dec,
+    psg_rpi_gpio_write_fn on_write, void *opaque)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->on_write = on_write;
+    dec->opaque = opaque;
+    dec->wait_min = UINT32_MAX;
+}
+
+void
+psg_rpi_gpio_decode(void *opaque, const psg_rpi_gpio_op_t *op)
+{
+    psg_rpi_gpio_decoder_t *dec = opaque;
+
+    if (op->blk != PSG_RPI_GPIO_BLK_GPIO)
+        return;
+
+    switch (op->op) {
+    case PSG_RPI_GPIO_OP_LOAD:
+        dec->loads++;
+        dec->cycle_loads++;
+        return;
+    case PSG_RPI_GPIO_OP_BARRIER:
+        dec->barriers++;
+        return;
+    default:
+        break;
+    }
+
+    dec->stores++;
+    uint32_t prev = dec->level;
+    if (op->off == GPSET0)
+        dec->level |= op->val;
+    else if (op->off == GPCLR0)
+        dec->level &= ~op->val;
+    else
+        return;                 /* GPFSEL */
+
+    if ((dec->level & ~prev & MASK_RESET) != 0) {
+        dec->resets++;
+        dec->addr_valid = 0;
+    }
+
+    uint8_t cycle = (uint8_t)(((dec->level & MASK_BDIR) ? 2 : 0) |
+        ((dec->level & MASK_BC1) ? 1 : 0));
+    uint32_t bus = (dec->level & MASK_DATABUS) >> PIN_D0;
+
+    /* the data bus must hold still while BDIR / BC1 are active */
+    if (dec->cycle != CYCLE_INACTIVE && bus != dec->cycle_bus) {
+        decode_error(dec, "data bus changed during a bus cycle");
+        dec->cycle_bus = bus;
+    }
+    if (cycle == dec->cycle)
+        return;
+
+    /* end of a cycle: the chip takes the bus on the falling edge */
+    if (dec->cycle == CYCLE_LATCH || dec->cycle == CYCLE_WRITE) {
+        if (dec->cycle_loads < dec->wait_min)
+            dec->wait_min = dec->cycle_loads;
+    }
+    if (dec->cycle == CYCLE_LATCH) {
+        dec->latches++;
+        if ((dec->cycle_bus & 0xf0) != 0)
+            decode_error(dec, "address does not select the chip");
+        dec->addr = (uint8_t)(dec->cycle_bus & 0x0f);
+        dec->addr_valid = 1;
+    } else if (dec->cycle == CYCLE_WRITE) {
+        dec->writes++;
+        if (dec->addr_valid == 0)
+            decode_error(dec, "data write without an address");
+        else if (dec->on_write != NULL)
+            (*dec->on_write)(dec->opaque, dec->addr, (uint8_t)dec->cycle_bus);
+    }
+
+    dec->cycle = cycle;
+    dec->cycle_bus = bus;
+    dec->cycle_loads = 0;
+    if (cycle == CYCLE_READ)
+        decode_error(dec, "read cycle");
+}
+
 void
 psg_backend_rpi_gpio_bind(psg_backend_ops_t *ops)
 {
@@ -617,4 +1204,5 @@ psg_backend_rpi_gpio_bind(psg_backend_ops_t *ops)
     ops->disable   = rpi_gpio_disable;
     ops->reset     = rpi_gpio_reset;
     ops->write_reg = rpi_gpio_write_reg;
+    ops->write_regs = rpi_gpio_write_regs;
 }
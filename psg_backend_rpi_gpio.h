@@ -3,8 +3,155 @@
 #ifndef PSG_BACKEND_RPI_GPIO_H
 #define PSG_BACKEND_RPI_GPIO_H
 
+#include <stdint.h>
+
 #include "psg_backend.h"
+#include "psg_hist.h"
 
 void psg_backend_rpi_gpio_bind(psg_backend_ops_t *ops);
 
+/* ---- MMIO source and trace ---- */
+
+/* traced MMIO operation */
+enum {
+    PSG_RPI_GPIO_OP_STORE = 0,
+    PSG_RPI_GPIO_OP_LOAD,
+    PSG_RPI_GPIO_OP_BARRIER,
+};
+
+/* register block of an operation */
+enum {
+    PSG_RPI_GPIO_BLK_GPIO = 0,
+    PSG_RPI_GPIO_BLK_CM,
+};
+
+typedef struct {
+    uint8_t  op;                /* PSG_RPI_GPIO_OP_xxx */
+    uint8_t  blk;               /* PSG_RPI_GPIO_BLK_xxx (barriers: GPIO) */
+    uint16_t off;               /* byte offset in the block */
+    uint32_t val;               /* value stored / loaded */
+} psg_rpi_gpio_op_t;
+
+/* called after every MMIO operation, in program order */
+typedef void (*psg_rpi_gpio_trace_fn)(void *opaque,
+    const psg_rpi_gpio_op_t *op);
+
+typedef struct {
+    /*
+     * mmap source: a character device (the default "/dev/mem") is
+     * mapped at the peripheral base of the SoC, a plain file holds the
+     * GPIO block at offset 0 and the CM block after it (the file is
+     * created and extended as needed), NULL maps anonymous memory.
+     * Paths under /dev/ must be character devices.
+     */
+    const char *path;
+    const char *soc;            /* "BCM2835", "BCM2836", "BCM2837" or
+                                   "BCM2711" (any case); NULL: detect */
+    psg_rpi_gpio_trace_fn trace;        /* NULL: no trace */
+    void *opaque;
+} psg_rpi_gpio_mmio_t;
+
+/*
+ * Select the MMIO source and trace hook, so that the bus logic can run
+ * without a Raspberry Pi.  Valid after init, before the first enable
+ * (which maps the registers).
+ */
+int psg_backend_rpi_gpio_configure(psg_backend_t *psgbe,
+    const psg_rpi_gpio_mmio_t *mmio);
+
+/* ---- bus timing ---- */
+
+/* chip types: address setup / write pulse times */
+enum {
+    PSG_RPI_GPIO_CHIP_YM2149 = 0,       /* 300 ns / 300 ns */
+    PSG_RPI_GPIO_CHIP_AY8910,           /* 400 ns / 500 ns */
+    PSG_RPI_GPIO_CHIP_COUNT
+};
+
+/* wait loop count without calibration (tuned once for the AY-3-8910) */
+#define PSG_RPI_GPIO_NREAD_DEFAULT  3u
+
+typedef struct {
+    int      chip;              /* PSG_RPI_GPIO_CHIP_xxx */
+    uint32_t read_pair_ps;      /* one wait loop iteration (0: not calibrated) */
+    uint32_t nread_addr;        /* wait loop count, address latch cycle */
+    uint32_t nread_data;        /* wait loop count, data write cycle */
+    uint32_t margin_pct;        /* calibrated counts: setup time + % + 1 */
+    uint32_t writes_per_sec;    /* measured, batched writes (0: not measured) */
+    uint32_t writes_per_sec_single;     /* measured, one write per call */
+} psg_rpi_gpio_timing_t;
+
+/*
+ * Chip type and wait loop count (0: calibrate).  Valid after init,
+ * before the first enable.  Calibration times the wait loop on the
+ * mapped registers at enable, after a short busy warm-up so that
+ * cpufreq has raised the clock.  It takes the count that covers the
+ * chip's setup times plus PSG_BUS_WAIT_MARGIN_PCT and one read.
+ * Unless a trace hook is set, the write rate is then measured with
+ * writes to R14 / R15 (I/O ports).  By default the chip is a YM2149
+ * and the count is calibrated.
+ */
+int psg_backend_rpi_gpio_set_timing(psg_backend_t *psgbe, int chip,
+    uint32_t nread);
+
+/* timing in effect (calibration results once enabled) */
+int psg_backend_rpi_gpio_timing(psg_backend_t *psgbe,
+    psg_rpi_gpio_timing_t *timing);
+
+/* ---- latency histograms ---- */
+
+typedef struct {
+    psg_hist_t write;           /* one register write, latch + data */
+    psg_hist_t burst;           /* one write_regs call (a tick's writes) */
+} psg_rpi_gpio_hist_t;
+
+/*
+ * Time every write and burst into histograms (off by default; costs
+ * a clock read per write).  Valid while disabled.  In a batch the
+ * time of a write is the CPU time to issue it, the stores being posted
+ * until the barrier at the end of the burst.
+ */
+int psg_backend_rpi_gpio_set_hist(psg_backend_t *psgbe, int on);
+
+/* histograms so far; 0 if off.  Only exact while no write is running */
+int psg_backend_rpi_gpio_hist(psg_backend_t *psgbe,
+    psg_rpi_gpio_hist_t *hist);
+
+/* ---- bus decoder ---- */
+
+/*
+ * Rebuilds YM2149 bus cycles from the GPSET0 / GPCLR0 store sequence.
+ * psg_rpi_gpio_decode() has the trace hook signature, so a decoder can
+ * be attached directly (opaque = decoder) or fed from a recorded trace.
+ */
+typedef void (*psg_rpi_gpio_write_fn)(void *opaque, uint8_t reg, uint8_t val);
+
+typedef struct {
+    psg_rpi_gpio_write_fn on_write;     /* decoded register writes */
+    void *opaque;
+
+    uint32_t level;             /* GPIO 0..31 output levels */
+    uint8_t  cycle;             /* bus cycle in progress (BDIR << 1 | BC1) */
+    uint8_t  addr;              /* latched register */
+    uint8_t  addr_valid;
+    uint32_t cycle_bus;         /* data bus during the cycle */
+    uint32_t cycle_loads;       /* loads (wait) within the cycle */
+
+    /* GPIO block operations */
+    uint64_t stores;
+    uint64_t loads;
+    uint64_t barriers;
+
+    uint64_t latches;           /* address latch cycles */
+    uint64_t writes;            /* data write cycles */
+    uint64_t resets;            /* RESET pulses */
+    uint32_t wait_min;          /* fewest loads within a latch / write cycle */
+    uint64_t errors;            /* protocol violations */
+    char     error[128];        /* the first one */
+} psg_rpi_gpio_decoder_t;
+
+void psg_rpi_gpio_decoder_init(psg_rpi_gpio_decoder_t *dec,
+    psg_rpi_gpio_write_fn on_write, void *opaque);
+void psg_rpi_gpio_decode(void *dec, const psg_rpi_gpio_op_t *op);
+
 #endif /* PSG_BACKEND_RPI_GPIO_H */
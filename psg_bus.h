@@ -0,0 +1,131 @@
+/*
+ * psg_bus.h
+ *  YM2149 / AY-3-8910 write cycles on the GPIO bus
+ *
+ *  psg_backend_rpi_gpio.c drives the bus with these steps and
+ *  psg_backend_null.c charges their cost, so the model follows the
+ *  board.  A port supplies the MMIO operations of each step; the
+ *  functions are inline and the ports constant, so the calls resolve
+ *  at compile time.
+ */
+
+#ifndef PSG_BUS_H
+#define PSG_BUS_H
+
+#include <stdint.h>
+
+#include "psg_backend_rpi_gpio.h"
+
+/* address setup / write pulse times (ns) by chip type */
+static const struct {
+    uint32_t addr_ns;
+    uint32_t data_ns;
+} psg_bus_chip_timing[PSG_RPI_GPIO_CHIP_COUNT] = {
+    [PSG_RPI_GPIO_CHIP_YM2149] = { 300, 300 },    /* YM2149F */
+    [PSG_RPI_GPIO_CHIP_AY8910] = { 400, 500 },    /* AY-3-8910 */
+};
+
+/* calibrated waits: setup time + PSG_BUS_WAIT_MARGIN_PCT and one read */
+#define PSG_BUS_WAIT_MARGIN_PCT 25u
+#define PSG_BUS_NREAD_MAX       1024u
+
+/* wait loop count that lasts at least ns, with the margin */
+static inline uint32_t
+psg_bus_nread_for_ns(uint32_t ns, uint32_t pair_ps)
+{
+    uint64_t ps = (uint64_t)ns * 10u * (100u + PSG_BUS_WAIT_MARGIN_PCT);
+    uint64_t n = (ps + pair_ps - 1) / pair_ps + 1;
+
+    if (n < 1)
+        n = 1;
+    if (n > PSG_BUS_NREAD_MAX)
+        n = PSG_BUS_NREAD_MAX;
+    return (uint32_t)n;
+}
+
+/*
+ * Bus control (BC2 fixed HIGH):
+ *   BDIR BC1  Function
+ *    0    0   Inactive
+ *    0    1   Read  (unused here)
+ *    1    0   Write (data)
+ *    1    1   Latch address
+ */
+enum {
+    PSG_BUS_WRITE = 0,          /* BDIR */
+    PSG_BUS_LATCH,              /* BDIR + BC1 */
+};
+
+/*
+ * MMIO operations of the steps: clr stores GPCLR0 with the data bits
+ * that fall, set GPSET0 with v and the control bits of the cycle, wait
+ * covers the chip's setup time for the cycle and ends with a barrier,
+ * end stores GPCLR0 with BDIR / BC1.
+ */
+typedef struct {
+    void (*clr)(void *ctx, uint8_t fall);
+    void (*set)(void *ctx, uint8_t v, int cycle);
+    void (*wait)(void *ctx, int cycle);
+    void (*end)(void *ctx);
+    void (*barrier)(void *ctx);
+} psg_bus_port_t;
+
+/* batch chunk reordered for latch reuse, ended by a barrier */
+#define PSG_BUS_ORDER_MAX       32u
+
+/* bus state left by the last cycle (BDIR / BC1 always end low) */
+typedef struct {
+    uint8_t bus;                /* data bus output */
+    int latch;                  /* latched register, -1: unknown */
+} psg_bus_t;
+
+/*
+ * Put v on the data bus and start a cycle in the same GPSET0 store.
+ * Only the data bits that must fall need GPCLR0, which goes first; the
+ * chip takes the address or data on the falling edge of the cycle, so
+ * the bus only has to be settled within the wait that follows.
+ */
+static inline void
+psg_bus_start(const psg_bus_port_t *p, void *ctx, psg_bus_t *b, uint8_t v,
+    int cycle)
+{
+    uint8_t fall = b->bus & ~v;
+
+    if (fall)
+        (*p->clr)(ctx, fall);
+    (*p->set)(ctx, v, cycle);
+    b->bus = v;
+}
+
+/*
+ * One cycle: start, wait for the setup time, back to inactive.  sync
+ * adds barriers after the start and the end (single writes); a batch
+ * relies on the barrier of the wait and one at the end.
+ */
+static inline void
+psg_bus_cycle(const psg_bus_port_t *p, void *ctx, psg_bus_t *b, uint8_t v,
+    int cycle, int sync)
+{
+    psg_bus_start(p, ctx, b, v, cycle);
+    if (sync)
+        (*p->barrier)(ctx);
+    (*p->wait)(ctx, cycle);
+    (*p->end)(ctx);
+    if (sync)
+        (*p->barrier)(ctx);
+}
+
+/* the chip keeps the address latched, so a write to it needs no latch */
+static inline void
+psg_bus_write(const psg_bus_port_t *p, void *ctx, psg_bus_t *b, uint8_t reg,
+    uint8_t val, int sync)
+{
+    reg &= 0x0f;
+    if (b->latch != reg) {
+        psg_bus_cycle(p, ctx, b, reg, PSG_BUS_LATCH, sync);
+        b->latch = reg;
+    }
+    psg_bus_cycle(p, ctx, b, val, PSG_BUS_WRITE, sync);
+}
+
+#endif /* PSG_BUS_H */
@@ -0,0 +1,17 @@
+/*
+ * psg_compat.h
+ *  Portability shims for the command line tools
+ */
+
+#ifndef PSG_COMPAT_H
+#define PSG_COMPAT_H
+
+#include <stdlib.h>
+
+/* getprogname(3) is BSD; glibc has the same name under another spelling */
+#if defined(__GLIBC__)
+extern char *program_invocation_short_name;
+#define getprogname()   program_invocation_short_name
+#endif
+
+#endif /* PSG_COMPAT_H */
@@ -0,0 +1,433 @@
+/*
+ * psg_corpus.c
+ *  Parallel batch validator / analyzer for p6psg data
+ *
+ *  Loads, verifies, analyzes and plays through every given file
+ *  headlessly and prints one line of statistics per song.  Songs are
+ *  spread over worker threads with a small work-stealing queue: each
+ *  worker owns a contiguous range of song indices, takes songs from
+ *  the front of its own range and, once that is empty, steals the
+ *  back half of another worker's range.  PSGDriver instances are
+ *  independent, so workers share nothing but the queue.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "psg_compat.h"
+#include "p6psg.h"
+#include "psg_analyze.h"
+#include "psg_driver.h"
+
+/* driver tick period (see psg_play.c) */
+#define TICK_NS         2000000ull
+
+/* default playthrough limit: 30 minutes */
+#define DEFAULT_TICKS   (30u * 60u * 500u)
+
+#define MAX_WORKERS     256
+
+/* per-song result, written by whichever worker handled the song */
+typedef struct song_stat {
+    int ok;
+    char error[160];
+    PSGAnalysis ana;
+    uint32_t ticks;             /* ticks played through */
+    int truncated;              /* intro + loop not played in full */
+    uint64_t nwrites;
+    unsigned int peak_writes;   /* max register writes in one tick */
+} song_stat_t;
+
+/* playthrough write counter (driver callback context) */
+typedef struct song_play {
+    const PSGDriver *drv;
+    uint64_t nwrites;
+    uint32_t cur_tick;
+    unsigned int cur_writes;
+    unsigned int peak_writes;
+} song_play_t;
+
+/*
+ * Work queue: [lo, hi) of song indices packed as hi << 32 | lo so that
+ * both the owner (lo++) and a thief (hi -= n) update it with one CAS.
+ * Padded to a cache line so that workers do not false-share.
+ */
+struct corpus;
+
+typedef struct worker {
+    _Alignas(64) _Atomic uint64_t range;
+    struct corpus *corpus;
+    pthread_t thread;
+    unsigned int id;
+    unsigned int nsongs;        /* songs handled */
+    unsigned int nsteals;       /* successful steals */
+} worker_t;
+
+typedef struct corpus {
+    char **paths;
+    song_stat_t *stat;
+    unsigned int nsongs;
+    uint32_t max_ticks;
+    worker_t *workers;
+    unsigned int nworkers;
+} corpus_t;
+
+#define RANGE(lo, hi)   (((uint64_t)(hi) << 32) | (uint32_t)(lo))
+#define RANGE_LO(r)     ((uint32_t)(r))
+#define RANGE_HI(r)     ((uint32_t)((r) >> 32))
+
+/* --- timing helpers --- */
+static inline uint64_t
+nsec_now_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* take one song from the front of our own range */
+static int
+queue_pop(worker_t *w, uint32_t *idx)
+{
+    uint64_t r = atomic_load(&w->range);
+
+    for (;;) {
+        uint32_t lo = RANGE_LO(r), hi = RANGE_HI(r);
+
+        if (lo >= hi)
+            return 0;
+        if (atomic_compare_exchange_weak(&w->range, &r, RANGE(lo + 1, hi))) {
+            *idx = lo;
+            return 1;
+        }
+    }
+}
+
+/* move the back half of a victim's range into our (empty) range */
+static int
+queue_steal(corpus_t *c, worker_t *self)
+{
+    for (unsigned int k = 1; k < c->nworkers; k++) {
+        worker_t *v = &c->workers[(self->id + k) % c->nworkers];
+        uint64_t r = atomic_load(&v->range);
+
+        for (;;) {
+            uint32_t lo = RANGE_LO(r), hi = RANGE_HI(r);
+
+            if (lo >= hi)
+                break;
+            uint32_t n = (hi - lo + 1) / 2;
+            if (atomic_compare_exchange_weak(&v->range, &r,
+                RANGE(lo, hi - n))) {
+                atomic_store(&self->range, RANGE(hi - n, hi));
+                self->nsteals++;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void
+song_write_reg_cb(void *opaque, uint8_t reg, uint8_t val)
+{
+    song_play_t *p = opaque;
+    uint32_t tick = p->drv->tick_count;
+
+    (void)reg;
+    (void)val;
+    if (tick != p->cur_tick) {
+        p->cur_tick = tick;
+        p->cur_writes = 0;
+    }
+    p->nwrites++;
+    if (++p->cur_writes > p->peak_writes)
+        p->peak_writes = p->cur_writes;
+}
+
+/* load, verify, analyze and play one song */
+static void
+song_run(const char *path, uint32_t max_ticks, song_stat_t *st)
+{
+    p6psg_t *p6psg;
+    p6psg_channel_dataset_t channels;
+    PSGDriver drv;
+    song_play_t play;
+
+    memset(st, 0, sizeof(*st));
+
+    p6psg = p6psg_create();
+    if (p6psg == NULL) {
+        snprintf(st->error, sizeof(st->error), "out of memory");
+        return;
+    }
+    /* p6psg_load() also rejects unknown commands and broken loops */
+    if (p6psg_load(p6psg, path, &channels) == 0) {
+        snprintf(st->error, sizeof(st->error), "%s",
+            p6psg_last_error(p6psg));
+        goto out;
+    }
+
+    memset(&play, 0, sizeof(play));
+    play.drv = &drv;
+    play.cur_tick = UINT32_MAX;
+    psg_driver_init(&drv, song_write_reg_cb, NULL, &play);
+    for (int i = 0; i < P6PSG_CH_COUNT; i++)
+        psg_driver_set_channel_data(&drv, i, channels.ch[i].ptr);
+    psg_driver_start(&drv);
+
+    /* the init writes of start share tick_count 0 but are not tick 0's */
+    play.cur_tick = UINT32_MAX;
+    play.cur_writes = 0;
+    play.peak_writes = 0;
+
+    (void)psg_analyze(&drv, max_ticks, &st->ana);
+
+    /* play through the intro and one loop (or up to the end) */
+    uint32_t len = st->ana.complete ? st->ana.total_ticks : max_ticks;
+    if (!st->ana.complete || len > max_ticks) {
+        len = max_ticks;
+        st->truncated = 1;
+    }
+    while (drv.tick_count < len && psg_driver_is_active(&drv))
+        psg_driver_tick(&drv);
+    psg_driver_stop(&drv);
+
+    st->ticks = drv.tick_count;
+    st->nwrites = play.nwrites;
+    st->peak_writes = play.peak_writes;
+    st->ok = 1;
+
+ out:
+    p6psg_destroy(p6psg);
+}
+
+static void *
+worker_main(void *arg)
+{
+    worker_t *w = arg;
+    corpus_t *c = w->corpus;
+    uint32_t idx;
+
+    for (;;) {
+        while (queue_pop(w, &idx)) {
+            song_run(c->paths[idx], c->max_ticks, &c->stat[idx]);
+            w->nsongs++;
+        }
+        /* nothing is ever added back, so one failed pass means done */
+        if (!queue_steal(c, w))
+            break;
+    }
+    return NULL;
+}
+
+static void
+print_ticks(char *buf, size_t bufsz, uint32_t ticks)
+{
+    if (ticks == PSG_ANALYZE_NONE) {
+        snprintf(buf, bufsz, "-");
+        return;
+    }
+    unsigned int ms = (unsigned int)((uint64_t)ticks * TICK_NS / 1000000ull);
+    snprintf(buf, bufsz, "%u:%02u.%03u",
+        ms / 60000u, (ms / 1000u) % 60u, ms % 1000u);
+}
+
+/* read one path per line from a list file ("-": stdin) */
+static int
+read_list(const char *listname, char ***pathsp, unsigned int *np)
+{
+    FILE *fp;
+    char line[4096];
+    char **paths = *pathsp;
+    unsigned int n = *np, cap = *np;
+
+    fp = (strcmp(listname, "-") == 0) ? stdin : fopen(listname, "r");
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        if (n == cap) {
+            unsigned int ncap = (cap != 0) ? cap * 2 : 256;
+            char **p = realloc(paths, ncap * sizeof(*p));
+            if (p == NULL)
+                goto nomem;
+            paths = p;
+            cap = ncap;
+        }
+        if ((paths[n] = strdup(line)) == NULL)
+            goto nomem;
+        n++;
+    }
+    if (fp != stdin)
+        fclose(fp);
+    *pathsp = paths;
+    *np = n;
+    return 1;
+
+ nomem:
+    if (fp != stdin)
+        fclose(fp);
+    *pathsp = paths;
+    *np = n;
+    errno = ENOMEM;
+    return 0;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "Usage: %s [-j jobs] [-n ticks] [-f listfile] [p6psgfile ...]\n",
+        getprogname());
+
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+    corpus_t corpus, *c = &corpus;
+    const char *listname = NULL;
+    long njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int nfail = 0;
+    char *ep;
+
+    memset(c, 0, sizeof(*c));
+    c->max_ticks = DEFAULT_TICKS;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "f:j:n:")) != -1) {
+        switch (ch) {
+        case 'f':
+            listname = optarg;
+            break;
+        case 'j':
+            njobs = strtol(optarg, &ep, 10);
+            if (*optarg == '\0' || *ep != '\0' || njobs < 1)
+                usage();
+            break;
+        case 'n':
+            c->max_ticks = (uint32_t)strtoul(optarg, &ep, 0);
+            if (*optarg == '\0' || *ep != '\0')
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    for (int i = 0; i < argc; i++) {
+        char **p = realloc(c->paths, (c->nsongs + 1) * sizeof(*p));
+        if (p == NULL || (p[c->nsongs] = strdup(argv[i])) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        c->paths = p;
+        c->nsongs++;
+    }
+    if (listname != NULL && read_list(listname, &c->paths, &c->nsongs) == 0) {
+        perror(listname);
+        exit(EXIT_FAILURE);
+    }
+    if (c->nsongs == 0)
+        usage();
+
+    if (njobs < 1)
+        njobs = 1;
+    if (njobs > MAX_WORKERS)
+        njobs = MAX_WORKERS;
+    if ((unsigned long)njobs > c->nsongs)
+        njobs = c->nsongs;
+    c->nworkers = (unsigned int)njobs;
+
+    c->stat = calloc(c->nsongs, sizeof(*c->stat));
+    if (c->stat == NULL || posix_memalign((void **)&c->workers, 64,
+        c->nworkers * sizeof(*c->workers)) != 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(c->workers, 0, c->nworkers * sizeof(*c->workers));
+
+    /* initial split: equal contiguous ranges, stealing evens out the rest */
+    for (unsigned int i = 0; i < c->nworkers; i++) {
+        worker_t *w = &c->workers[i];
+        uint32_t lo = (uint32_t)((uint64_t)c->nsongs * i / c->nworkers);
+        uint32_t hi = (uint32_t)((uint64_t)c->nsongs * (i + 1) / c->nworkers);
+
+        w->corpus = c;
+        w->id = i;
+        atomic_init(&w->range, RANGE(lo, hi));
+    }
+
+    uint64_t t0 = nsec_now_monotonic();
+    for (unsigned int i = 1; i < c->nworkers; i++) {
+        int error = pthread_create(&c->workers[i].thread, NULL,
+            worker_main, &c->workers[i]);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            exit(EXIT_FAILURE);
+        }
+    }
+    worker_main(&c->workers[0]);
+    for (unsigned int i = 1; i < c->nworkers; i++)
+        pthread_join(c->workers[i].thread, NULL);
+    uint64_t t1 = nsec_now_monotonic();
+
+    /* report in input order */
+    printf("# %-9s %-11s %-11s %9s %5s  %s\n",
+        "result", "intro", "loop", "writes/s", "peak", "file");
+    uint64_t total_ticks = 0;
+    for (unsigned int i = 0; i < c->nsongs; i++) {
+        const song_stat_t *st = &c->stat[i];
+        char intro[32], loop[32];
+
+        if (!st->ok) {
+            printf("  %-9s %-11s %-11s %9s %5s  %s: %s\n",
+                "ERROR", "-", "-", "-", "-", c->paths[i], st->error);
+            nfail++;
+            continue;
+        }
+        print_ticks(intro, sizeof(intro), st->ana.intro_ticks);
+        if (st->ana.loop_ticks != 0)
+            print_ticks(loop, sizeof(loop), st->ana.loop_ticks);
+        else
+            snprintf(loop, sizeof(loop), "-");
+        double sec = (double)st->ticks * TICK_NS / 1e9;
+        printf("  %-9s %-11s %-11s %9.1f %5u  %s\n",
+            st->truncated ? "truncated" : "ok", intro, loop,
+            (sec > 0.0) ? st->nwrites / sec : 0.0, st->peak_writes,
+            c->paths[i]);
+        total_ticks += st->ticks;
+    }
+
+    double elapsed = (double)(t1 - t0) / 1e9;
+    fprintf(stderr, "%u songs (%u failed), %.1f s of music in %.3f s "
+        "with %u threads", c->nsongs, nfail,
+        (double)total_ticks * TICK_NS / 1e9, elapsed, c->nworkers);
+    if (elapsed > 0.0)
+        fprintf(stderr, ", %.0f songs/s", c->nsongs / elapsed);
+    fprintf(stderr, "\n");
+    for (unsigned int i = 0; i < c->nworkers; i++) {
+        fprintf(stderr, "  worker %u: %u songs, %u steals\n",
+            i, c->workers[i].nsongs, c->workers[i].nsteals);
+    }
+
+    for (unsigned int i = 0; i < c->nsongs; i++)
+        free(c->paths[i]);
+    free(c->paths);
+    free(c->stat);
+    free(c->workers);
+    exit((nfail != 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
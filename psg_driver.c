@@ -4,7 +4,6 @@
  */
 
 #include <string.h>
-#include <stdio.h>
 
 #include "psg_driver.h"
 #include "ym2149f.h"
@@ -70,13 +69,54 @@ calc_bpm_x10_from_t96(uint8_t t96)
     return (uint16_t)((12500u + (t96 / 2u)) / t96);
 }
 
-/* PSG レジスタ書き込みヘルパ */
+/* バッファ済みレジスタ書き込みをコールバックへ書き出す */
+static void
+psg_flush(PSGDriver *drv)
+{
+    if (drv->batch_len == 0)
+        return;
+
+    if (drv->write_regs) {
+        (*drv->write_regs)(drv->opaque, drv->batch, drv->batch_len);
+    } else if (drv->write_reg) {
+        for (unsigned int i = 0; i < drv->batch_len; i++) {
+            (*drv->write_reg)(drv->opaque,
+                              drv->batch[i].reg, drv->batch[i].val);
+        }
+    }
+    drv->batch_len = 0;
+}
+
+/*
+ * PSG レジスタ書き込みヘルパ
+ *  シャドウと同じ値の書き込みは実機では何も変わらないので捨てる。
+ *  ただし R13 (エンベロープ形状) は書き込み自体でエンベロープが
+ *  再スタートするので常に書く。
+ *  書き込みは tick 終了時 (psg_flush()) にまとめてコールバックへ渡す。
+ */
 static inline void
 psg_write(PSGDriver *drv, uint8_t reg, uint8_t val)
 {
-    if (drv->write_reg) {
-        (*drv->write_reg)(drv->opaque, reg, val);
+    const uint16_t bit = (uint16_t)(1u << (reg & 0x0f));
+
+    reg &= 0x0f;
+    if ((drv->reg_valid & bit) != 0 && drv->reg_shadow[reg] == val &&
+        reg != AY_ESHAPE)
+        return;
+    drv->reg_shadow[reg] = val;
+    drv->reg_valid |= bit;
+    if (drv->mute)
+        return;
+    if (drv->coalesce) {
+        drv->reg_dirty |= bit;
+        return;
     }
+
+    if (drv->batch_len >= PSG_WRITE_BATCH_MAX)
+        psg_flush(drv);
+    drv->batch[drv->batch_len].reg = reg;
+    drv->batch[drv->batch_len].val = val;
+    drv->batch_len++;
 }
 
 /* ボリューム値 0〜15 書き込みヘルパ */
@@ -302,7 +342,7 @@ static inline void
 psg_note_event(PSGDriver *drv, int ch, uint8_t octave, uint8_t note,
                uint8_t volume, uint16_t len, uint8_t is_rest, uint16_t bpm_x10)
 {
-    if (drv->note_event) {
+    if (drv->note_event && !drv->mute) {
         (*drv->note_event)(drv->opaque,
                            ch, octave, note, volume, len, is_rest, bpm_x10);
     }
@@ -356,12 +396,20 @@ psg_driver_init(PSGDriver *drv,
     const uint8_t reg6_default = 0x00;
     psg_write(drv, AY_NOISEPER, reg6_default);
     drv->main.reg6_value = reg6_default;
+    psg_flush(drv);
 
     for (int i = 0; i < 3; i++) {
         psg_channel_reset(&drv->ch[i], i);
     }
 }
 
+/* レジスタ一括書き込みコールバック設定 */
+void
+psg_driver_set_write_regs(PSGDriver *drv, PSGWriteRegsFn regs_write_cb)
+{
+    drv->write_regs = regs_write_cb;
+}
+
 /* チャンネルにオブジェクトデータを設定 */
 void
 psg_driver_set_channel_data(PSGDriver *drv,
@@ -400,197 +448,624 @@ psg_driver_stop(PSGDriver *drv)
         /* ボリューム0を書いてミュート */
         psg_write(drv, AY_AVOL + i, 0);
     }
+    psg_flush(drv);
 }
 
-/* I コマンド値取得（今は単純に MAIN ワークの内容を返すだけ） */
-uint8_t
-psg_driver_get_i_command(const PSGDriver *drv)
+/* 出力抑止 */
+void
+psg_driver_set_mute(PSGDriver *drv, int mute)
 {
-    return drv->main.i_command_value;
+    drv->mute = mute ? 1 : 0;
 }
 
-/* 1チャンネルぶんの 1tick 処理（Stage 1 簡易版） */
-static void
-psg_channel_tick(PSGDriver *drv, PSGChannel *ch)
+/* シャドウ上のレジスタ値をすべて書き出す */
+void
+psg_driver_sync_regs(PSGDriver *drv)
 {
-    if (!ch->active) {
-        return;
+    psg_flush(drv);
+    for (uint8_t reg = AY_AFINE; reg <= AY_CVOL; reg++) {
+        if ((drv->reg_valid & (1u << reg)) == 0) {
+            drv->reg_shadow[reg] = 0;
+            drv->reg_valid |= (uint16_t)(1u << reg);
+        }
+        drv->batch[drv->batch_len].reg = reg;
+        drv->batch[drv->batch_len].val = drv->reg_shadow[reg];
+        drv->batch_len++;
     }
+    psg_flush(drv);
+}
 
-    uint16_t wait_counter = ch->wait_counter;
-    wait_counter--;
-    ch->wait_counter = wait_counter;
+/* カウンタ値 0 は 1周 (256 / 65536) 扱い */
+static inline uint32_t
+psg_tempo_period(uint8_t v)
+{
+    return (v == 0) ? 256u : v;
+}
 
-    if (wait_counter > 0) {
-        /* ノート再生中の処理 */
+static inline uint32_t
+psg_wait_steps(uint16_t v)
+{
+    return (v == 0) ? 65536u : v;
+}
 
-        /* 休符中は再生中処理なしで終了 */
-        if ((ch->flags & CH_F_REST) != 0)
-            return;
+/* 次の音符境界までの tick 数 */
+uint32_t
+psg_driver_ticks_to_note(const PSGDriver *drv)
+{
+    uint32_t steps = UINT32_MAX;
 
-        if (ch->wait_counter == ch->q_counter) {
-            /* 残り時間がゲート時間になったら音量オフ */
-            psg_write(drv, AY_AVOL + ch->channel_index, 0);
-            ch->prev_volume = 0;
-            /* 後は休符相当で発声処理なしなので休符フラグセットしてリターン */
-            ch->flags |= CH_F_REST;
-            return;
+    /* チャンネル処理何回目で音長カウンタが満了するか */
+    for (int i = 0; i < 3; i++) {
+        const PSGChannel *ch = &drv->ch[i];
+        if (ch->active && psg_wait_steps(ch->wait_counter) < steps)
+            steps = psg_wait_steps(ch->wait_counter);
+    }
+    if (steps == UINT32_MAX)
+        return UINT32_MAX;
+
+    /* チャンネル処理 1回目は tempo_counter tick 後、以降 tempo_val 毎 */
+    return psg_tempo_period(drv->main.tempo_counter) - 1 +
+        (steps - 1) * psg_tempo_period(drv->main.tempo_val);
+}
+
+static inline uint32_t
+psg_count_steps(uint8_t v)
+{
+    return (v == 0) ? 256u : v;
+}
+
+/* チャンネル処理何回目で出力 (または次コマンド解析) が起きるか */
+static uint32_t
+psg_channel_event_steps(const PSGChannel *ch)
+{
+    uint32_t steps = psg_wait_steps(ch->wait_counter);
+
+    /* 休符中 (Q によるゲートオフ後も含む) は音長満了まで何もしない */
+    if ((ch->flags & CH_F_REST) != 0)
+        return steps;
+
+    /* Q ゲートオフ */
+    if (ch->q_counter != 0 && ch->q_counter < steps)
+        steps = steps - ch->q_counter;
+
+    /* ビブラート: ウェイト消化後、周期カウンタ満了で書き込み */
+    if ((ch->flags & CH_F_VIB_ON) != 0) {
+        uint32_t v = ch->vib_wait_work + psg_count_steps(ch->vib_count_work);
+        if (v < steps)
+            steps = v;
+    }
+
+    /* ソフトウェア EG: カウンタ満了で音量更新または 2段目へ移行 */
+    if (ch->eg_width_base != 0 &&
+        ((ch->flags & CH_F_PSG_EG) == 0 || ch->eg2_width_base != 0)) {
+        uint32_t e = psg_count_steps(ch->eg_count_work);
+        if (e < steps)
+            steps = e;
+    }
+
+    return steps;
+}
+
+/* 次に何か起きる (レジスタ書き込みかコマンド解析) tick までの tick 数 */
+uint32_t
+psg_driver_ticks_to_event(const PSGDriver *drv)
+{
+    uint32_t steps = UINT32_MAX;
+
+    for (int i = 0; i < 3; i++) {
+        const PSGChannel *ch = &drv->ch[i];
+        if (ch->active) {
+            uint32_t s = psg_channel_event_steps(ch);
+            if (s < steps)
+                steps = s;
         }
+    }
+    if (steps == UINT32_MAX)
+        return UINT32_MAX;
 
-        /* 発声中ビブラート (LFO) 処理 */
-        psg_vibrato_tick(drv, ch);
+    return psg_tempo_period(drv->main.tempo_counter) - 1 +
+        (steps - 1) * psg_tempo_period(drv->main.tempo_val);
+}
 
-        /* 発声中ソフトウェアエンベロープ (EG) 処理 */
-        psg_psgeg_tick(drv, ch);
+/* テンポカウンタと各チャンネルのカウンタを進める */
+void
+psg_driver_skip_ticks(PSGDriver *drv, uint32_t n)
+{
+    uint32_t c  = psg_tempo_period(drv->main.tempo_counter);
+    uint32_t tv = psg_tempo_period(drv->main.tempo_val);
 
-        /* ノート継続なので終了 */
+    drv->tick_count += n;
+    if (n < c) {
+        drv->main.tempo_counter = (uint8_t)(c - n);
         return;
     }
 
-    /* ノート終了時は次コマンド解析 */
+    /* 飛ばす区間内のチャンネル処理回数 */
+    n -= c;
+    uint32_t steps = 1 + n / tv;
+    drv->main.tempo_counter = (uint8_t)(tv - n % tv);
+    for (int i = 0; i < 3; i++) {
+        PSGChannel *ch = &drv->ch[i];
+        if (!ch->active)
+            continue;
+        ch->wait_counter = (uint16_t)(ch->wait_counter - steps);
+        if ((ch->flags & CH_F_REST) != 0)
+            continue;
 
-    /* 次のオブジェクトを読み取るループ。
-       コマンドだけが連続する場合を考慮して、音符を読むまで回す。 */
-    for (;;) {
-        uint8_t code = ch->data_base[ch->data_offset++];
+        /* psg_vibrato_tick() の空回り分 */
+        if ((ch->flags & CH_F_VIB_ON) != 0) {
+            if (steps <= ch->vib_wait_work) {
+                ch->vib_wait_work = (uint8_t)(ch->vib_wait_work - steps);
+            } else {
+                ch->vib_count_work = (uint8_t)(ch->vib_count_work -
+                    (steps - ch->vib_wait_work));
+                ch->vib_wait_work = 0;
+            }
+        }
 
-        if ((code & F_NOTE) == 0) {
-            /* === 音符オブジェクト === */
+        /* psg_psgeg_tick() の空回り分 */
+        if (ch->eg_width_base != 0 &&
+            ((ch->flags & CH_F_PSG_EG) == 0 || ch->eg2_width_base != 0))
+            ch->eg_count_work = (uint8_t)(ch->eg_count_work - steps);
+    }
+}
 
-            int tie = (code & F_TIE) ? 1 : 0;
+/* n tick 進める (何も起きない区間は飛ばす) */
+uint32_t
+psg_driver_advance(PSGDriver *drv, uint32_t n)
+{
+    return psg_driver_advance_cb(drv, n, NULL, NULL);
+}
 
-            /* ゲートオフ時間設定 */
-            uint8_t q_counter = ch->q_default;
-            if (tie)
-                q_counter = 0;
+/* 同上、実行する tick ごとに fn を呼ぶ */
+uint32_t
+psg_driver_advance_cb(PSGDriver *drv, uint32_t n, PSGTickFn fn, void *opaque)
+{
+    uint32_t t0 = drv->tick_count;
+    uint32_t left = n;
+
+    while (left > 0) {
+        uint32_t idle = psg_driver_ticks_to_event(drv);
+        if (idle == UINT32_MAX)
+            break;      /* 全チャンネル停止 */
+        if (idle == 0) {
+            if (fn != NULL)
+                (*fn)(opaque, n - left);
+            psg_driver_tick(drv);
+            left--;
+            continue;
+        }
+        if (idle > left)
+            idle = left;
+        psg_driver_skip_ticks(drv, idle);
+        left -= idle;
+    }
+    return drv->tick_count - t0;
+}
 
-            uint8_t note     = code & F_PITCH;
-            uint8_t len_flag = code & F_LEN;
+/* n tick 進めて最終状態だけ書き出す */
+uint32_t
+psg_driver_catch_up(PSGDriver *drv, uint32_t n)
+{
+    uint8_t before[PSG_REG_COUNT];
+    uint16_t valid = drv->reg_valid;
 
-            uint16_t len = 0;
+    psg_flush(drv);
+    memcpy(before, drv->reg_shadow, sizeof(before));
 
-            switch (len_flag) {
-            case F_LEN_L: /* L デフォルト */
-                len = ch->l_default;
-                break;
-            case F_LEN_LPLUS: /* L+ デフォルト */
-                len = ch->lplus_default;
-                break;
-            case F_LEN_1BYTE: /* 1バイト音長 */
-                len = ch->data_base[ch->data_offset++];
-                break;
-            case F_LEN_2BYTE: /* 2バイト音長 (little endian) */
-                len  = ch->data_base[ch->data_offset++];
-                len |= (uint16_t)ch->data_base[ch->data_offset++] << 8;
-                break;
-            }
+    drv->coalesce = 1;
+    drv->reg_dirty = 0;
+    uint32_t done = psg_driver_advance(drv, n);
+    drv->coalesce = 0;
 
-            /* 音長カウンタセット */
-            ch->wait_counter = len;
+    /* R11/R12 の後に R13 が来るようレジスタ番号順 */
+    for (uint8_t reg = 0; reg < PSG_REG_COUNT; reg++) {
+        const uint16_t bit = (uint16_t)(1u << reg);
+        if ((drv->reg_dirty & bit) == 0)
+            continue;
+        if (reg != AY_ESHAPE && (valid & bit) != 0 &&
+            before[reg] == drv->reg_shadow[reg])
+            continue;
+        drv->batch[drv->batch_len].reg = reg;
+        drv->batch[drv->batch_len].val = drv->reg_shadow[reg];
+        drv->batch_len++;
+    }
+    drv->reg_dirty = 0;
+    psg_flush(drv);
+    return done;
+}
 
-            /* ゲートオフ時間が発声時間より長い場合も1tickは発声させる */
-            if (q_counter >= len)
-                q_counter = len - 1;
-            /* Q カウンタ現在値セット */
-            ch->q_counter = q_counter;
+/* 再生中チャンネル有無 */
+int
+psg_driver_is_active(const PSGDriver *drv)
+{
+    for (int i = 0; i < 3; i++) {
+        if (drv->ch[i].active)
+            return 1;
+    }
+    return 0;
+}
 
-            if (note == 0) {
-                /* 休符 */
+/* I コマンド値取得（今は単純に MAIN ワークの内容を返すだけ） */
+uint8_t
+psg_driver_get_i_command(const PSGDriver *drv)
+{
+    return drv->main.i_command_value;
+}
 
-                /* 休符フラグセット */
-                ch->flags |= CH_F_REST;
+/*
+ * コマンド処理ヘルパ
+ *  オペランドの読み出しとジャンプ先の解決は呼び出し側
+ *  (psg_channel_exec()) で行う。
+ *  演奏データは p6psg_load() でネスト構造等を検証済みなので
+ *  ここでは実行時チェックはしない。
+ */
 
-                /* 音量0を書き込み */
-                psg_write(drv, AY_AVOL + ch->channel_index, 0);
-                ch->prev_volume = 0;
+/* 音符／休符 (code: 音符オブジェクト, len: 解決済み音長) */
+static void
+psg_ch_note(PSGDriver *drv, PSGChannel *ch, uint8_t code, uint16_t len)
+{
+    int tie = (code & F_TIE) ? 1 : 0;
+
+    /* ゲートオフ時間設定 */
+    uint8_t q_counter = ch->q_default;
+    if (tie)
+        q_counter = 0;
+
+    uint8_t note     = code & F_PITCH;
+
+    /* 音長カウンタセット */
+    ch->wait_counter = len;
+
+    /* ゲートオフ時間が発声時間より長い場合も1tickは発声させる */
+    if (q_counter >= len)
+        q_counter = len - 1;
+    /* Q カウンタ現在値セット */
+    ch->q_counter = q_counter;
 
-                /* ui 表示用ノートイベント更新 */
-                psg_note_event(drv, ch->channel_index,
-                               ch->octave, 0, ch->volume, (uint16_t)len, 1,
-                               drv->main.bpm_x10);
+    if (note == 0) {
+        /* 休符 */
+
+        /* 休符フラグセット */
+        ch->flags |= CH_F_REST;
+
+        /* 音量0を書き込み */
+        psg_write(drv, AY_AVOL + ch->channel_index, 0);
+        ch->prev_volume = 0;
+
+        /* ui 表示用ノートイベント更新 */
+        psg_note_event(drv, ch->channel_index,
+                       ch->octave, 0, ch->volume, (uint16_t)len, 1,
+                       drv->main.bpm_x10);
+
+    } else {
+        /* 通常の音符 */
 
+        /* 休符フラグクリア */
+        ch->flags &= ~CH_F_REST;
+
+        int prev_tie = (ch->flags & CH_F_TIE) != 0;
+        if (!prev_tie && ch->eg_width_base != 0) {
+            /* ソフトウェアエンベロープ (EG) ワーク初期化 */
+            psg_psgeg_note_init(ch);
+        }
+
+        if ((ch->flags & CH_F_VIB_ON) != 0) {
+            /* ビブラート (LFO) ワーク初期化 */
+#ifdef KEEP_VIBRATO_TIE
+            if (!prev_tie)
+#endif
+            {
+                psg_vibrato_note_init(ch);
+            }
+        }
+
+        /* 周波数レジスタ値算出 */
+        uint16_t tone = psg_calc_tone(ch->octave, note);
+
+        if (ch->detune != 0) {
+            /* デチューン分調整 */
+            if ((ch->detune & 0x80u) == 0) {
+                /* 最上位ビットが0なら周波数上げるので値は減算 */
+                tone -= ch->detune;
             } else {
-                /* 通常の音符 */
+                /* 最上位ビットが1なら周波数下げるので値は加算 */
+                tone += (ch->detune & ~0x80u);
+            }
+        }
 
-                /* 休符フラグクリア */
-                ch->flags &= ~CH_F_REST;
+        /* 前ノートがタイでない場合は書き込み前にボリュームオフ */
+        if (!prev_tie)
+            psg_write(drv, AY_AVOL + ch->channel_index, 0);
 
-                int prev_tie = (ch->flags & CH_F_TIE) != 0;
-                if (!prev_tie && ch->eg_width_base != 0) {
-                    /* ソフトウェアエンベロープ (EG) ワーク初期化 */
-                    psg_psgeg_note_init(ch);
-                }
+        /* 現在の基準トーン値セット */
+        ch->freq_value = tone;
 
-                if ((ch->flags & CH_F_VIB_ON) != 0) {
-                    /* ビブラート (LFO) ワーク初期化 */
 #ifdef KEEP_VIBRATO_TIE
-                    if (!prev_tie)
+        /*
+         * タイ継続中の場合にビブラートも継続させる場合は
+         * ビブラート周波数変化周期の位相を保持するために
+         * ノート開始時に基準トーン値そのものではなく
+         * 前ノートから継続中のビブラート補正値も加算反映した
+         * 周波数値を書き込む必要がある
+         */
+        if (prev_tie && (ch->flags & CH_F_VIB_ON) != 0) {
+            int32_t t = (int32_t)tone + (int32_t)ch->vib_offset;
+            tone = psg_clamp_tone_12bit(t);
+        }
 #endif
-                    {
-                        psg_vibrato_note_init(ch);
-                    }
-                }
 
-                /* 周波数レジスタ値算出 */
-                uint16_t tone = psg_calc_tone(ch->octave, note);
-
-                if (ch->detune != 0) {
-                    /* デチューン分調整 */
-                    if ((ch->detune & 0x80u) == 0) {
-                        /* 最上位ビットが0なら周波数上げるので値は減算 */
-                        tone -= ch->detune;
-                    } else {
-                        /* 最上位ビットが1なら周波数下げるので値は加算 */
-                        tone += (ch->detune & ~0x80u);
-                    }
-                }
+        /* 周波数レジスタセット */
+        psg_write_tone(drv, ch, tone);
+
+        /* 音量レジスタセット */
+        int vol = ch->volume;
+        if (prev_tie) {
+            /* タイ継続ならソフトウェアエンベロープ分も加算 */
+            vol += ch->volume_adjust;
+            vol = psg_clip_vol(vol);
+        }
+        psg_write(drv, AY_AVOL + ch->channel_index,
+                (uint8_t)vol);
+        ch->prev_volume = vol;
+
+        /* ui 表示用ノートイベント更新 */
+        psg_note_event(drv, ch->channel_index,
+                       ch->octave, note, ch->volume, (uint16_t)len, 0,
+                       drv->main.bpm_x10);
+    }
+
+    /* タイフラグ更新 */
+    if (tie)
+        ch->flags |= CH_F_TIE;
+    else
+        ch->flags &= ~CH_F_TIE;
+}
+
+/* 音長なし音符の音長 (L / L+ デフォルト) */
+static inline uint16_t
+psg_ch_default_len(const PSGChannel *ch, uint8_t code)
+{
+    return ((code & F_LEN) == F_LEN_LPLUS) ?
+        ch->lplus_default : ch->l_default;
+}
+
+/* ボリューム v0〜v15, v+, v- */
+static inline void
+psg_cmd_volume(PSGChannel *ch, uint8_t code)
+{
+    int vol;
+
+    switch (code & 0xF0) {
+    case 0x90:
+        ch->volume = code & 0x0F;
+        break;
+    case 0xA0:
+        vol = ch->volume + (code & 0x0F);
+        ch->volume = psg_clip_vol(vol);
+        break;
+    case 0xB0:
+        vol = ch->volume - (code & 0x0F);
+        ch->volume = psg_clip_vol(vol);
+        break;
+    }
+}
+
+/* S コマンド (p1 == 0 なら p2〜p5 は無し) */
+static inline void
+psg_cmd_s(PSGChannel *ch, const uint8_t p[5])
+{
+    ch->eg_width_base = p[0];
+    if (p[0] != 0u) {
+        ch->eg_count_base = p[1];
+        ch->eg_delta_base = p[2];
+        ch->eg2_width_base = p[3];
+        ch->eg2_count_base = p[4];
+    }
+}
+
+/* W コマンド */
+static inline void
+psg_cmd_w(PSGDriver *drv, uint8_t reg6)
+{
+    psg_write(drv, AY_NOISEPER, reg6);
+    drv->main.reg6_value = reg6;
+}
+
+/* W+/- コマンド */
+static inline void
+psg_cmd_w_add(PSGDriver *drv, uint8_t diff)
+{
+    int wval = drv->main.reg6_value + diff;
+    if (wval > 31)
+        wval = 31;
+    if (wval < 0)
+        wval = 0;
+    psg_cmd_w(drv, (uint8_t)wval);
+}
 
-                /* 前ノートがタイでない場合は書き込み前にボリュームオフ */
-                if (!prev_tie)
-                    psg_write(drv, AY_AVOL + ch->channel_index, 0);
+/* P1〜P3 コマンド */
+static inline void
+psg_cmd_p(PSGDriver *drv, PSGChannel *ch, uint8_t code)
+{
+    uint32_t tbit = 0x1u << ch->channel_index;
+    uint32_t nbit = 0x1u << (ch->channel_index + 3);
+    uint8_t reg7 = drv->main.reg7_value;
+    if ((code & 0x01u) != 0) {
+        /* トーン有効 */
+        reg7 &= ~tbit;
+    } else {
+        /* トーン無効 */
+        reg7 |= tbit;
+    }
+    if ((code & 0x02u) != 0) {
+        /* ノイズ有効 */
+        reg7 &= ~nbit;
+    } else {
+        /* ノイズ無効 */
+        reg7 |= nbit;
+    }
+    psg_write(drv, AY_ENABLE, reg7);
+    drv->main.reg7_value = reg7;
+}
+
+/* [ コマンド */
+static inline void
+psg_cmd_nest_begin(PSGChannel *ch, uint8_t count)
+{
+    int nest = ch->flags & CH_F_NEST;
+    nest++;
+    ch->flags = (ch->flags & 0xF8u) | nest;
+    ch->nest_flag[nest - 1] = count;
+    ch->l_backup = ch->l_default;
+    ch->lplus_backup = ch->lplus_default;
+    ch->octave_backup = (ch->octave_backup & 0xF0) | ch->octave;
+}
+
+/* ] コマンド: ネストの最初に戻る場合 1 を返す */
+static inline int
+psg_cmd_nest_end(PSGChannel *ch)
+{
+    int nest = ch->flags & CH_F_NEST;
+    if (--ch->nest_flag[nest - 1] == 0) {
+        /* ネスト回数終了して脱出 */
+        nest--;
+        ch->flags = (ch->flags & 0xF8) | nest;
+        return 0;
+    }
+    /* ネストの最初に戻る */
+    ch->l_default = ch->l_backup;
+    ch->lplus_default = ch->lplus_backup;
+    ch->octave = ch->octave_backup & 0x0f;
+    return 1;
+}
 
-                /* 現在の基準トーン値セット */
-                ch->freq_value = tone;
+/* : コマンド: 最後の繰り返しでネストを脱出する場合 1 を返す */
+static inline int
+psg_cmd_nest_exit(PSGChannel *ch)
+{
+    int nest = ch->flags & CH_F_NEST;
+    if (ch->nest_flag[nest - 1] == 1) {
+        /* 最後の繰り返しなのでネスト脱出 */
+        ch->nest_flag[nest - 1] = 0;
+        nest--;
+        ch->flags = (ch->flags & 0xF8) | nest;
+        return 1;
+    }
+    return 0;
+}
 
+/* M コマンド */
+static inline void
+psg_cmd_m(PSGChannel *ch, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t p4)
+{
+    ch->vib_wait_base = p1;
+    ch->vib_count_base = p2;
+    ch->vib_amp_base = (uint8_t)(p3 * 2);
+    ch->vib_delta_base = (int8_t)p4;
+    /* 第4パラメータでビブラートフラグセットクリア */
+    if (ch->vib_delta_base != 0)
+        ch->flags |= CH_F_VIB_ON;
+    else
+        ch->flags &= ~CH_F_VIB_ON;
 #ifdef KEEP_VIBRATO_TIE
-                /*
-                 * タイ継続中の場合にビブラートも継続させる場合は
-                 * ビブラート周波数変化周期の位相を保持するために
-                 * ノート開始時に基準トーン値そのものではなく
-                 * 前ノートから継続中のビブラート補正値も加算反映した
-                 * 周波数値を書き込む必要がある
-                 */
-                if (prev_tie && (ch->flags & CH_F_VIB_ON) != 0) {
-                    int32_t t = (int32_t)tone + (int32_t)ch->vib_offset;
-                    tone = psg_clamp_tone_12bit(t);
-                }
+    psg_vibrato_note_init(ch);
 #endif
+}
 
-                /* 周波数レジスタセット */
-                psg_write_tone(drv, ch, tone);
+/* M% コマンド */
+static inline void
+psg_cmd_m_delta(PSGChannel *ch, uint8_t p4)
+{
+    ch->vib_delta_base = (int8_t)p4;
+    /* 第4パラメータでビブラートフラグセットクリア */
+    if (ch->vib_delta_base != 0)
+        ch->flags |= CH_F_VIB_ON;
+    else
+        ch->flags &= ~CH_F_VIB_ON;
+}
 
-                /* 音量レジスタセット */
-                int vol = ch->volume;
-                if (prev_tie) {
-                    /* タイ継続ならソフトウェアエンベロープ分も加算 */
-                    vol += ch->volume_adjust;
-                    vol = psg_clip_vol(vol);
-                }
-                psg_write(drv, AY_AVOL + ch->channel_index,
-                        (uint8_t)vol);
-                ch->prev_volume = vol;
-
-                /* ui 表示用ノートイベント更新 */
-                psg_note_event(drv, ch->channel_index,
-                               ch->octave, note, ch->volume, (uint16_t)len, 0,
-                               drv->main.bpm_x10);
-            }
+/* T コマンド (t96: 96分音符長の 2ms回数) */
+static inline void
+psg_cmd_t(PSGDriver *drv, uint8_t t96)
+{
+    drv->main.tempo_val = t96;
+    drv->main.bpm_x10   = calc_bpm_x10_from_t96(t96); /* ui 表示用 */
+}
+
+/* U+/- コマンド */
+static inline void
+psg_cmd_detune_add(PSGChannel *ch, int8_t diff)
+{
+    int8_t detune = (int8_t)ch->detune;
+    if (((uint8_t)detune & 0x80u) != 0) {
+        detune = (int8_t)((uint8_t)detune & ~0x80u);
+        detune = -detune;
+    }
+    detune += diff;
+    if (detune < 0) {
+        detune = -detune;
+        detune = (int8_t)((uint8_t)detune | 0x80u);
+    }
+    ch->detune = (uint8_t)detune;
+}
 
-            /* タイフラグ更新 */
-            if (tie)
-                ch->flags |= CH_F_TIE;
-            else
-                ch->flags &= ~CH_F_TIE;
+/* J コマンド (data_offset は J の次を指している) */
+static inline void
+psg_cmd_j(PSGChannel *ch)
+{
+    ch->j_return_offset = ch->data_offset;
+    ch->octave_backup = (ch->octave << 4) | (ch->octave_backup & 0x0f);
+}
+
+/* エンドマーク: J 位置に戻る場合 1、チャンネル停止の場合 0 を返す */
+static inline int
+psg_cmd_end(PSGDriver *drv, PSGChannel *ch)
+{
+    if (ch->j_return_offset != 0) {
+        ch->data_offset = ch->j_return_offset;
+        ch->octave = (ch->octave_backup >> 4) & 0x0f;
+        ch->loop_count++;
+        return 1;
+    }
+
+    ch->active = 0;
+    /* 終了時はボリュームオフ */
+    psg_write(drv, AY_AVOL + ch->channel_index, 0);
+    /* UI 側ノート表示も VOL=0 かつ休符状態にする */
+    psg_note_event(drv, ch->channel_index,
+                   ch->octave, 0, 0, 0, 1,
+                   drv->main.bpm_x10);
+    return 0;
+}
+
+/* オブジェクトデータを解釈して次の音符まで処理する */
+static void
+psg_channel_exec(PSGDriver *drv, PSGChannel *ch)
+{
+    /* 次のオブジェクトを読み取るループ。
+       コマンドだけが連続する場合を考慮して、音符を読むまで回す。 */
+    for (;;) {
+        uint8_t code = ch->data_base[ch->data_offset++];
+
+        if ((code & F_NOTE) == 0) {
+            /* === 音符オブジェクト === */
+            uint16_t len = 0;
+
+            switch (code & F_LEN) {
+            case F_LEN_L: /* L デフォルト */
+            case F_LEN_LPLUS: /* L+ デフォルト */
+                len = psg_ch_default_len(ch, code);
+                break;
+            case F_LEN_1BYTE: /* 1バイト音長 */
+                len = ch->data_base[ch->data_offset++];
+                break;
+            case F_LEN_2BYTE: /* 2バイト音長 (little endian) */
+                len  = ch->data_base[ch->data_offset++];
+                len |= (uint16_t)ch->data_base[ch->data_offset++] << 8;
+                break;
+            }
+            psg_ch_note(drv, ch, code, len);
 
             /* 音符を処理したので、この tick は終了 */
             return;
@@ -604,93 +1079,37 @@ psg_channel_tick(PSGDriver *drv, PSGChannel *ch)
             ch->octave = code & 0x0F;
             /* 続けて次のオブジェクトを見る */
             continue;
-        } else if (hi == 0x90) {
-            /* ボリューム v0〜v15 */
-            ch->volume = code & 0x0F;
-            continue;
-        } else if (hi == 0xA0) {
-            int vol = ch->volume + (code & 0x0F);
-            vol = psg_clip_vol(vol);
-            ch->volume = vol;
-            continue;
-        } else if (hi == 0xB0) {
-            int vol = ch->volume - (code & 0x0F);
-            vol = psg_clip_vol(vol);
-            ch->volume = vol;
+        } else if (hi == 0x90 || hi == 0xA0 || hi == 0xB0) {
+            /* ボリューム v0〜v15, v+, v- */
+            psg_cmd_volume(ch, code);
             continue;
         }
 
-        uint8_t p1, p3;
-        uint8_t reg6, reg7;
-        uint32_t tbit, nbit;
-        int wval;
-        int nest;
+        uint8_t p[5];
         uint16_t offset;
-        uint8_t t96;
-        int8_t detune, diff;
         switch (code) {
         case 0xea:    /* S コマンド */
-            p1 = ch->data_base[ch->data_offset++];
-            ch->eg_width_base = p1;
-            if (p1 != 0u) {
-                ch->eg_count_base = ch->data_base[ch->data_offset++];
-                ch->eg_delta_base = ch->data_base[ch->data_offset++];
-                ch->eg2_width_base = ch->data_base[ch->data_offset++];
-                ch->eg2_count_base = ch->data_base[ch->data_offset++];
+            p[0] = ch->data_base[ch->data_offset++];
+            if (p[0] != 0u) {
+                for (int i = 1; i < 5; i++)
+                    p[i] = ch->data_base[ch->data_offset++];
             }
+            psg_cmd_s(ch, p);
             continue;
         case 0xeb:    /* W コマンド */
-            reg6 = ch->data_base[ch->data_offset++];
-            psg_write(drv, AY_NOISEPER, reg6);
-            drv->main.reg6_value = reg6;
+            psg_cmd_w(drv, ch->data_base[ch->data_offset++]);
             continue;
         case 0xec:    /* W+/- コマンド */
-            wval = drv->main.reg6_value + ch->data_base[ch->data_offset++];
-            if (wval > 31)
-                wval = 31;
-            if (wval < 0)
-                wval = 0;
-            reg6 = (uint8_t)wval;
-            psg_write(drv, AY_NOISEPER, reg6);
-            drv->main.reg6_value = reg6;
+            psg_cmd_w_add(drv, ch->data_base[ch->data_offset++]);
             continue;
         case 0xed:    /* P1 コマンド */
         case 0xee:    /* P2 コマンド */
         case 0xef:    /* P3 コマンド */
-            tbit = 0x1u << ch->channel_index;
-            nbit = 0x1u << (ch->channel_index + 3);
-            reg7 = drv->main.reg7_value;
-            if ((code & 0x01u) != 0) {
-                /* トーン有効 */
-                reg7 &= ~tbit;
-            } else {
-                /* トーン無効 */
-                reg7 |= tbit;
-            }
-            if ((code & 0x02u) != 0) {
-                /* ノイズ有効 */
-                reg7 &= ~nbit;
-            } else {
-                /* ノイズ無効 */
-                reg7 |= nbit;
-            }
-            psg_write(drv, AY_ENABLE, reg7);
-            drv->main.reg7_value = reg7;
+            psg_cmd_p(drv, ch, code);
             continue;
 
         case 0xf0:    /* [ コマンド */
-            nest = ch->flags & CH_F_NEST;
-            if (nest >= 4) {
-                /* コンパイル時にチェックされているはずだが一応 */
-                (void)ch->data_base[ch->data_offset++];
-                continue;
-            }
-            nest++;
-            ch->flags = (ch->flags & 0xF8u) | nest;
-            ch->nest_flag[nest - 1] = ch->data_base[ch->data_offset++];
-            ch->l_backup = ch->l_default;
-            ch->lplus_backup = ch->lplus_default;
-            ch->octave_backup = (ch->octave_backup & 0xF0) | ch->octave;
+            psg_cmd_nest_begin(ch, ch->data_base[ch->data_offset++]);
             continue;
         case 0xf1:    /* ] コマンド (ジャンプ1バイト) */
         case 0xf2:    /* ] コマンド (ジャンプ2バイト) */
@@ -700,56 +1119,22 @@ psg_channel_tick(PSGDriver *drv, PSGChannel *ch)
             } else {
                 offset |= 0xFF00u;
             }
-            nest = ch->flags & CH_F_NEST;
-            if (nest == 0) {
-                /* コンパイル時にチェックされているはずだが一応 */
-                continue;
-            }
-            if (--ch->nest_flag[nest - 1] == 0) {
-                /* ネスト回数終了して脱出 */
-                nest--;
-                ch->flags = (ch->flags & 0xF8) | nest;
-                continue;
-            }
-            /* ネストの最初に戻る */
-            ch->data_offset += offset;
-            ch->l_default = ch->l_backup;
-            ch->lplus_default = ch->lplus_backup;
-            ch->octave = ch->octave_backup & 0x0f;
+            if (psg_cmd_nest_end(ch))
+                ch->data_offset += offset;
             continue;
         case 0xf3:    /* : コマンド */
             offset  = ch->data_base[ch->data_offset++];
             offset |= ch->data_base[ch->data_offset++] << 8;
-            nest = ch->flags & CH_F_NEST;
-            if (nest > 4 || nest == 0) {
-                /* コンパイル時にチェックされているはずだが一応 */
-                continue;
-            }
-            if (ch->nest_flag[nest - 1] == 1) {
-                /* 最後の繰り返しなのでネスト脱出 */
-                ch->nest_flag[nest - 1] = 0;
-                nest--;
-                ch->flags = (ch->flags & 0xF8) | nest;
+            if (psg_cmd_nest_exit(ch))
                 ch->data_offset += offset;
-            }
             continue;
         case 0xf4:    /* I コマンド */
             drv->main.i_command_value = ch->data_base[ch->data_offset++];
             continue;
         case 0xf5:    /* M コマンド */
-            ch->vib_wait_base = ch->data_base[ch->data_offset++];
-            ch->vib_count_base = ch->data_base[ch->data_offset++];
-            p3 = ch->data_base[ch->data_offset++];
-            ch->vib_amp_base = (uint8_t)(p3 * 2);
-            ch->vib_delta_base = (int8_t)ch->data_base[ch->data_offset++];
-            /* 第4パラメータでビブラートフラグセットクリア */
-            if (ch->vib_delta_base != 0)
-                ch->flags |= CH_F_VIB_ON;
-            else
-                ch->flags &= ~CH_F_VIB_ON;
-#ifdef KEEP_VIBRATO_TIE
-            psg_vibrato_note_init(ch);
-#endif
+            for (int i = 0; i < 4; i++)
+                p[i] = ch->data_base[ch->data_offset++];
+            psg_cmd_m(ch, p[0], p[1], p[2], p[3]);
             continue;
         case 0xf6:    /* N コマンド */
             /* ビブラート効果の有効／無効スイッチ */
@@ -758,10 +1143,8 @@ psg_channel_tick(PSGDriver *drv, PSGChannel *ch)
             ch->lplus_default = ch->data_base[ch->data_offset++];
             continue;
         case 0xf8:    /* T コマンド */
-            t96 = ch->data_base[ch->data_offset++]; /* 96分音符長の 2ms回数 */
+            psg_cmd_t(drv, ch->data_base[ch->data_offset++]);
             (void)ch->data_base[ch->data_offset++]; /* P6ポートF6h値 (無視) */
-            drv->main.tempo_val = t96;
-            drv->main.bpm_x10   = calc_bpm_x10_from_t96(t96); /* ui 表示用 */
             continue;
         case 0xf9:    /* L コマンド */
             ch->l_default = ch->data_base[ch->data_offset++];
@@ -773,53 +1156,67 @@ psg_channel_tick(PSGDriver *drv, PSGChannel *ch)
             ch->detune = ch->data_base[ch->data_offset++];
             continue;
         case 0xfc:    /* U+/- コマンド */
-            diff   = ch->data_base[ch->data_offset++];
-            detune = (int8_t)ch->detune;
-            if (((uint8_t)detune & 0x80u) != 0) {
-                detune = (int8_t)((uint8_t)detune & ~0x80u);
-                detune = -detune;
-            }
-            detune += diff;
-            if (detune < 0) {
-                detune = -detune;
-                detune = (int8_t)((uint8_t)detune | 0x80u);
-            }
-            ch->detune = (uint8_t)detune;
+            psg_cmd_detune_add(ch, (int8_t)ch->data_base[ch->data_offset++]);
             continue;
         case 0xfd:    /* M% コマンド */
-            ch->vib_delta_base = (int8_t)ch->data_base[ch->data_offset++];
-            /* 第4パラメータでビブラートフラグセットクリア */
-            if (ch->vib_delta_base != 0)
-                ch->flags |= CH_F_VIB_ON;
-            else
-                ch->flags &= ~CH_F_VIB_ON;
+            psg_cmd_m_delta(ch, ch->data_base[ch->data_offset++]);
             continue;
         case 0xfe:    /* J コマンド */
-            ch->j_return_offset = ch->data_offset;
-            ch->octave_backup = (ch->octave << 4) | (ch->octave_backup & 0x0f);
+            psg_cmd_j(ch);
             continue;
         case 0xff:    /* エンドマーク */
-            if (ch->j_return_offset != 0) {
-                ch->data_offset = ch->j_return_offset;
-                ch->octave = (ch->octave_backup >> 4) & 0x0f;
+            if (psg_cmd_end(drv, ch))
                 continue;
-            } else {
-                ch->active = 0;
-                /* 終了時はボリュームオフ */
-                psg_write(drv, AY_AVOL + ch->channel_index, 0);
-                /* UI 側ノート表示も VOL=0 かつ休符状態にする */
-                psg_note_event(drv, ch->channel_index,
-                               ch->octave, 0, 0, 0, 1,
-                               drv->main.bpm_x10);
-                return;
-            }
+            return;
         default:
-            printf("ch %d unknown command: %02x\n", ch->channel_index, code);
+            /* 未定義コマンドは p6psg_load() で弾かれているので来ない */
             continue;
         }
     }
 }
 
+/* 1チャンネルぶんの 1tick 処理（Stage 1 簡易版） */
+static void
+psg_channel_tick(PSGDriver *drv, PSGChannel *ch)
+{
+    if (!ch->active) {
+        return;
+    }
+
+    uint16_t wait_counter = ch->wait_counter;
+    wait_counter--;
+    ch->wait_counter = wait_counter;
+
+    if (wait_counter > 0) {
+        /* ノート再生中の処理 */
+
+        /* 休符中は再生中処理なしで終了 */
+        if ((ch->flags & CH_F_REST) != 0)
+            return;
+
+        if (ch->wait_counter == ch->q_counter) {
+            /* 残り時間がゲート時間になったら音量オフ */
+            psg_write(drv, AY_AVOL + ch->channel_index, 0);
+            ch->prev_volume = 0;
+            /* 後は休符相当で発声処理なしなので休符フラグセットしてリターン */
+            ch->flags |= CH_F_REST;
+            return;
+        }
+
+        /* 発声中ビブラート (LFO) 処理 */
+        psg_vibrato_tick(drv, ch);
+
+        /* 発声中ソフトウェアエンベロープ (EG) 処理 */
+        psg_psgeg_tick(drv, ch);
+
+        /* ノート継続なので終了 */
+        return;
+    }
+
+    /* ノート終了時は次コマンド解析 */
+    psg_channel_exec(drv, ch);
+}
+
 /* 2msごとの割り込み相当処理 */
 void
 psg_driver_tick(PSGDriver *drv)
@@ -829,7 +1226,11 @@ psg_driver_tick(PSGDriver *drv)
             psg_channel_tick(drv, &drv->ch[i]);
         }
         drv->main.tempo_counter = drv->main.tempo_val;
+
+        /* この tick の書き込みをまとめて出力 */
+        psg_flush(drv);
     }
+    drv->tick_count++;
 
     /* フェード等があればここで main ワークを更新（後で実装） */
 }
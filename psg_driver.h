@@ -8,6 +8,8 @@
 
 #include <stdint.h>
 
+#include "psg_backend.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -15,12 +17,34 @@ extern "C" {
 /* PSG レジスタ書き込みコールバック型 */
 typedef void (*PSGWriteRegFn)(void *opaque, uint8_t reg, uint8_t val);
 
+/* レジスタ書き込み 1 回分 (バックエンドの一括書き込みにそのまま渡せる) */
+typedef psg_regval_t PSGRegWrite;
+
+/*
+ * PSG レジスタ一括書き込みコールバック型 (1tick 分をまとめて渡す)
+ *  n は PSG_WRITE_BATCH_MAX 以下
+ */
+typedef void (*PSGWriteRegsFn)(void *opaque,
+                               const PSGRegWrite *w, unsigned int n);
+
+/*
+ * psg_driver_advance_cb() で実際に実行する tick の直前に呼ぶコールバック型
+ *  i は進める n tick のうち何番目の tick か (0 始まり)
+ */
+typedef void (*PSGTickFn)(void *opaque, uint32_t i);
+
 /* デモ画面表示用ノートデータ書き込みコールバック関数型 */
 typedef void (*PSGNoteEventFn)(void *opaque, int ch,
                               uint8_t octave, uint8_t note,
                               uint8_t volume, uint16_t len,
                               uint8_t is_rest, uint16_t bpm_x10);
 
+/* PSG レジスタ数 */
+#define PSG_REG_COUNT       16
+
+/* 1tick 分のレジスタ書き込みバッファ容量 (溢れたら途中で書き出す) */
+#define PSG_WRITE_BATCH_MAX 32
+
 /* コマンド/ノートのオブジェクトデータ定義 */
 #define F_NOTE          0x80u       /* 0:音符,休符, 1:コマンド */
 #define F_TIE           0x40u       /* 0:タイなし, 1:タイあり */
@@ -90,6 +114,7 @@ typedef struct PSGChannel {
     uint8_t        prev_volume;     /* 更新抑制用 前回tick補正後ボリューム値 */
     uint8_t        channel_index;   /* 0,1,2 など */
     uint8_t        active;          /* 0=停止, 1=再生中 */
+    uint16_t       loop_count;      /* エンドマークから J 位置に戻った回数 */
 } PSGChannel;
 
 /* ドライバ全体のワーク */
@@ -113,7 +138,18 @@ typedef struct PSGMainWork {
 typedef struct PSGDriver {
     PSGMainWork   main;
     PSGChannel    ch[3];            /* A/B/C の3チャンネル */
+
+    /* レジスタシャドウ (同値書き込み抑制用) と tick 内書き込みバッファ */
+    uint8_t       reg_shadow[PSG_REG_COUNT]; /* 最後に書き込んだ値 */
+    uint16_t      reg_valid;        /* reg_shadow 有効ビット (bit n = Rn) */
+    uint8_t       batch_len;        /* batch[] 使用数 */
+    PSGRegWrite   batch[PSG_WRITE_BATCH_MAX];
+    uint8_t       mute;             /* 1: シャドウ更新のみで出力しない */
+    uint8_t       coalesce;         /* 1: 書き込みは reg_dirty に記録だけ */
+    uint16_t      reg_dirty;        /* coalesce 中に書いたレジスタ */
+
     PSGWriteRegFn write_reg;        /* PSG レジスタ書き込み */
+    PSGWriteRegsFn write_regs;      /* PSG レジスタ一括書き込み (任意) */
     PSGNoteEventFn note_event;      /* デモ表示用ノートデータ書き込み */
     void          *opaque;          /* コールバックopaque */
     uint32_t      tick_count;       /* 経過 tick 数 */
@@ -125,7 +161,13 @@ void psg_driver_init(PSGDriver *drv,
                      PSGNoteEventFn ui_note_cb,
                      void *opaque);
 
-/* チャンネルにオブジェクトデータを設定 */
+/* レジスタ一括書き込みコールバック設定 (設定時は write_reg より優先) */
+void psg_driver_set_write_regs(PSGDriver *drv, PSGWriteRegsFn regs_write_cb);
+
+/*
+ * チャンネルにオブジェクトデータを設定
+ *  data は p6psg_load() で検証済みであること (実行時のチェックはしない)
+ */
 void psg_driver_set_channel_data(PSGDriver    *drv,
                                  int           ch_index,
                                  const uint8_t *data);
@@ -139,6 +181,68 @@ void psg_driver_stop(PSGDriver *drv);
 /* 2msごとの割り込み相当処理 */
 void psg_driver_tick(PSGDriver *drv);
 
+/*
+ * 出力抑止 (シーク時の早送り用)
+ *  mute 中はレジスタシャドウだけを更新し、書き込みとノートイベントの
+ *  コールバックは呼ばない。
+ */
+void psg_driver_set_mute(PSGDriver *drv, int mute);
+
+/*
+ * シャドウ上のレジスタ値 (R0〜R10) をすべて書き出す
+ *  チップ側の状態が不明になった後 (シーク後など) に使う。
+ *  まだ書いていないレジスタはリセット値 0 を書く。
+ */
+void psg_driver_sync_regs(PSGDriver *drv);
+
+/*
+ * 次に音符境界 (いずれかのチャンネルの音長カウンタ満了) が来る tick までの
+ * 間に挟まる tick 数。全チャンネル停止中は UINT32_MAX。
+ */
+uint32_t psg_driver_ticks_to_note(const PSGDriver *drv);
+
+/*
+ * 次にレジスタ書き込みかコマンド解析が起きる tick までの間に挟まる
+ * tick 数 (音長、Q ゲートオフ、LFO、EG の各カウンタから求める)。
+ * 全チャンネル停止中は UINT32_MAX。
+ */
+uint32_t psg_driver_ticks_to_event(const PSGDriver *drv);
+
+/*
+ * n tick 分を出力なしでカウンタだけ進めて飛ばす
+ *  n が psg_driver_ticks_to_event() 以下なら psg_driver_tick() を n 回
+ *  呼んだのと同じ状態になる。
+ *  n が psg_driver_ticks_to_note() 以下ならタイミング (音長とテンポ) は
+ *  正確だが LFO/EG/Q の状態は崩れるので、演奏位置の解析専用。
+ */
+void psg_driver_skip_ticks(PSGDriver *drv, uint32_t n);
+
+/*
+ * n tick 進める (出力は psg_driver_tick() を n 回呼んだのと同じ)
+ *  何も起きない区間は psg_driver_skip_ticks() で飛ばす。
+ *  全チャンネルが停止したらそこで止める。戻り値は進めた tick 数。
+ */
+uint32_t psg_driver_advance(PSGDriver *drv, uint32_t n);
+
+/*
+ * psg_driver_advance() と同じだが、飛ばさずに実行する tick ごとに
+ * その直前で fn を呼ぶ (書き込み時刻や遅れをその tick で測るため)
+ */
+uint32_t psg_driver_advance_cb(PSGDriver *drv, uint32_t n, PSGTickFn fn,
+    void *opaque);
+
+/*
+ * 遅れを取り戻すための n tick 分の一括実行
+ *  ドライバの状態は psg_driver_advance() と同じだが、途中の書き込みは
+ *  出さず、最後に開始時から値が変わったレジスタだけをまとめて書く
+ *  (R13 は途中で書かれていれば最後に 1 回書く)。バスに出る書き込みは
+ *  tick 数によらずレジスタごとに高々 1 回。戻り値は進めた tick 数。
+ */
+uint32_t psg_driver_catch_up(PSGDriver *drv, uint32_t n);
+
+/* 再生中チャンネル有無 (全チャンネル終了で 0) */
+int psg_driver_is_active(const PSGDriver *drv);
+
 /* I コマンド値取得 */
 uint8_t psg_driver_get_i_command(const PSGDriver *drv);
 
@@ -0,0 +1,630 @@
+/*
+ * psg_emu.c
+ *  Software AY-3-8910 / YM2149 emulation
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "psg_emu.h"
+#include "ym2149f.h"
+
+/* per-channel full scale; three channels at full level do not clip */
+#define PSG_EMU_AMP_MAX     10922
+
+/* 32-level DAC (YM2149, about 1.5dB per step), built on first init */
+static int32_t psg_emu_dac[32];
+static int psg_emu_dac_ready;
+
+static void
+psg_emu_dac_init(void)
+{
+    if (psg_emu_dac_ready)
+        return;
+    psg_emu_dac[0] = 0;
+    for (int i = 1; i < 32; i++) {
+        psg_emu_dac[i] = (int32_t)lrint(PSG_EMU_AMP_MAX *
+            pow(10.0, (i - 31) * 1.5 / 20.0));
+    }
+    psg_emu_dac_ready = 1;
+}
+
+static inline psg_emu_v4
+psg_emu_splat(int32_t v)
+{
+    psg_emu_v4 r = { v, v, v, v };
+    return r;
+}
+
+static inline int32_t
+psg_emu_min3(psg_emu_v4 v)
+{
+    int32_t m = v[0];
+
+    if (v[1] < m)
+        m = v[1];
+    if (v[2] < m)
+        m = v[2];
+    return m;
+}
+
+/* can the noise / envelope currently reach the output? */
+static inline void
+psg_emu_update_audible(PSGEmu *emu)
+{
+    emu->noise_audible = 0;
+    emu->env_audible = 0;
+    for (int ch = 0; ch < 3; ch++) {
+        int on = emu->env_mask[ch] != 0 || emu->fixed_amp[ch] != 0;
+        if (emu->env_mask[ch] != 0)
+            emu->env_audible = 1;
+        if (on && emu->noise_dis[ch] == 0)
+            emu->noise_audible = 1;
+    }
+}
+
+/* recompute the per-channel DAC levels after a volume/envelope change */
+static inline void
+psg_emu_update_amp(PSGEmu *emu)
+{
+    int32_t env = psg_emu_dac[(emu->env_step ^ emu->env_attack) & 0x1f];
+
+    emu->amp = (emu->fixed_amp & ~emu->env_mask) |
+        (psg_emu_splat(env) & emu->env_mask);
+}
+
+static void
+psg_emu_env_restart(PSGEmu *emu, uint8_t shape)
+{
+    emu->env_attack = (shape & 0x04) ? 0x1f : 0;
+    if ((shape & 0x08) == 0) {
+        /* shapes 0-7: one ramp, then hold at 0 */
+        emu->env_hold = 1;
+        emu->env_alternate = (emu->env_attack != 0);
+    } else {
+        emu->env_hold = shape & 0x01;
+        emu->env_alternate = (shape & 0x02) != 0;
+    }
+    emu->env_step = 0x1f;
+    emu->env_holding = 0;
+    emu->env_left = emu->env_per;
+}
+
+static void
+psg_emu_env_advance(PSGEmu *emu)
+{
+    if (emu->env_holding)
+        return;
+    if (--emu->env_step >= 0)
+        return;
+
+    if (emu->env_hold) {
+        if (emu->env_alternate)
+            emu->env_attack ^= 0x1f;
+        emu->env_holding = 1;
+        emu->env_step = 0;
+    } else {
+        if (emu->env_alternate)
+            emu->env_attack ^= 0x1f;
+        emu->env_step &= 0x1f;
+    }
+}
+
+static inline void
+psg_emu_noise_advance(PSGEmu *emu)
+{
+    /* 17-bit LFSR, taps at bit 0 and bit 3 */
+    uint32_t bit = (emu->lfsr ^ (emu->lfsr >> 3)) & 1;
+
+    emu->lfsr = (emu->lfsr >> 1) | (bit << 16);
+    emu->noise_out = -(int32_t)(emu->lfsr & 1);
+}
+
+void
+psg_emu_init(PSGEmu *emu, uint32_t clock_hz, uint32_t rate)
+{
+    psg_emu_dac_init();
+
+    memset(emu, 0, sizeof(*emu));
+    emu->step_rate = clock_hz / 8;
+    emu->rate = rate;
+    psg_emu_reset(emu);
+}
+
+void
+psg_emu_reset(PSGEmu *emu)
+{
+    emu->tone_cnt = psg_emu_splat(0);
+    emu->tone_out = psg_emu_splat(0);
+    emu->lfsr = 1;
+    emu->noise_out = 0;
+    emu->step_acc = 0;
+    emu->dc = 0;
+    memset(emu->blep_tail, 0, sizeof(emu->blep_tail));
+    emu->blep_acc = 0.0;
+    emu->blep_level = 0;
+
+    /* lane 3 never toggles */
+    psg_emu_v4 per = { 1, 1, 1, INT32_MAX };
+    emu->tone_per = per;
+
+    memset(emu->regs, 0, sizeof(emu->regs));
+    for (uint8_t reg = 0; reg < 14; reg++)
+        psg_emu_write(emu, reg, 0);
+}
+
+void
+psg_emu_write(PSGEmu *emu, uint8_t reg, uint8_t val)
+{
+    reg &= 0x0f;
+    emu->regs[reg] = val;
+
+    switch (reg) {
+    case AY_AFINE: case AY_ACOARSE:
+    case AY_BFINE: case AY_BCOARSE:
+    case AY_CFINE: case AY_CCOARSE: {
+        int ch = reg >> 1;
+        int32_t per = emu->regs[ch * 2] | ((emu->regs[ch * 2 + 1] & 0x0f) << 8);
+        emu->tone_per[ch] = (per != 0) ? per : 1;
+        break;
+    }
+    case AY_NOISEPER: {
+        /* the noise counter runs at clock/16 */
+        uint32_t per = val & 0x1f;
+        emu->noise_per = ((per != 0) ? per : 1) * 2;
+        if (emu->noise_left == 0 || emu->noise_left > emu->noise_per)
+            emu->noise_left = emu->noise_per;
+        break;
+    }
+    case AY_ENABLE:
+        for (int ch = 0; ch < 3; ch++) {
+            emu->tone_dis[ch] = (val & (1u << ch)) ? -1 : 0;
+            emu->noise_dis[ch] = (val & (8u << ch)) ? -1 : 0;
+        }
+        psg_emu_update_audible(emu);
+        break;
+    case AY_AVOL: case AY_BVOL: case AY_CVOL: {
+        int ch = reg - AY_AVOL;
+        uint8_t v = val & 0x0f;
+        emu->env_mask[ch] = (val & 0x10) ? -1 : 0;
+        /* 4-bit volume maps onto every other DAC step */
+        emu->fixed_amp[ch] = psg_emu_dac[(v != 0) ? v * 2 + 1 : 0];
+        psg_emu_update_amp(emu);
+        psg_emu_update_audible(emu);
+        break;
+    }
+    case AY_EFINE: case AY_ECOARSE: {
+        /* YM2149: 32 steps per 256 * EP clocks, i.e. EP clock/8 steps */
+        uint32_t per = emu->regs[AY_EFINE] | (emu->regs[AY_ECOARSE] << 8);
+        emu->env_per = (per != 0) ? per : 1;
+        if (emu->env_left == 0 || emu->env_left > emu->env_per)
+            emu->env_left = emu->env_per;
+        break;
+    }
+    case AY_ESHAPE:
+        psg_emu_env_restart(emu, val & 0x0f);
+        psg_emu_update_amp(emu);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Advance a step counter by run steps; returns how many times it expired.
+ * left is the number of steps until the next expiry (1..per).
+ */
+static inline uint32_t
+psg_emu_count(uint32_t *left, uint32_t per, uint32_t run)
+{
+    if (run < *left) {
+        *left -= run;
+        return 0;
+    }
+    run -= *left;
+    *left = per - run % per;
+    return 1 + run / per;
+}
+
+/* steps until the next toggle or audible noise/envelope step (<= n) */
+static inline uint32_t
+psg_emu_run_len(const PSGEmu *emu, uint32_t n)
+{
+    const psg_emu_v4 one = psg_emu_splat(1);
+
+    /* steps until the earliest tone toggle (at least one) */
+    psg_emu_v4 d = emu->tone_per - emu->tone_cnt;
+    d = (d & (d > one)) | (one & ~(d > one));
+    uint32_t run = (uint32_t)psg_emu_min3(d);
+    if (run > n)
+        run = n;
+    if (emu->noise_audible && run > emu->noise_left)
+        run = emu->noise_left;
+    if (emu->env_audible && run > emu->env_left)
+        run = emu->env_left;
+    return run;
+}
+
+/* mixer: (tone | tone disabled) & (noise | noise disabled), per lane */
+static inline psg_emu_v4
+psg_emu_output(const PSGEmu *emu)
+{
+    psg_emu_v4 out = (emu->tone_out | emu->tone_dis) &
+        (psg_emu_splat(emu->noise_out) | emu->noise_dis);
+    return out & emu->amp;
+}
+
+/* advance all counters by run steps */
+static inline void
+psg_emu_advance(PSGEmu *emu, uint32_t run)
+{
+    /* tone counters */
+    emu->tone_cnt += psg_emu_splat((int32_t)run);
+    psg_emu_v4 t = emu->tone_cnt >= emu->tone_per;
+    emu->tone_out ^= t;
+    emu->tone_cnt &= ~t;
+
+    for (uint32_t k = psg_emu_count(&emu->noise_left, emu->noise_per,
+        run); k > 0; k--)
+        psg_emu_noise_advance(emu);
+    uint32_t k = psg_emu_count(&emu->env_left, emu->env_per, run);
+    if (k > 0) {
+        while (k-- > 0 && !emu->env_holding)
+            psg_emu_env_advance(emu);
+        psg_emu_update_amp(emu);
+    }
+}
+
+/*
+ * Advance n clock/8 steps and return the sum of the channel outputs
+ * over them.  Instead of stepping one by one, jump straight to the next
+ * step where a tone output toggles, the LFSR shifts or the envelope
+ * moves; the output is constant in between.  Noise and envelope steps
+ * that cannot be heard do not end a run, they are caught up afterwards.
+ */
+static inline int32_t
+psg_emu_run(PSGEmu *emu, uint32_t n)
+{
+    psg_emu_v4 sum = psg_emu_splat(0);
+
+    while (n > 0) {
+        uint32_t run = psg_emu_run_len(emu, n);
+        sum += psg_emu_output(emu) * psg_emu_splat((int32_t)run);
+        psg_emu_advance(emu, run);
+        n -= run;
+    }
+    return sum[0] + sum[1] + sum[2];
+}
+
+/* --- band-limited steps (PSG_EMU_QUALITY_GOOD / BEST) --- */
+
+/*
+ * Each change of the mixed output level is added to a delta buffer as a
+ * windowed-sinc impulse placed at its sub-sample position, and the
+ * output is the running sum of that buffer.  The kernel is stored in
+ * polyphase form: phase p holds the taps for an impulse at p / phases
+ * of a sample.  Output is delayed by taps / 2 samples.
+ */
+typedef struct psg_emu_blep {
+    int taps;
+    int phases;
+    double cutoff;              /* relative to the output Nyquist rate */
+    float *kernel;              /* phases * taps, 16-byte aligned */
+} psg_emu_blep_t;
+
+static psg_emu_blep_t psg_emu_blep_tab[] = {
+    [PSG_EMU_QUALITY_GOOD] = { 16, 32, 0.80, NULL },
+    [PSG_EMU_QUALITY_BEST] = { PSG_EMU_BLEP_TAPS_MAX, 64, 0.90, NULL },
+};
+
+static const psg_emu_blep_t *
+psg_emu_blep_get(int quality)
+{
+    psg_emu_blep_t *b = &psg_emu_blep_tab[quality];
+
+    if (b->kernel != NULL)
+        return b;
+
+    float *k;
+    if (posix_memalign((void **)&k, 16,
+        (size_t)b->phases * b->taps * sizeof(float)) != 0)
+        return NULL;
+
+    for (int p = 0; p < b->phases; p++) {
+        float *kp = k + p * b->taps;
+        double sum = 0.0;
+
+        for (int i = 0; i < b->taps; i++) {
+            /* distance from the impulse, in output samples */
+            double x = i - b->taps / 2 - (double)p / b->phases;
+            double w = (x + b->taps / 2.0) / b->taps;   /* 0..1 */
+            double sinc = (x == 0.0) ? 1.0 :
+                sin(M_PI * b->cutoff * x) / (M_PI * b->cutoff * x);
+            double blackman = (w <= 0.0 || w >= 1.0) ? 0.0 :
+                0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+            kp[i] = (float)(sinc * blackman);
+            sum += kp[i];
+        }
+        /* unity DC gain for every phase */
+        for (int i = 0; i < b->taps; i++)
+            kp[i] = (float)(kp[i] / sum);
+    }
+    b->kernel = k;
+    return b;
+}
+
+/* dst[0..taps) += delta * kern[0..taps); taps is a multiple of 4 */
+static inline void
+psg_emu_blep_add(float *dst, const float *kern, int taps, float delta)
+{
+#if defined(__SSE2__)
+    __m128 d = _mm_set1_ps(delta);
+    for (int i = 0; i < taps; i += 4) {
+        __m128 v = _mm_loadu_ps(dst + i);
+        v = _mm_add_ps(v, _mm_mul_ps(d, _mm_load_ps(kern + i)));
+        _mm_storeu_ps(dst + i, v);
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t d = vdupq_n_f32(delta);
+    for (int i = 0; i < taps; i += 4) {
+        float32x4_t v = vld1q_f32(dst + i);
+        vst1q_f32(dst + i, vmlaq_f32(v, vld1q_f32(kern + i), d));
+    }
+#else
+    for (int i = 0; i < taps; i++)
+        dst[i] += delta * kern[i];
+#endif
+}
+
+/*
+ * Advance the n steps of one sample, adding level changes at dst.
+ * acc is the step accumulator before this sample: step `done' of the
+ * sample lies at (done * rate - acc) / step_rate output samples from
+ * the sample start.  That is offset by one step (rate / step_rate) so
+ * that it is never negative, so an impulse may land in the next slot.
+ */
+static inline void
+psg_emu_run_blep(PSGEmu *emu, uint32_t n, uint32_t acc, float *dst)
+{
+    const psg_emu_blep_t *b = emu->blep;
+    uint32_t done = 0;
+
+    while (done < n) {
+        uint32_t run = psg_emu_run_len(emu, n - done);
+        psg_emu_v4 o = psg_emu_output(emu);
+        int32_t level = o[0] + o[1] + o[2];
+
+        if (level != emu->blep_level) {
+            uint64_t pos = (uint64_t)(done + 1) * emu->rate - acc;
+            uint32_t slot = (uint32_t)(pos / emu->step_rate);
+            uint32_t phase = (uint32_t)((pos % emu->step_rate) *
+                b->phases / emu->step_rate);
+            psg_emu_blep_add(dst + slot, b->kernel + phase * b->taps,
+                b->taps, (float)(level - emu->blep_level));
+            emu->blep_level = level;
+        }
+        psg_emu_advance(emu, run);
+        done += run;
+    }
+}
+
+/* the chip output is unipolar; remove DC with a one-pole filter */
+static inline int16_t
+psg_emu_dc_block(PSGEmu *emu, int32_t x)
+{
+    emu->dc += ((x << 8) - emu->dc) >> 10;
+    int32_t y = x - (emu->dc >> 8);
+    if (y > INT16_MAX)
+        y = INT16_MAX;
+    if (y < INT16_MIN)
+        y = INT16_MIN;
+    return (int16_t)y;
+}
+
+/* clock/8 steps covered by the next sample */
+static inline uint32_t
+psg_emu_sample_steps(PSGEmu *emu)
+{
+    uint32_t acc = emu->step_acc + emu->step_rate;
+
+    emu->step_acc = acc % emu->rate;
+    return acc / emu->rate;
+}
+
+#define PSG_EMU_BLEP_CHUNK  256
+
+static void
+psg_emu_render_blep(PSGEmu *emu, int16_t *out, size_t n)
+{
+    const int taps = emu->blep->taps;
+    float buf[PSG_EMU_BLEP_CHUNK + PSG_EMU_BLEP_TAPS_MAX + 1];
+
+    while (n > 0) {
+        size_t chunk = (n > PSG_EMU_BLEP_CHUNK) ? PSG_EMU_BLEP_CHUNK : n;
+
+        /* deltas already spread past the previous chunk */
+        memcpy(buf, emu->blep_tail, (taps + 1) * sizeof(float));
+        memset(buf + taps + 1, 0, chunk * sizeof(float));
+
+        psg_emu_render_raw(emu, buf, chunk);
+        psg_emu_render_finish(emu, out, buf, chunk);
+        memcpy(emu->blep_tail, buf + chunk, (taps + 1) * sizeof(float));
+
+        out += chunk;
+        n -= chunk;
+    }
+}
+
+int
+psg_emu_set_quality(PSGEmu *emu, int quality)
+{
+    switch (quality) {
+    case PSG_EMU_QUALITY_FAST:
+        emu->blep = NULL;
+        break;
+    case PSG_EMU_QUALITY_GOOD:
+    case PSG_EMU_QUALITY_BEST:
+        emu->blep = psg_emu_blep_get(quality);
+        if (emu->blep == NULL)
+            return 0;
+        break;
+    default:
+        return 0;
+    }
+    emu->quality = quality;
+    memset(emu->blep_tail, 0, sizeof(emu->blep_tail));
+    emu->blep_acc = 0.0;
+    emu->blep_level = 0;
+    return 1;
+}
+
+void
+psg_emu_render(PSGEmu *emu, int16_t *out, size_t n)
+{
+    if (emu->blep != NULL) {
+        psg_emu_render_blep(emu, out, n);
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        /* box filter: average of the steps covered by this sample */
+        uint32_t steps = psg_emu_sample_steps(emu);
+        int32_t x = (steps != 0) ?
+            psg_emu_run(emu, steps) / (int32_t)steps : 0;
+        out[i] = psg_emu_dc_block(emu, x);
+    }
+}
+
+void
+psg_emu_render_raw(PSGEmu *emu, float *raw, size_t n)
+{
+    if (emu->blep != NULL) {
+        for (size_t i = 0; i < n; i++) {
+            uint32_t acc = emu->step_acc;
+            uint32_t steps = psg_emu_sample_steps(emu);
+            psg_emu_run_blep(emu, steps, acc, raw + i);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t steps = psg_emu_sample_steps(emu);
+        raw[i] = (float)((steps != 0) ?
+            psg_emu_run(emu, steps) / (int32_t)steps : 0);
+    }
+}
+
+void
+psg_emu_render_finish(PSGEmu *emu, int16_t *out, const float *raw, size_t n)
+{
+    if (emu->blep != NULL) {
+        for (size_t i = 0; i < n; i++) {
+            emu->blep_acc += raw[i];
+            out[i] = psg_emu_dc_block(emu, (int32_t)lrint(emu->blep_acc));
+        }
+        return;
+    }
+
+    /* box filter levels are integers, exact in a float */
+    for (size_t i = 0; i < n; i++)
+        out[i] = psg_emu_dc_block(emu, (int32_t)raw[i]);
+}
+
+/* --- state-only advance --- */
+
+/* 17-bit LFSR with taps 0 and 3 (x^17 + x^14 + 1) is maximal length */
+#define PSG_EMU_LFSR_PERIOD 131071u
+
+/* shift the LFSR k times */
+static void
+psg_emu_noise_jump(PSGEmu *emu, uint64_t k)
+{
+    uint32_t lfsr = emu->lfsr;
+
+    /*
+     * The first m <= 14 feedback bits only depend on bits that are
+     * still the original ones, so they can be shifted in at once.
+     */
+    k %= PSG_EMU_LFSR_PERIOD;
+    while (k > 0) {
+        uint32_t m = (k > 14) ? 14 : (uint32_t)k;
+        uint32_t fb = (lfsr ^ (lfsr >> 3)) & ((1u << m) - 1);
+        lfsr = (lfsr >> m) | (fb << (17 - m));
+        k -= m;
+    }
+    emu->lfsr = lfsr;
+    emu->noise_out = -(int32_t)(lfsr & 1);
+}
+
+/* advance all counters by run steps, any number of events apart */
+static void
+psg_emu_jump(PSGEmu *emu, uint64_t run)
+{
+    if (run == 0)
+        return;
+
+    for (int ch = 0; ch < 4; ch++) {
+        uint64_t per = (uint64_t)emu->tone_per[ch];
+        uint64_t cnt = (uint64_t)emu->tone_cnt[ch];
+        uint64_t r = run;
+
+        if (cnt >= per) {
+            /* period was shortened below the count: toggles next step */
+            emu->tone_out[ch] = ~emu->tone_out[ch];
+            cnt = 0;
+            r--;
+        }
+        cnt += r;
+        if ((cnt / per) & 1)
+            emu->tone_out[ch] = ~emu->tone_out[ch];
+        emu->tone_cnt[ch] = (int32_t)(cnt % per);
+    }
+
+    /* psg_emu_count() takes 32-bit runs */
+    uint64_t nk = 0, ek = 0;
+    for (uint64_t left = run; left > 0; ) {
+        uint32_t r = (left > UINT32_MAX) ? UINT32_MAX : (uint32_t)left;
+        nk += psg_emu_count(&emu->noise_left, emu->noise_per, r);
+        ek += psg_emu_count(&emu->env_left, emu->env_per, r);
+        left -= r;
+    }
+    psg_emu_noise_jump(emu, nk);
+    if (ek > 0) {
+        /* repeating shapes cycle through 64 steps at most */
+        if (!emu->env_hold && ek > 64)
+            ek = 64 + ek % 64;
+        while (ek-- > 0 && !emu->env_holding)
+            psg_emu_env_advance(emu);
+        psg_emu_update_amp(emu);
+    }
+}
+
+void
+psg_emu_skip(PSGEmu *emu, size_t n)
+{
+    uint64_t acc = emu->step_acc + (uint64_t)n * emu->step_rate;
+    uint64_t steps = acc / emu->rate;
+
+    emu->step_acc = (uint32_t)(acc % emu->rate);
+    if (steps == 0)
+        return;
+
+    /*
+     * Band-limited output remembers the level of the last step; the
+     * output is constant within a run, so that is the level of the
+     * last step here as well.
+     */
+    psg_emu_jump(emu, steps - 1);
+    if (emu->blep != NULL) {
+        psg_emu_v4 o = psg_emu_output(emu);
+        emu->blep_level = o[0] + o[1] + o[2];
+    }
+    psg_emu_jump(emu, 1);
+}
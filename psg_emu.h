@@ -0,0 +1,131 @@
+/*
+ * psg_emu.h
+ *  Software AY-3-8910 / YM2149 emulation
+ *
+ *  Tone counters, 17-bit noise LFSR, envelope generator (YM2149
+ *  32-step), mixer and logarithmic volume DAC.  The three channels
+ *  are kept in the lanes of a GCC vector so that each counter step
+ *  updates all of them at once, and the chip is advanced in runs up
+ *  to the next counter event instead of one clock/8 step at a time.
+ */
+
+#ifndef PSG_EMU_H
+#define PSG_EMU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSG_EMU_CLOCK_DEFAULT   2000000u    /* 2MHz, see psg_backend_rpi_gpio.c */
+#define PSG_EMU_RATE_DEFAULT    44100u
+
+/* output filter quality tiers */
+enum {
+    PSG_EMU_QUALITY_FAST = 0,   /* box filter (average per sample) */
+    PSG_EMU_QUALITY_GOOD,       /* band-limited steps, 16 taps */
+    PSG_EMU_QUALITY_BEST,       /* band-limited steps, 32 taps */
+    PSG_EMU_QUALITY_COUNT
+};
+
+#define PSG_EMU_BLEP_TAPS_MAX   32
+
+/* extra entries past the end of a raw buffer (band-limited step spill) */
+#define PSG_EMU_RAW_PAD         (PSG_EMU_BLEP_TAPS_MAX + 1)
+
+/* lanes 0..2: channel A..C, lane 3: unused (never toggles, amplitude 0) */
+typedef int32_t psg_emu_v4 __attribute__((vector_size(16)));
+
+typedef struct PSGEmu {
+    /* per-channel state */
+    psg_emu_v4 tone_cnt;        /* tone counters (clock/8 steps) */
+    psg_emu_v4 tone_per;        /* tone periods (>= 1) */
+    psg_emu_v4 tone_out;        /* tone outputs (-1 / 0) */
+    psg_emu_v4 tone_dis;        /* R7 tone disable (-1: disabled) */
+    psg_emu_v4 noise_dis;       /* R7 noise disable (-1: disabled) */
+    psg_emu_v4 env_mask;        /* R8-R10 bit 4 (-1: envelope mode) */
+    psg_emu_v4 fixed_amp;       /* DAC level of R8-R10 fixed volume */
+    psg_emu_v4 amp;             /* current DAC level */
+
+    /* noise */
+    uint32_t lfsr;              /* 17-bit LFSR */
+    int32_t  noise_out;         /* -1 / 0 */
+    uint32_t noise_per;         /* clock/8 steps per LFSR shift */
+    uint32_t noise_left;        /* steps until next shift */
+
+    /* envelope */
+    uint32_t env_per;           /* clock/8 steps per envelope step */
+    uint32_t env_left;          /* steps until next envelope step */
+    int32_t  env_step;          /* 31..0 */
+    int32_t  env_attack;        /* 0x1f when counting up */
+    uint8_t  env_hold;
+    uint8_t  env_alternate;
+    uint8_t  env_holding;
+
+    /* only audible noise / envelope steps need to end a run */
+    uint8_t  noise_audible;
+    uint8_t  env_audible;
+
+    uint8_t  regs[16];
+
+    /* resampling (box filter over the clock/8 steps of each sample) */
+    uint32_t step_rate;         /* clock / 8 */
+    uint32_t rate;              /* output sample rate */
+    uint32_t step_acc;          /* fractional steps carried over */
+    int32_t  dc;                /* DC blocker state (<< 8) */
+
+    /* band-limited step output (quality GOOD / BEST) */
+    int      quality;
+    const struct psg_emu_blep *blep;    /* NULL: box filter */
+    int32_t  blep_level;        /* last mixed output level */
+    double   blep_acc;          /* integrator */
+    float    blep_tail[PSG_EMU_BLEP_TAPS_MAX + 1];  /* deltas for next samples */
+} PSGEmu;
+
+/*
+ * initialize with chip clock (Hz) and output sample rate (Hz)
+ *  quality starts at PSG_EMU_QUALITY_FAST.
+ */
+void psg_emu_init(PSGEmu *emu, uint32_t clock_hz, uint32_t rate);
+
+/* select output filter (PSG_EMU_QUALITY_xxx); 0 on failure */
+int psg_emu_set_quality(PSGEmu *emu, int quality);
+
+/* reset all registers and counters */
+void psg_emu_reset(PSGEmu *emu);
+
+/* register write; takes effect from the next rendered sample */
+void psg_emu_write(PSGEmu *emu, uint8_t reg, uint8_t val);
+
+/* render n mono 16-bit samples */
+void psg_emu_render(PSGEmu *emu, int16_t *out, size_t n);
+
+/*
+ * Advance the chip by n samples without producing output.  The chip
+ * state afterwards is the same as after psg_emu_render() of n samples;
+ * only the output filter state (integrator, DC blocker) is left as is.
+ * Tone, noise and envelope counters are jumped arithmetically, so this
+ * costs next to nothing compared with rendering.
+ */
+void psg_emu_skip(PSGEmu *emu, size_t n);
+
+/*
+ * psg_emu_render() split in two for rendering a song in independent
+ * pieces: psg_emu_render_raw() advances the chip by n samples and adds
+ * their pre-filter values to raw[] (sample levels for FAST, level
+ * deltas for the band-limited tiers), and psg_emu_render_finish() turns
+ * raw values into PCM with the integrator / DC blocker of emu.
+ * raw[] holds n + PSG_EMU_RAW_PAD entries, zeroed by the caller; level
+ * deltas of the last samples spill into the pad.
+ */
+void psg_emu_render_raw(PSGEmu *emu, float *raw, size_t n);
+void psg_emu_render_finish(PSGEmu *emu, int16_t *out, const float *raw,
+    size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PSG_EMU_H */
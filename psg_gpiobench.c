@@ -0,0 +1,332 @@
+/*
+ * psg_gpiobench.c
+ *  GPIO bus logic check and benchmark without a Raspberry Pi
+ *
+ *  Plays each given song headlessly through psg_backend_rpi_gpio with
+ *  its registers mapped from anonymous memory (or a plain file).  A
+ *  first pass decodes the GPSET0 / GPCLR0 store sequence back into
+ *  YM2149 bus cycles and checks that it carries exactly the register
+ *  writes of the driver (a batch may be reordered across registers as
+ *  psg_backend_order_latch() allows); the MMIO operations per write are
+ *  reported from it.  A second pass without the trace times the bus code.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "psg_compat.h"
+#include "p6psg.h"
+#include "psg_driver.h"
+#include "psg_backend.h"
+#include "psg_backend_rpi_gpio.h"
+
+/* default length: 3 minutes */
+#define DEFAULT_TICKS   (3u * 60u * 500u)
+
+typedef struct bench {
+    psg_backend_t psgbe;
+    psg_backend_ops_t ops;
+    int single;                 /* write_reg per write (ym_write_reg_raw) */
+    uint32_t nread;             /* wait loop count (0: calibrate) */
+    int hist;                   /* latency histograms of the timed pass */
+    psg_rpi_gpio_hist_t h;
+
+    /* writes handed to the backend, checked against the decoder */
+    psg_regval_t want[PSG_WRITE_BATCH_MAX];
+    unsigned int nwant;
+    unsigned int ngot;
+    uint32_t left;              /* want[] entries not decoded yet */
+    uint64_t writes;
+    uint64_t mismatches;
+} bench_t;
+
+/* --- timing helpers --- */
+static inline uint64_t
+nsec_now_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void
+bench_decoded_cb(void *opaque, uint8_t reg, uint8_t val)
+{
+    bench_t *b = opaque;
+    unsigned int group = psg_reg_order_group(reg);
+    unsigned int i;
+
+    /* the first write left of its group must be this one */
+    for (i = 0; i < b->nwant; i++) {
+        if ((b->left & (1u << i)) != 0 &&
+            psg_reg_order_group(b->want[i].reg) == group)
+            break;
+    }
+    if (i == b->nwant || (b->want[i].reg & 0x0f) != reg ||
+        b->want[i].val != val)
+        b->mismatches++;
+    else
+        b->left &= ~(1u << i);
+    b->ngot++;
+}
+
+static void
+bench_write(bench_t *b, const psg_regval_t *rv, unsigned int n)
+{
+    /* the driver never hands over more; want[] and left are sized for it */
+    assert(n <= PSG_WRITE_BATCH_MAX);
+    memcpy(b->want, rv, n * sizeof(*rv));
+    b->nwant = n;
+    b->ngot = 0;
+    b->left = (n >= 32) ? 0xffffffffu : (1u << n) - 1u;
+    if (b->single) {
+        for (unsigned int i = 0; i < n; i++)
+            (void)(*b->psgbe.ops->write_reg)(&b->psgbe, rv[i].reg, rv[i].val);
+    } else {
+        (void)psg_backend_write_regs(&b->psgbe, rv, n);
+    }
+    if (b->ngot != n)
+        b->mismatches++;
+    b->writes += n;
+}
+
+static void
+bench_write_reg_cb(void *opaque, uint8_t reg, uint8_t val)
+{
+    psg_regval_t rv = { reg, val };
+
+    bench_write(opaque, &rv, 1);
+}
+
+static void
+bench_write_regs_cb(void *opaque, const PSGRegWrite *w, unsigned int n)
+{
+    bench_write(opaque, w, n);
+}
+
+/*
+ * play one song through the GPIO backend; dec != NULL attaches the
+ * decoder.  Returns elapsed ns of the tick loop, 0 on error.
+ */
+static uint64_t
+bench_play(bench_t *b, const p6psg_channel_dataset_t *channels,
+    uint32_t max_ticks, const char *mmio_path, psg_rpi_gpio_decoder_t *dec)
+{
+    psg_rpi_gpio_mmio_t mmio;
+    PSGDriver drv;
+    uint64_t elapsed = 0;
+    int inited = 0, enabled = 0;
+
+    b->writes = 0;
+    b->mismatches = 0;
+    psg_backend_rpi_gpio_bind(&b->ops);
+    memset(&b->psgbe, 0, sizeof(b->psgbe));
+    b->psgbe.ops = &b->ops;
+
+    memset(&mmio, 0, sizeof(mmio));
+    mmio.path = mmio_path;
+    mmio.soc = "BCM2836";       /* fixed divisors, independent of the host */
+    if (dec != NULL) {
+        psg_rpi_gpio_decoder_init(dec, bench_decoded_cb, b);
+        mmio.trace = psg_rpi_gpio_decode;
+        mmio.opaque = dec;
+    }
+
+    if ((*b->ops.init)(&b->psgbe) == 0)
+        goto out;
+    inited = 1;
+    if (psg_backend_rpi_gpio_configure(&b->psgbe, &mmio) == 0 ||
+        psg_backend_rpi_gpio_set_timing(&b->psgbe, PSG_RPI_GPIO_CHIP_YM2149,
+            b->nread) == 0 ||
+        psg_backend_rpi_gpio_set_hist(&b->psgbe,
+            b->hist && dec == NULL) == 0 ||
+        (*b->ops.enable)(&b->psgbe) == 0)
+        goto out;
+    enabled = 1;
+
+    /* the setup on enable is not part of the song */
+    if (dec != NULL) {
+        dec->stores = dec->loads = dec->barriers = 0;
+        dec->latches = dec->writes = 0;
+    }
+
+    psg_driver_init(&drv, bench_write_reg_cb, NULL, b);
+    if (!b->single)
+        psg_driver_set_write_regs(&drv, bench_write_regs_cb);
+    for (int i = 0; i < P6PSG_CH_COUNT; i++)
+        psg_driver_set_channel_data(&drv, i, channels->ch[i].ptr);
+    psg_driver_start(&drv);
+
+    uint64_t t0 = nsec_now_monotonic();
+    while (drv.tick_count < max_ticks && psg_driver_is_active(&drv))
+        psg_driver_tick(&drv);
+    uint64_t t1 = nsec_now_monotonic();
+    psg_driver_stop(&drv);
+    elapsed = (t1 > t0) ? t1 - t0 : 1;
+
+ out:
+    if (elapsed == 0) {
+        fprintf(stderr, "rpi-gpio: %s\n",
+            psg_backend_last_error(&b->psgbe));
+    }
+    if (enabled) {
+        /* leave the silencing writes on disable out of the counts */
+        psg_rpi_gpio_decoder_t song;
+        if (dec != NULL) {
+            dec->on_write = NULL;
+            song = *dec;
+        }
+        (*b->ops.disable)(&b->psgbe);
+        if (dec != NULL)
+            *dec = song;
+    }
+    if (inited) {
+        if (b->hist && dec == NULL)
+            (void)psg_backend_rpi_gpio_hist(&b->psgbe, &b->h);
+        (*b->ops.fini)(&b->psgbe);
+    }
+    return elapsed;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "Usage: %s [-Hs] [-m mmiofile] [-n ticks] [-r nread]\n"
+        "       [-M stores_per_write]\n"
+        "       p6psgfile ...\n",
+        getprogname());
+
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *mmio_path = NULL;
+    uint32_t max_ticks = DEFAULT_TICKS;
+    double max_stores = 0.0;
+    int single = 0;
+    int hist = 0;
+    unsigned long nread = PSG_RPI_GPIO_NREAD_DEFAULT;
+    unsigned int nfail = 0;
+    char *ep;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "Hm:M:n:r:s")) != -1) {
+        switch (ch) {
+        case 'H':
+            hist = 1;
+            break;
+        case 'm':
+            mmio_path = optarg;
+            break;
+        case 'M':
+            max_stores = strtod(optarg, &ep);
+            if (*optarg == '\0' || *ep != '\0' || max_stores < 0.0)
+                usage();
+            break;
+        case 'n':
+            max_ticks = (uint32_t)strtoul(optarg, &ep, 0);
+            if (*optarg == '\0' || *ep != '\0')
+                usage();
+            break;
+        case 'r':
+            nread = strtoul(optarg, &ep, 0);
+            if (*optarg == '\0' || *ep != '\0' || nread > 1024)
+                usage();
+            break;
+        case 's':
+            single = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1)
+        usage();
+
+    for (int i = 0; i < argc; i++) {
+        const char *song = argv[i];
+        p6psg_t *p6psg;
+        p6psg_channel_dataset_t channels;
+        psg_rpi_gpio_decoder_t dec;
+        bench_t b;
+        const char *result = "ok";
+
+        p6psg = p6psg_create();
+        if (p6psg == NULL) {
+            fprintf(stderr, "p6psg: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        if (p6psg_load(p6psg, song, &channels) == 0) {
+            fprintf(stderr, "%s: %s\n", song, p6psg_last_error(p6psg));
+            printf("%-7s %s\n", "ERROR", song);
+            p6psg_destroy(p6psg);
+            nfail++;
+            continue;
+        }
+
+        memset(&b, 0, sizeof(b));
+        b.single = single;
+        b.nread = (uint32_t)nread;
+        b.hist = hist;
+        uint64_t ns_trace = bench_play(&b, &channels, max_ticks, mmio_path,
+            &dec);
+        uint64_t writes = b.writes;
+        uint64_t mismatches = b.mismatches;
+        uint64_t ns = (ns_trace != 0) ?
+            bench_play(&b, &channels, max_ticks, mmio_path, NULL) : 0;
+        p6psg_destroy(p6psg);
+
+        if (ns_trace == 0 || ns == 0) {
+            printf("%-7s %s\n", "ERROR", song);
+            nfail++;
+            continue;
+        }
+
+        double w = (writes != 0) ? (double)writes : 1.0;
+        if (mismatches != 0 || dec.writes != writes) {
+            fprintf(stderr, "%s: %llu of %llu writes not on the bus as "
+                "issued (%llu decoded)\n", song,
+                (unsigned long long)mismatches, (unsigned long long)writes,
+                (unsigned long long)dec.writes);
+            result = "FAIL";
+        }
+        if (dec.errors != 0) {
+            fprintf(stderr, "%s: %llu bus protocol errors, first: %s\n",
+                song, (unsigned long long)dec.errors, dec.error);
+            result = "FAIL";
+        }
+        if (max_stores > 0.0 && dec.stores / w > max_stores) {
+            fprintf(stderr, "%s: %.2f stores/write exceeds %.2f\n",
+                song, dec.stores / w, max_stores);
+            result = "FAIL";
+        }
+        if (strcmp(result, "ok") != 0)
+            nfail++;
+
+        printf("%-7s %s: %llu writes, per write %.2f stores, %.2f loads, "
+            "%.2f barriers, %.2f latches, wait >= %u loads, %.1f ns\n",
+            result, song, (unsigned long long)writes,
+            dec.stores / w, dec.loads / w, dec.barriers / w, dec.latches / w,
+            (dec.wait_min != UINT32_MAX) ? dec.wait_min : 0,
+            (double)ns / w);
+        if (hist) {
+            psg_hist_print(stdout, "write", &b.h.write);
+            psg_hist_print(stdout, "burst", &b.h.burst);
+        }
+    }
+
+    if (nfail != 0)
+        printf("%u of %d songs failed\n", nfail, argc);
+    exit((nfail != 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
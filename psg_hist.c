@@ -0,0 +1,68 @@
+/*
+ * psg_hist.c
+ *  Log-bucketed latency histograms
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "psg_hist.h"
+
+void
+psg_hist_fmt_ns(char *buf, size_t len, uint64_t ns)
+{
+    if (ns < 1000u)
+        snprintf(buf, len, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000u)
+        snprintf(buf, len, "%.3gus", ns / 1e3);
+    else if (ns < 1000000000u)
+        snprintf(buf, len, "%.3gms", ns / 1e6);
+    else
+        snprintf(buf, len, "%.3gs", ns / 1e9);
+}
+
+uint64_t
+psg_hist_percentile(const psg_hist_t *h, double p)
+{
+    uint64_t want = (uint64_t)(h->count * p / 100.0 + 0.5);
+    uint64_t cum = 0;
+
+    if (want == 0)
+        want = 1;
+    for (int i = 0; i < PSG_HIST_BUCKETS - 1; i++) {
+        cum += h->bucket[i];
+        if (cum >= want) {
+            uint64_t hi = 1ull << (i + 1);
+            return (hi < h->max_ns) ? hi : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+void
+psg_hist_print(FILE *fp, const char *name, const psg_hist_t *h)
+{
+    char lo[16], hi[16], avg[16], max[16];
+    uint64_t cum = 0;
+
+    if (h->count == 0)
+        return;
+
+    psg_hist_fmt_ns(avg, sizeof(avg), h->sum_ns / h->count);
+    psg_hist_fmt_ns(max, sizeof(max), h->max_ns);
+    fprintf(fp, "%s: %llu samples, avg %s, max %s\n", name,
+        (unsigned long long)h->count, avg, max);
+
+    for (int i = 0; i < PSG_HIST_BUCKETS; i++) {
+        if (h->bucket[i] == 0)
+            continue;
+        cum += h->bucket[i];
+        psg_hist_fmt_ns(lo, sizeof(lo), (i == 0) ? 0 : 1ull << i);
+        if (i == PSG_HIST_BUCKETS - 1)
+            snprintf(hi, sizeof(hi), "-");
+        else
+            psg_hist_fmt_ns(hi, sizeof(hi), 1ull << (i + 1));
+        fprintf(fp, "%s:   %7s .. %-7s %10llu %7.3f%%\n", name, lo, hi,
+            (unsigned long long)h->bucket[i], 100.0 * cum / h->count);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * psg_hist.h
+ *  Log-bucketed latency histograms
+ *
+ *  Bucket i counts durations in [2^i, 2^(i+1)) ns (bucket 0 also 0 ns,
+ *  the last one everything longer).  Adding a sample is a few
+ *  instructions, so it can stay in the write paths when enabled.
+ */
+
+#ifndef PSG_HIST_H
+#define PSG_HIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PSG_HIST_BUCKETS    32      /* up to 2^31 ns (2.1 s) */
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t bucket[PSG_HIST_BUCKETS];
+} psg_hist_t;
+
+static inline void
+psg_hist_add(psg_hist_t *h, uint64_t ns)
+{
+    unsigned int i = (ns > 1) ? 63u - (unsigned int)__builtin_clzll(ns) : 0;
+
+    if (i >= PSG_HIST_BUCKETS)
+        i = PSG_HIST_BUCKETS - 1;
+    h->bucket[i]++;
+    h->count++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+}
+
+/*
+ * Print count, average, maximum and the non-empty buckets with their
+ * cumulative share as "name: ..." lines; nothing if h is empty.
+ */
+void psg_hist_print(FILE *fp, const char *name, const psg_hist_t *h);
+
+/*
+ * Upper bound of the p-th percentile (0 < p <= 100): the end of the
+ * bucket it falls in, or the maximum if that is smaller.
+ */
+uint64_t psg_hist_percentile(const psg_hist_t *h, double p);
+
+/* duration with a unit that keeps it short: "512ns", "16.4us", "2.1ms" */
+void psg_hist_fmt_ns(char *buf, size_t len, uint64_t ns);
+
+#endif /* PSG_HIST_H */
@@ -0,0 +1,153 @@
+/*
+ * psg_jitter.c
+ *  Tick jitter and overrun accounting for the player loop
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "psg_hist.h"
+#include "psg_jitter.h"
+
+static inline uint32_t
+sat32(uint64_t v)
+{
+    return (v < UINT32_MAX) ? (uint32_t)v : UINT32_MAX;
+}
+
+int
+psg_jitter_open(psg_jitter_t *j, const char *log_path, uint64_t t0,
+    uint64_t tick_ns)
+{
+    memset(j, 0, sizeof(*j));
+    j->t0 = t0;
+    j->tick_ns = tick_ns;
+    if (log_path == NULL)
+        return 1;
+
+    j->log_path = strdup(log_path);
+    if (j->log_path == NULL) {
+        snprintf(j->error, sizeof(j->error), "out of memory");
+        return 0;
+    }
+    j->log = fopen(log_path, "wb");
+    if (j->log == NULL) {
+        snprintf(j->error, sizeof(j->error), "%s: %s", log_path,
+            strerror(errno));
+        goto fail;
+    }
+
+    psg_jitter_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PSG_JITTER_MAGIC, sizeof(PSG_JITTER_MAGIC));
+    hdr.rec_size = sizeof(psg_jitter_rec_t);
+    hdr.tick_ns = (uint32_t)tick_ns;
+    if (fwrite(&hdr, sizeof(hdr), 1, j->log) != 1) {
+        snprintf(j->error, sizeof(j->error), "%s: %s", log_path,
+            strerror(errno));
+        fclose(j->log);
+        j->log = NULL;
+        goto fail;
+    }
+    return 1;
+
+ fail:
+    free(j->log_path);
+    j->log_path = NULL;
+    return 0;
+}
+
+void
+psg_jitter_tick(psg_jitter_t *j, uint64_t deadline, uint64_t now)
+{
+    psg_hist_add(&j->late, (now > deadline) ? now - deadline : 0);
+}
+
+void
+psg_jitter_wake(psg_jitter_t *j, uint64_t deadline, uint64_t now,
+    uint32_t due, int capped, uint64_t work_ns, uint64_t ui_ns)
+{
+    psg_jitter_rec_t r;
+
+    r.deadline_ns = deadline - j->t0;
+    r.late_ns = sat32((now > deadline) ? now - deadline : 0);
+    r.work_ns = sat32(work_ns);
+    r.ui_ns = sat32(ui_ns);
+    r.due = (due < UINT16_MAX) ? (uint16_t)due : UINT16_MAX;
+    r.flags = capped ? PSG_JITTER_F_CAPPED : 0;
+
+    j->wakes++;
+    if (due > 1)
+        j->bursts++;
+    if (due > j->due_max)
+        j->due_max = due;
+    if (capped)
+        j->capped++;
+    if (work_ns > j->work_max_ns)
+        j->work_max_ns = work_ns;
+    if (ui_ns > j->ui_max_ns)
+        j->ui_max_ns = ui_ns;
+    if (r.late_ns >= j->worst.late_ns)
+        j->worst = r;
+
+    if (j->log != NULL && fwrite(&r, sizeof(r), 1, j->log) != 1)
+        j->log_errors++;
+}
+
+int
+psg_jitter_close(psg_jitter_t *j)
+{
+    int ok = (j->log_errors == 0);
+
+    if (j->log != NULL && fclose(j->log) != 0)
+        ok = 0;
+    if (!ok) {
+        snprintf(j->error, sizeof(j->error), "%s: write error",
+            j->log_path);
+    }
+    j->log = NULL;
+    free(j->log_path);
+    j->log_path = NULL;
+    return ok;
+}
+
+void
+psg_jitter_print(FILE *fp, const psg_jitter_t *j)
+{
+    static const double pct[] = { 50.0, 90.0, 99.0, 99.9 };
+    char buf[16];
+
+    if (j->wakes == 0)
+        return;
+
+    fprintf(fp, "jitter: %llu ticks, lateness",
+        (unsigned long long)j->late.count);
+    for (size_t i = 0; i < sizeof(pct) / sizeof(pct[0]); i++) {
+        psg_hist_fmt_ns(buf, sizeof(buf), psg_hist_percentile(&j->late,
+            pct[i]));
+        fprintf(fp, " p%g <= %s,", pct[i], buf);
+    }
+    psg_hist_fmt_ns(buf, sizeof(buf), j->late.max_ns);
+    fprintf(fp, " max %s\n", buf);
+
+    fprintf(fp, "jitter: %llu wakes, %llu catch-up bursts, largest due %u, "
+        "cap hit %llu times\n", (unsigned long long)j->wakes,
+        (unsigned long long)j->bursts, j->due_max,
+        (unsigned long long)j->capped);
+
+    psg_hist_fmt_ns(buf, sizeof(buf), j->worst.late_ns);
+    fprintf(fp, "jitter: latest wake %s at %.3f s (%u due, ticks ", buf,
+        (double)j->worst.deadline_ns / 1e9, j->worst.due);
+    psg_hist_fmt_ns(buf, sizeof(buf), j->worst.work_ns);
+    fprintf(fp, "%s, UI ", buf);
+    psg_hist_fmt_ns(buf, sizeof(buf), j->worst.ui_ns);
+    fprintf(fp, "%s)\n", buf);
+
+    psg_hist_fmt_ns(buf, sizeof(buf), j->work_max_ns);
+    fprintf(fp, "jitter: longest ticks run %s, ", buf);
+    psg_hist_fmt_ns(buf, sizeof(buf), j->ui_max_ns);
+    fprintf(fp, "longest UI update %s\n", buf);
+}
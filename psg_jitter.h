@@ -0,0 +1,84 @@
+/*
+ * psg_jitter.h
+ *  Tick jitter and overrun accounting for the player loop
+ *
+ *  Every tick that runs is recorded with how late it started against
+ *  its deadline, so a tick run after others in a catch-up burst carries
+ *  their time too.  Every wake of the loop that runs ticks is recorded:
+ *  how late it woke against the first tick that runs (the kernel; idle
+ *  ticks skipped by the tickless loop do not count), how long the ticks
+ *  took (driver and backend writes), how long the UI update after them
+ *  took, and how many ticks ran.  Lateness percentiles, catch-up bursts
+ *  and the catch-up cap are summarized at the end; optionally each wake
+ *  goes to a binary log for plotting.
+ */
+
+#ifndef PSG_JITTER_H
+#define PSG_JITTER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "psg_hist.h"
+
+/*
+ * Log file: a header, then one record per wake, in host byte order.
+ * Durations saturate at UINT32_MAX.
+ */
+#define PSG_JITTER_MAGIC    "PSGJIT1"
+
+typedef struct {
+    char     magic[8];          /* PSG_JITTER_MAGIC */
+    uint32_t rec_size;          /* sizeof(psg_jitter_rec_t) */
+    uint32_t tick_ns;
+} psg_jitter_hdr_t;
+
+#define PSG_JITTER_F_CAPPED 0x0001u     /* due was cut to the cap */
+
+typedef struct {
+    uint64_t deadline_ns;       /* first tick run, ns after the start */
+    uint32_t late_ns;           /* wake time after that deadline */
+    uint32_t work_ns;           /* running the ticks */
+    uint32_t ui_ns;             /* UI update after them */
+    uint16_t due;               /* ticks run (idle ticks skipped: not counted) */
+    uint16_t flags;             /* PSG_JITTER_F_xxx */
+} psg_jitter_rec_t;
+
+typedef struct psg_jitter {
+    psg_hist_t late;            /* per tick run: start after its deadline */
+    uint64_t wakes;
+    uint64_t bursts;            /* wakes that ran more than one tick */
+    uint32_t due_max;
+    uint64_t capped;            /* wakes that hit the catch-up cap */
+    uint64_t work_max_ns;
+    uint64_t ui_max_ns;
+    psg_jitter_rec_t worst;     /* the latest wake */
+
+    uint64_t t0;                /* start (deadlines are relative to it) */
+    uint64_t tick_ns;
+    FILE *log;
+    char *log_path;
+    uint64_t log_errors;        /* records not written */
+    char error[128];            /* why open failed */
+} psg_jitter_t;
+
+/* start recording; log_path != NULL also writes the log */
+int psg_jitter_open(psg_jitter_t *j, const char *log_path, uint64_t t0,
+    uint64_t tick_ns);
+
+/* one tick that started at now (call it just before running the tick) */
+void psg_jitter_tick(psg_jitter_t *j, uint64_t deadline, uint64_t now);
+
+/*
+ * One wake at now that ran due ticks, the first of them with deadline
+ * (the ticks themselves go to psg_jitter_tick())
+ */
+void psg_jitter_wake(psg_jitter_t *j, uint64_t deadline, uint64_t now,
+    uint32_t due, int capped, uint64_t work_ns, uint64_t ui_ns);
+
+/* close the log; 0 with j->error set if it could not be written */
+int psg_jitter_close(psg_jitter_t *j);
+
+void psg_jitter_print(FILE *fp, const psg_jitter_t *j);
+
+#endif /* PSG_JITTER_H */
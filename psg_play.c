@@ -3,8 +3,13 @@
  *  Minimal YM2149 (AY-3-8910 compatible) player
  */
 
+#include <sys/mman.h>
 #include <sys/select.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,14 +17,60 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "psg_compat.h"
 #include "p6psg.h"
 #include "psg_driver.h"
+#include "psg_analyze.h"
+#include "psg_seek.h"
 #include "player_ui.h"
 #include "psg_backend.h"
+#include "psg_backend_null.h"
+#include "psg_backend_pcm.h"
 #include "psg_backend_rpi_gpio.h"
+#include "psg_emu.h"
+#include "psg_hist.h"
+#include "psg_jitter.h"
+#include "psg_writer.h"
 
 static volatile sig_atomic_t g_stop = 0;
 static volatile sig_atomic_t g_redraw = 0;
+static volatile sig_atomic_t g_report = 0;
+
+/* driver tick period */
+#define TICK_NS         2000000ull
+
+/* seek index range and key step ('<' / '>') */
+#define SEEK_MAX_TICKS  (10u * 60u * 500u)     /* 10 minutes */
+#define SEEK_STEP_TICKS (10u * 500u)           /* 10 seconds */
+
+/* -w: ticks run this far ahead of their write time */
+#define WRITER_LEAD_NS  TICK_NS
+
+/* -R: stack touched up front so that it is resident and locked */
+#define RT_STACK_PREFAULT   (256u * 1024u)
+
+/* -S: longest spin window (us) */
+#define SPIN_MAX_US     (TICK_NS / 1000u)
+
+/* -B backend names */
+static const struct backend_entry {
+    const char *name;
+    void (*bind)(psg_backend_ops_t *ops);
+} g_backends[] = {
+    { "rpi-gpio",   psg_backend_rpi_gpio_bind },
+    { "pcm",        psg_backend_pcm_bind },     /* emulated, streamed as PCM */
+    { "null",       psg_backend_null_bind },    /* discarded, bus time modeled */
+    { NULL,         NULL }
+};
+
+/* -C chip names */
+static const struct chip_entry {
+    const char *name;
+    const char *desc;
+} g_chips[PSG_RPI_GPIO_CHIP_COUNT] = {
+    [PSG_RPI_GPIO_CHIP_YM2149] = { "ym2149", "YM2149F" },
+    [PSG_RPI_GPIO_CHIP_AY8910] = { "ay8910", "AY-3-8910" },
+};
 
 static void
 on_signal(int signo)
@@ -28,6 +79,13 @@ on_signal(int signo)
     g_stop = 1;
 }
 
+static void
+on_report(int signo)
+{
+    (void)signo;
+    g_report = 1;
+}
+
 /* --- timing helpers --- */
 static inline uint64_t
 nsec_now_monotonic(void)
@@ -38,9 +96,19 @@ nsec_now_monotonic(void)
     return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
+/* -H: latency histograms */
+typedef struct play_hist {
+    psg_hist_t write;           /* psg_write_reg_cb() */
+    psg_hist_t burst;           /* psg_write_regs_cb(), a tick's writes */
+    psg_hist_t late;            /* tick start after its deadline */
+} play_hist_t;
+
 typedef struct psgio {
     psg_backend_t *psgbe;
     UI_state *ui;
+    psg_writer_t *writer;       /* -w: writes go through the writer thread */
+    uint64_t t_write;           /* when the writes of this tick are due */
+    play_hist_t *hist;          /* -H */
 } psgio_t;
 
 static void
@@ -49,8 +117,176 @@ psg_write_reg_cb(void *opaque, uint8_t reg, uint8_t val)
     psgio_t *psgio = opaque;
     psg_backend_t *psgbe = psgio->psgbe;
     UI_state *ui = psgio->ui;
-    (void)(*psgbe->ops->write_reg)(psgbe, reg, val);
+    uint64_t t0 = (psgio->hist != NULL) ? nsec_now_monotonic() : 0;
+    if (psgio->writer != NULL) {
+        psg_regval_t rv = { reg, val };
+        (void)psg_writer_push(psgio->writer, psgio->t_write, &rv, 1);
+    } else {
+        (void)(*psgbe->ops->write_reg)(psgbe, reg, val);
+    }
     ui_on_reg_write(ui, reg, val);
+    if (psgio->hist != NULL)
+        psg_hist_add(&psgio->hist->write, nsec_now_monotonic() - t0);
+}
+
+static void
+psg_write_regs_cb(void *opaque, const PSGRegWrite *w, unsigned int n)
+{
+    psgio_t *psgio = opaque;
+    psg_backend_t *psgbe = psgio->psgbe;
+    UI_state *ui = psgio->ui;
+    uint64_t t0 = (psgio->hist != NULL) ? nsec_now_monotonic() : 0;
+
+    for (unsigned int i = 0; i < n; i++)
+        ui_on_reg_write(ui, w[i].reg, w[i].val);
+    if (psgio->writer != NULL)
+        (void)psg_writer_push(psgio->writer, psgio->t_write, w, n);
+    else
+        (void)psg_backend_write_regs(psgbe, w, n);
+    if (psgio->hist != NULL)
+        psg_hist_add(&psgio->hist->burst, nsec_now_monotonic() - t0);
+}
+
+/* --- -R: real-time mode --- */
+
+static void
+sleep_until_ns(uint64_t t)
+{
+    struct timespec ts;
+
+    /* a signal ends the sleep early; the loop sees it as an early wake */
+    ts.tv_sec = (time_t)(t / 1000000000ull);
+    ts.tv_nsec = (long)(t % 1000000000ull);
+    (void)clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* -S: sleep-then-spin waits */
+typedef struct spin_stats {
+    uint64_t waits;
+    uint64_t spins;             /* waits that ended spinning */
+    uint64_t late_wakes;        /* the sleep alone overshot the deadline */
+    uint64_t spin_ns;           /* time spent spinning */
+    uint64_t spin_max_ns;
+    uint64_t wall_ns;           /* loop time, for the CPU share */
+    uint64_t cpu_ns;            /* tick thread CPU time in the loop */
+} spin_stats_t;
+
+static uint64_t
+nsec_thread_cpu(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Sleep until margin ns before t, then spin on CLOCK_MONOTONIC up to t.
+ * A signal that ends the sleep early returns without spinning.
+ */
+static void
+spin_until_ns(uint64_t t, uint64_t margin, spin_stats_t *st)
+{
+    uint64_t now = nsec_now_monotonic();
+
+    st->waits++;
+    if (now + margin < t) {
+        sleep_until_ns(t - margin);
+        now = nsec_now_monotonic();
+        if (now + margin < t)
+            return;
+    }
+    if (now >= t) {
+        st->late_wakes++;
+        return;
+    }
+
+    uint64_t t0 = now;
+    while (now < t)
+        now = nsec_now_monotonic();
+    st->spins++;
+    st->spin_ns += now - t0;
+    if (now - t0 > st->spin_max_ns)
+        st->spin_max_ns = now - t0;
+}
+
+static void
+prefault_stack(void)
+{
+    volatile uint8_t buf[RT_STACK_PREFAULT];
+
+    for (size_t i = 0; i < sizeof(buf); i += 4096)
+        buf[i] = 0;
+}
+
+/*
+ * Lock memory, prefault the stack and run the calling thread under
+ * SCHED_FIFO (at the middle priority).  Threads created afterwards
+ * inherit the policy.  Returns 0 with a message on failure.
+ */
+static int
+rt_setup(char *err, size_t errlen)
+{
+    struct sched_param sp;
+    int error;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        snprintf(err, errlen, "mlockall: %s", strerror(errno));
+        return 0;
+    }
+    prefault_stack();
+
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = (sched_get_priority_min(SCHED_FIFO) +
+        sched_get_priority_max(SCHED_FIFO)) / 2;
+    error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if (error != 0) {
+        snprintf(err, errlen, "SCHED_FIFO: %s", strerror(error));
+        return 0;
+    }
+    return 1;
+}
+
+/* -H: how late a tick starts (now + lead against its deadline) */
+static inline void
+tick_late(play_hist_t *hist, uint64_t lead, uint64_t deadline)
+{
+    uint64_t now = nsec_now_monotonic() + lead;
+
+    psg_hist_add(&hist->late, (now > deadline) ? now - deadline : 0);
+}
+
+/* ticks run in one wake of the loop */
+typedef struct {
+    psgio_t *psgio;
+    psg_jitter_t *jitter;       /* -J */
+    uint64_t deadline;          /* of the first due tick */
+    uint64_t tick_ns;
+    uint64_t lead;
+    uint32_t ran;               /* ticks run */
+    uint64_t first;             /* deadline of the first tick run */
+} play_run_t;
+
+/*
+ * Just before due tick i runs: its writes are due at its deadline, and
+ * its lateness is taken against that deadline, so a late tick is not
+ * hidden behind idle ones skipped before it or measured against the
+ * last tick of the burst.
+ */
+static void
+play_tick_cb(void *opaque, uint32_t i)
+{
+    play_run_t *r = opaque;
+    uint64_t deadline = r->deadline + (uint64_t)i * r->tick_ns;
+
+    r->psgio->t_write = deadline;
+    if (r->psgio->hist != NULL)
+        tick_late(r->psgio->hist, r->lead, deadline);
+    if (r->jitter != NULL)
+        psg_jitter_tick(r->jitter, deadline, nsec_now_monotonic() + r->lead);
+    if (r->ran++ == 0)
+        r->first = deadline;
 }
 
 static void
@@ -64,11 +300,154 @@ ui_note_event_cb(void *opaque, int ch, uint8_t octave, uint8_t note,
     ui_on_note_event(ui, now, ch, octave, note, volume, len, is_rest, bpm_x10);
 }
 
+static void
+print_pcm_stats(psg_backend_t *psgbe)
+{
+    psg_backend_pcm_stats_t st;
+
+    if (psg_backend_pcm_stats(psgbe, &st) == 0)
+        return;
+    fprintf(stderr, "pcm: %llu samples, %llu underruns%s\n",
+        (unsigned long long)st.samples, (unsigned long long)st.underruns,
+        st.failed ? ", stopped by a write error" : "");
+    if (st.writes > 0) {
+        fprintf(stderr, "pcm: write to sink %.2f ms avg, %.2f ms max "
+            "(+%.0f ms output latency), %llu late\n",
+            (double)st.lat_sum_ns / st.writes / 1e6,
+            (double)st.lat_max_ns / 1e6, (double)st.latency_ns / 1e6,
+            (unsigned long long)st.late_writes);
+    }
+    if (st.lead_min_ns != INT64_MAX) {
+        fprintf(stderr, "pcm: min output lead %.2f ms\n",
+            (double)st.lead_min_ns / 1e6);
+    }
+    fprintf(stderr, "pcm: ring max %u of %u entries, full %llu times\n",
+        st.ring_max, st.ring_size, (unsigned long long)st.ring_full);
+}
+
+static void
+print_null_stats(psg_backend_t *psgbe)
+{
+    psg_backend_null_stats_t st;
+
+    if (psg_backend_null_stats(psgbe, &st) == 0 || st.elapsed_ns == 0)
+        return;
+
+    double sec = (double)st.elapsed_ns / 1e9;
+    double ticks = (double)st.elapsed_ns / TICK_NS;
+    fprintf(stderr, "null: %llu writes in %.1f s, %.1f writes/s, "
+        "%.1f bytes/s, %.2f writes/tick\n",
+        (unsigned long long)st.writes, sec, st.writes / sec,
+        2.0 * st.writes / sec, st.writes / ticks);
+    fprintf(stderr, "null: writes per register:");
+    for (int i = 0; i < 16; i++)
+        fprintf(stderr, " %llu", (unsigned long long)st.reg_writes[i]);
+    fprintf(stderr, "\n");
+    if (st.batches > 0) {
+        fprintf(stderr, "null: %llu batches, %.2f writes avg, %u max\n",
+            (unsigned long long)st.batches,
+            (double)st.writes / st.batches, st.batch_max);
+    }
+    fprintf(stderr, "null: modeled bus %llu stores, %llu reads, "
+        "%llu barriers, %llu address latches\n", (unsigned long long)st.stores,
+        (unsigned long long)st.reads, (unsigned long long)st.barriers,
+        (unsigned long long)st.latches);
+    fprintf(stderr, "null: modeled bus time %.3f ms total, %.3f%% busy, "
+        "%.1f us max per tick (%.2f%% of %llu us)\n",
+        (double)st.bus_ns / 1e6, 100.0 * st.bus_ns / st.elapsed_ns,
+        (double)st.bus_max_ns / 1e3, 100.0 * st.bus_max_ns / TICK_NS,
+        (unsigned long long)(TICK_NS / 1000));
+}
+
+static void
+print_rpi_gpio_timing(psg_backend_t *psgbe)
+{
+    psg_rpi_gpio_timing_t tm;
+
+    if (psg_backend_rpi_gpio_timing(psgbe, &tm) == 0)
+        return;
+    fprintf(stderr, "rpi-gpio: %s, wait %u / %u reads",
+        g_chips[tm.chip].desc, tm.nread_addr, tm.nread_data);
+    if (tm.read_pair_ps != 0)
+        fprintf(stderr, " (%.1f ns each, calibrated, +%u%% +1 margin)",
+            tm.read_pair_ps / 1e3, tm.margin_pct);
+    fprintf(stderr, "\n");
+    if (tm.writes_per_sec != 0) {
+        fprintf(stderr, "rpi-gpio: %u writes/s batched, %u writes/s single\n",
+            tm.writes_per_sec, tm.writes_per_sec_single);
+    }
+}
+
+/*
+ * -H histograms.  With -w the backend ones are updated by the writer
+ * thread; leave rpi_gpio 0 until it is stopped rather than read them
+ * while it writes.
+ */
+static void
+print_hists(const play_hist_t *hist, psg_backend_t *psgbe, int rpi_gpio)
+{
+    psg_rpi_gpio_hist_t bh;
+
+    psg_hist_print(stderr, "tick late", &hist->late);
+    psg_hist_print(stderr, "write_reg cb", &hist->write);
+    psg_hist_print(stderr, "write_regs cb", &hist->burst);
+    if (rpi_gpio && psg_backend_rpi_gpio_hist(psgbe, &bh) != 0) {
+        psg_hist_print(stderr, "rpi-gpio write", &bh.write);
+        psg_hist_print(stderr, "rpi-gpio burst", &bh.burst);
+    }
+}
+
+static void
+print_spin_stats(const spin_stats_t *st, uint64_t margin)
+{
+    fprintf(stderr, "spin: %llu waits, %llu spun (%.1f us window), "
+        "%llu woke past the deadline\n",
+        (unsigned long long)st->waits, (unsigned long long)st->spins,
+        (double)margin / 1e3, (unsigned long long)st->late_wakes);
+    if (st->spins > 0) {
+        fprintf(stderr, "spin: %.1f us avg, %.1f us max\n",
+            (double)st->spin_ns / st->spins / 1e3,
+            (double)st->spin_max_ns / 1e3);
+    }
+    if (st->wall_ns > 0) {
+        fprintf(stderr, "spin: %.3f s spun, %.2f%% of a CPU; tick thread "
+            "%.2f%% of a CPU in total\n", (double)st->spin_ns / 1e9,
+            100.0 * st->spin_ns / st->wall_ns,
+            100.0 * st->cpu_ns / st->wall_ns);
+    }
+}
+
+static void
+print_writer_stats(const psg_writer_t *writer)
+{
+    psg_writer_stats_t st;
+
+    psg_writer_stats(writer, &st);
+    fprintf(stderr, "writer: %llu batches, %llu writes, %llu errors\n",
+        (unsigned long long)st.batches, (unsigned long long)st.writes,
+        (unsigned long long)st.errors);
+    if (st.batches > 0) {
+        fprintf(stderr, "writer: lag %.1f us avg, %.1f us max, "
+            "%llu late (> %llu us)\n",
+            (double)st.lag_sum_ns / st.batches / 1e3,
+            (double)st.lag_max_ns / 1e3, (unsigned long long)st.late,
+            (unsigned long long)(PSG_WRITER_LATE_NS / 1000));
+    }
+    fprintf(stderr, "writer: ring max %u of %u entries, full %llu times\n",
+        st.ring_max, st.ring_size, (unsigned long long)st.ring_full);
+}
+
 static void
 usage(void)
 {
     fprintf(stderr,
-        "Usage: %s [-t title] p6psgfile\n", getprogname());
+        "Usage: %s [-e] [-B backend] [-l loops] [-o tracefile]\n"
+        "       [-p position] [-t title] [-P pcmfile [-L latency_ms]]\n"
+        "       [-w [-c cpu]] [-C chip] [-HJkRu] [-S spin_us] [-T timelog]\n"
+        "       p6psgfile\n"
+        "backends: rpi-gpio (default), pcm (with -P), null\n"
+        "chips (rpi-gpio): ym2149 (default), ay8910\n",
+        getprogname());
 
     exit(EXIT_FAILURE);
 }
@@ -88,13 +467,108 @@ main(int argc, char **argv)
     PSGDriver psgdriver, *drv;
     UI_state uistate, *ui;
     int status = EXIT_SUCCESS;
+    PSGSeekIndex seekidx;
+    int seekidx_valid = 0;
+    double pos_sec = 0.0;
+    long loops = -1;
+    int tickless = 0;
+    int collapse = 0;
+    int ui_inline = 0;
+    uint32_t stop_tick = UINT32_MAX;
+    PSGAnalysis ana;
+    const struct backend_entry *be;
+    psg_writer_t writer_store, *writer = NULL;
+    int use_writer = 0;
+    long writer_cpu = -1;
+    int chip = PSG_RPI_GPIO_CHIP_YM2149;
+    play_hist_t hist_store;
+    int use_hist = 0;
+    int rt = 0;
+    unsigned long spin_us = 0;
+    spin_stats_t spin_st;
+    psg_jitter_t jitter_store, *jitter = NULL;
+    int use_jitter = 0;
+    const char *timelog = NULL;
+    const char *bename = NULL;
+    const char *pcmname = NULL;
+    const char *tracename = NULL;
+    unsigned long latency_ms = PSG_BACKEND_PCM_LATENCY_DEFAULT;
+    char *ep;
 
     int ch;
-    while ((ch = getopt(argc, argv, "t:")) != -1) {
+    while ((ch = getopt(argc, argv, "B:c:C:eHJkl:L:o:p:P:RS:t:T:uw")) != -1) {
         switch (ch) {
+        case 'B':
+            bename = optarg;
+            break;
+        case 'c':
+            writer_cpu = strtol(optarg, &ep, 10);
+            if (*optarg == '\0' || *ep != '\0' || writer_cpu < 0 ||
+                writer_cpu > 1023)
+                usage();
+            break;
+        case 'C':
+            for (chip = 0; chip < PSG_RPI_GPIO_CHIP_COUNT; chip++) {
+                if (strcmp(g_chips[chip].name, optarg) == 0)
+                    break;
+            }
+            if (chip == PSG_RPI_GPIO_CHIP_COUNT)
+                usage();
+            break;
+        case 'e':
+            tickless = 1;
+            break;
+        case 'H':
+            use_hist = 1;
+            break;
+        case 'J':
+            use_jitter = 1;
+            break;
+        case 'k':
+            collapse = 1;
+            break;
+        case 'l':
+            loops = strtol(optarg, &ep, 10);
+            if (*optarg == '\0' || *ep != '\0' || loops < 0)
+                usage();
+            break;
+        case 'L':
+            latency_ms = strtoul(optarg, &ep, 10);
+            if (*optarg == '\0' || *ep != '\0' || latency_ms > 10000)
+                usage();
+            break;
+        case 'o':
+            tracename = optarg;
+            break;
+        case 'P':
+            pcmname = optarg;
+            break;
+        case 'p':
+            pos_sec = strtod(optarg, &ep);
+            if (*optarg == '\0' || *ep != '\0' || pos_sec < 0.0)
+                usage();
+            break;
+        case 'R':
+            rt = 1;
+            break;
+        case 'S':
+            spin_us = strtoul(optarg, &ep, 10);
+            if (*optarg == '\0' || *ep != '\0' || spin_us == 0 ||
+                spin_us > SPIN_MAX_US)
+                usage();
+            break;
         case 't':
             title = optarg;
             break;
+        case 'T':
+            timelog = optarg;
+            break;
+        case 'u':
+            ui_inline = 1;
+            break;
+        case 'w':
+            use_writer = 1;
+            break;
         default:
             usage();
         }
@@ -106,11 +580,36 @@ main(int argc, char **argv)
         usage();
     ifname = argv[0];
 
+    /* -P implies the pcm backend, -o is for the null backend */
+    if (bename == NULL)
+        bename = (pcmname != NULL) ? "pcm" : "rpi-gpio";
+    for (be = g_backends; be->name != NULL; be++) {
+        if (strcmp(be->name, bename) == 0)
+            break;
+    }
+    if (be->name == NULL)
+        usage();
+    if ((be->bind == psg_backend_pcm_bind) != (pcmname != NULL))
+        usage();
+    if (tracename != NULL && be->bind != psg_backend_null_bind)
+        usage();
+    if (writer_cpu >= 0 && !use_writer)
+        usage();
+
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = on_signal;
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    if (pcmname != NULL) {
+        /* a gone reader shows up as a write error instead */
+        sa.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &sa, NULL);
+    }
+    if (use_hist) {
+        sa.sa_handler = on_report;
+        sigaction(SIGUSR1, &sa, NULL);
+    }
 
     p6psg = p6psg_create();
     if (p6psg == NULL) {
@@ -127,10 +626,17 @@ main(int argc, char **argv)
 
     /* ---- YM2149 backend bind/init/enable/reset ---- */
     psgio = &psgiostore;
+    psgio->writer = NULL;
+    psgio->t_write = 0;
+    psgio->hist = NULL;
+    if (use_hist) {
+        memset(&hist_store, 0, sizeof(hist_store));
+        psgio->hist = &hist_store;
+    }
 
     ops = &ops_store;
     memset(ops, 0, sizeof(*ops));
-    psg_backend_rpi_gpio_bind(ops);
+    (*be->bind)(ops);
     if (ops->id == NULL) {
         fprintf(stderr, "failed to bind backend\n");
         status = EXIT_FAILURE;
@@ -150,6 +656,34 @@ main(int argc, char **argv)
     psgio->psgbe = psgbe;
     backend_inited = 1;
 
+    if (pcmname != NULL && psg_backend_pcm_configure(psgbe, pcmname,
+        PSG_EMU_RATE_DEFAULT, PSG_EMU_QUALITY_FAST,
+        (uint32_t)latency_ms) == 0) {
+        fprintf(stderr, "failed to configure backend (%s): %s\n",
+            psgbe->ops->id, psg_backend_last_error(psgbe));
+        status = EXIT_FAILURE;
+        goto out;
+    }
+    if (be->bind == psg_backend_rpi_gpio_bind &&
+        (psg_backend_rpi_gpio_set_timing(psgbe, chip, 0) == 0 ||
+        psg_backend_rpi_gpio_set_hist(psgbe, use_hist) == 0)) {
+        fprintf(stderr, "failed to configure backend (%s): %s\n",
+            psgbe->ops->id, psg_backend_last_error(psgbe));
+        status = EXIT_FAILURE;
+        goto out;
+    }
+    psg_bus_cost_t cost = {
+        PSG_BUS_STORE_NS_DEFAULT, PSG_BUS_READ_NS_DEFAULT,
+        PSG_BUS_BARRIER_NS_DEFAULT, chip
+    };
+    if (be->bind == psg_backend_null_bind &&
+        psg_backend_null_configure(psgbe, &cost, tracename) == 0) {
+        fprintf(stderr, "failed to configure backend (%s): %s\n",
+            psgbe->ops->id, psg_backend_last_error(psgbe));
+        status = EXIT_FAILURE;
+        goto out;
+    }
+
     if ((*psgbe->ops->enable)(psgbe) == 0) {
         fprintf(stderr, "failed to enable backend (%s): %s\n",
             psgbe->ops->id, psg_backend_last_error(psgbe));
@@ -158,28 +692,119 @@ main(int argc, char **argv)
     }
     backend_enabled = 1;
 
+    if (rt) {
+        /* after enable: backend threads keep the default policy */
+        char err[128];
+        if (rt_setup(err, sizeof(err)) == 0) {
+            fprintf(stderr, "failed to enter real-time mode: %s\n", err);
+            status = EXIT_FAILURE;
+            goto out;
+        }
+    }
+
+    if (use_writer) {
+        /* from here on only the writer thread calls the backend */
+        if (psg_writer_start(&writer_store, psgbe, (int)writer_cpu) == 0) {
+            fprintf(stderr, "failed to start writer thread: %s\n",
+                writer_store.error);
+            status = EXIT_FAILURE;
+            goto out;
+        }
+        writer = &writer_store;
+        psgio->writer = writer;
+    }
+
+    if (pcmname != NULL && strcmp(pcmname, "-") == 0) {
+        /* the backend has its own copy of stdout; draw the UI on the tty */
+        int fd = open("/dev/tty", O_WRONLY);
+        if (fd < 0)
+            fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+    }
+
     ui = &uistate;
     int ui_active = 0;
     uint64_t now0 = nsec_now_monotonic();
-    ui_init(ui, now0);
+    if (title == NULL)
+        title = "OSC demo";
+    if (ui_inline) {
+        ui_init(ui, now0);
+    } else if (ui_init_thread(ui, now0, title) == 0) {
+        /* still usable, only drawn by the tick loop itself */
+        fprintf(stderr, "failed to start UI thread, drawing inline\n");
+    }
     psgio->ui = ui;
     ui_active = 1;
 
     drv = &psgdriver;
     psg_driver_init(drv, psg_write_reg_cb, ui_note_event_cb, psgio);
+    psg_driver_set_write_regs(drv, psg_write_regs_cb);
     psg_driver_set_channel_data(drv, P6PSG_CH_A, channels.ch[P6PSG_CH_A].ptr);
     psg_driver_set_channel_data(drv, P6PSG_CH_B, channels.ch[P6PSG_CH_B].ptr);
     psg_driver_set_channel_data(drv, P6PSG_CH_C, channels.ch[P6PSG_CH_C].ptr);
     psg_driver_start(drv);
 
+    /* song length and loop point for the UI and -l */
+    if (psg_analyze(drv, 100 * SEEK_MAX_TICKS, &ana) != 0) {
+        ui_set_song_length(ui, (uint64_t)ana.intro_ticks * TICK_NS,
+            (uint64_t)ana.loop_ticks * TICK_NS);
+        if (loops >= 0) {
+            /* -l 0 plays up to the loop point (or the end) only */
+            uint64_t t = ana.intro_ticks + (uint64_t)ana.loop_ticks * loops;
+            stop_tick = (t < UINT32_MAX) ? (uint32_t)t : UINT32_MAX;
+        }
+    } else if (loops >= 0) {
+        /* the end of the song still stops it (see the loop below) */
+        fprintf(stderr, "loop point not found, -l %ld only stops at the "
+            "end of the song\n", loops);
+    }
+
+    /* snapshot index for -p and '<' / '>' seeks */
+    if (psg_seek_build(&seekidx, drv, PSG_SEEK_INTERVAL_DEFAULT,
+        SEEK_MAX_TICKS) != 0) {
+        seekidx_valid = 1;
+        if (pos_sec > 0.0) {
+            uint32_t pos = psg_seek(&seekidx, drv,
+                (uint32_t)(pos_sec * (1000000000.0 / TICK_NS)));
+            ui_set_position(ui, nsec_now_monotonic(),
+                (uint64_t)pos * TICK_NS);
+        }
+    }
+
     /*
      * main player loop
      */
 
-    /* call PSG driver every 2ms */
-    const uint64_t tick_ns = 2000000ull;
+    /*
+     * call PSG driver every 2ms
+     *  With -w each tick runs lead ns before its deadline and the writer
+     *  thread puts its writes on the bus at the deadline, so the loop
+     *  below works in (now + lead) time.
+     *  With -R the loop sleeps to the deadline itself (absolute
+     *  CLOCK_MONOTONIC) and select(2) only polls stdin; -S does the
+     *  same but wakes spin ns early and spins up to the deadline.
+     */
+    const uint64_t tick_ns = TICK_NS;
+    const uint64_t lead = (writer != NULL) ? WRITER_LEAD_NS : 0;
+    const uint64_t spin = (uint64_t)spin_us * 1000u;
     uint64_t t0 = nsec_now_monotonic();
     uint64_t next_deadline = t0 + tick_ns;
+    uint64_t cpu0 = (spin != 0) ? nsec_thread_cpu() : 0;
+
+    memset(&spin_st, 0, sizeof(spin_st));
+    if (use_jitter || timelog != NULL) {
+        if (psg_jitter_open(&jitter_store, timelog, t0, tick_ns) == 0) {
+            fprintf(stderr, "failed to open timing log: %s\n",
+                jitter_store.error);
+            status = EXIT_FAILURE;
+            g_stop = 1;
+        } else {
+            jitter = &jitter_store;
+        }
+    }
 
     while (g_stop == 0) {
         fd_set rfds;
@@ -192,6 +817,32 @@ main(int argc, char **argv)
         struct timeval tv;
         tv.tv_sec  = 0;
         tv.tv_usec = 2000; /* 2ms */
+        uint64_t wake = next_deadline;
+        if (tickless) {
+            /*
+             * Sleep until the next tick that does something (or the next
+             * UI frame, whichever comes first); the idle ticks in between
+             * are skipped by psg_driver_advance() below.
+             */
+            uint32_t idle = psg_driver_ticks_to_event(drv);
+            wake = ui_next_render_ns(ui) + lead;
+            if (wake > next_deadline &&
+                idle < (wake - next_deadline) / tick_ns)
+                wake = next_deadline + (uint64_t)idle * tick_ns;
+            uint64_t now = nsec_now_monotonic() + lead;
+            uint64_t sleep_us = (wake > now) ? (wake - now) / 1000 : 0;
+            tv.tv_sec  = (time_t)(sleep_us / 1000000);
+            tv.tv_usec = (suseconds_t)(sleep_us % 1000000);
+        }
+        if (rt || spin != 0) {
+            /* keys wait for the tick; the tick never waits for keys */
+            if (spin != 0)
+                spin_until_ns(wake - lead, spin, &spin_st);
+            else
+                sleep_until_ns(wake - lead);
+            tv.tv_sec  = 0;
+            tv.tv_usec = 0;
+        }
         int n = select(STDIN_FILENO + 1, &rfds, NULL, NULL, &tv);
 
         if (n > 0 && FD_ISSET(STDIN_FILENO, &rfds)) {
@@ -203,6 +854,19 @@ main(int argc, char **argv)
                         g_redraw = 1;  /* Ctrl+L */
                     if (buf[i] == 'q' || buf[i] == 'Q')
                         g_stop = 1;    /* quit */
+                    if ((buf[i] == '<' || buf[i] == '>') && seekidx_valid) {
+                        /* seek -/+ 10 seconds */
+                        uint32_t pos = drv->tick_count;
+                        if (buf[i] == '>')
+                            pos += SEEK_STEP_TICKS;
+                        else if (pos > SEEK_STEP_TICKS)
+                            pos -= SEEK_STEP_TICKS;
+                        else
+                            pos = 0;
+                        pos = psg_seek(&seekidx, drv, pos);
+                        ui_set_position(ui, nsec_now_monotonic(),
+                            (uint64_t)pos * tick_ns);
+                    }
                 }
             }
         }
@@ -210,10 +874,14 @@ main(int argc, char **argv)
          * Determine how many ticks are due. This keeps timing stable even if
          * select() returns late.
          */
-        uint64_t now = nsec_now_monotonic();
+        uint64_t now = nsec_now_monotonic() + lead;
 
         if (now < next_deadline) {
             /* Early wake; just continue (rare on coarse tick systems). */
+            if (tickless) {
+                /* woke up for a UI frame, not for a tick */
+                ui_maybe_render(ui, now - lead, title);
+            }
             continue;
         }
 
@@ -222,31 +890,107 @@ main(int argc, char **argv)
         uint32_t due = (uint32_t)(behind / tick_ns) + 1;
 
         /* Optional safety cap to avoid spiral if the system is overloaded */
-        if (due > 50)
-            due = 50;
-
-        for (uint32_t i = 0; i < due; i++) {
-            psg_driver_tick(drv);
-            next_deadline += tick_ns;
+        uint32_t cap = 50;
+        if (tickless) {
+            /* idle ticks cost nothing, only cap the ones that do work */
+            uint32_t idle = psg_driver_ticks_to_event(drv);
+            cap += (idle < UINT32_MAX - cap) ? idle : UINT32_MAX - cap;
         }
-
-        /* draw AFTER catch-up loop (important) */
+        int capped = (due > cap);
+        if (capped)
+            due = cap;
+
+        uint64_t t_run = (jitter != NULL) ? nsec_now_monotonic() : 0;
+        play_run_t run = { psgio, jitter, next_deadline, tick_ns, lead, 0, 0 };
+        if (tickless && !collapse) {
+            /* idle ticks are skipped, the ones that run are stamped */
+            psg_driver_advance_cb(drv, due, play_tick_cb, &run);
+        } else if (collapse && (tickless || due > 1)) {
+            /*
+             * behind: only the final register state goes out, with the
+             * last due tick; tickless skips the idle ticks before the
+             * first one that does anything
+             */
+            uint32_t skip = tickless ? psg_driver_ticks_to_event(drv) : 0;
+            if (skip >= due) {
+                psg_driver_advance(drv, due);
+            } else {
+                if (skip > 0)
+                    psg_driver_skip_ticks(drv, skip);
+                play_tick_cb(&run, due - 1);
+                psg_driver_catch_up(drv, due - skip);
+                run.first = next_deadline + (uint64_t)skip * tick_ns;
+                run.ran = due - skip;
+            }
+        } else {
+            for (uint32_t i = 0; i < due; i++) {
+                play_tick_cb(&run, i);
+                psg_driver_tick(drv);
+            }
+        }
+        next_deadline += (uint64_t)due * tick_ns;
+        if (drv->tick_count >= stop_tick)
+            g_stop = 1;
+        if (loops >= 0 && !psg_driver_is_active(drv))
+            g_stop = 1;
+
+        /* draw (or hand to the UI thread) AFTER catch-up loop (important) */
+        uint64_t t_ui = (jitter != NULL) ? nsec_now_monotonic() : 0;
         if (g_redraw) {
-            ui_request_redraw(ui);;
+            ui_request_redraw(ui);
             g_redraw = 0;
         }
-        ui_maybe_render(ui, now, title != NULL ? title : "OSC demo");
+        ui_maybe_render(ui, now - lead, title);
+        if (jitter != NULL && run.ran > 0) {
+            psg_jitter_wake(jitter, run.first, now, run.ran, capped,
+                t_ui - t_run, nsec_now_monotonic() - t_ui);
+        }
+
+        if (g_report) {
+            print_hists(psgio->hist, psgbe,
+                be->bind == psg_backend_rpi_gpio_bind && writer == NULL);
+            g_report = 0;
+        }
     }
 
+    if (jitter != NULL) {
+        if (psg_jitter_close(jitter) == 0)
+            fprintf(stderr, "timing log: %s\n", jitter->error);
+        psg_jitter_print(stderr, jitter);
+    }
+    if (spin != 0) {
+        spin_st.wall_ns = nsec_now_monotonic() - t0;
+        spin_st.cpu_ns = nsec_thread_cpu() - cpu0;
+        print_spin_stats(&spin_st, spin);
+    }
+
+    /* the final mute goes out right away */
+    psgio->t_write = 0;
     psg_driver_stop(drv);
 
+    if (seekidx_valid)
+        psg_seek_free(&seekidx);
+
     if (ui_active)
         ui_shutdown(ui);
 
  out:
+    if (writer != NULL) {
+        psg_writer_stop(writer);
+        print_writer_stats(writer);
+        writer = NULL;
+    }
+    if (use_hist && backend_enabled)
+        print_hists(&hist_store, psgbe, be->bind == psg_backend_rpi_gpio_bind);
     if (backend_enabled) {
         (*psgbe->ops->disable)(psgbe);
         backend_enabled = 0;
+        if (be->bind == psg_backend_pcm_bind)
+            print_pcm_stats(psgbe);
+        if (be->bind == psg_backend_null_bind)
+            print_null_stats(psgbe);
+        if (be->bind == psg_backend_rpi_gpio_bind)
+            print_rpi_gpio_timing(psgbe);
     }
 
     if (backend_inited) {
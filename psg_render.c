@@ -0,0 +1,875 @@
+/*
+ * psg_render.c
+ *  Headless (faster than realtime) renderer for p6psg data
+ *
+ *  Runs psg_driver_tick() back to back without any 2ms pacing and
+ *  optionally writes a timestamped register write log.
+ *  No PSG backend or UI is involved, so this runs on any host.
+ *
+ *  PCM output can be rendered on several threads (-j): a headless pass
+ *  runs the driver and only the counters of the emulated chip, saving
+ *  both at segment boundaries, then the segments are rendered
+ *  concurrently from those snapshots and written out in order.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "psg_compat.h"
+#include "p6psg.h"
+#include "psg_analyze.h"
+#include "psg_backend.h"
+#include "psg_backend_emu.h"
+#include "psg_driver.h"
+#include "psg_emu.h"
+#include "psg_seek.h"
+#include "psg_wav.h"
+
+/* driver tick period (see psg_play.c) */
+#define TICK_NS         2000000ull
+
+/* default render length: 5 minutes */
+#define DEFAULT_TICKS   (5u * 60u * 500u)
+
+/* PCM render chunk (samples) */
+#define PCM_CHUNK       4096
+
+/* parallel PCM segment length: 10 seconds */
+#define SEG_TICKS       5000u
+
+#define MAX_WORKERS     256
+
+typedef struct render {
+    FILE *log;                  /* register write log (NULL: no log) */
+    const PSGDriver *drv;
+    uint64_t nwrites;
+
+    /* PCM output through the emulation backend (-w) */
+    psg_backend_t *psgbe;
+    psg_wav_t wav;
+    uint64_t samples;           /* samples rendered so far */
+
+    /* chip state for parallel PCM output (-j) */
+    PSGEmu *scan;
+} render_t;
+
+/*
+ * One segment of parallel PCM output.  Rendering starts a few ticks
+ * before the segment (pre-roll) so that band-limited steps of the
+ * samples just before it are complete; those samples are dropped.
+ */
+typedef struct render_seg {
+    PSGEmu emu;                 /* chip state at tick0 */
+    PSGDriver drv;              /* driver state at tick0 */
+    uint32_t tick0;             /* render from */
+    uint32_t tick1;             /* output from */
+    uint32_t tick2;             /* output up to (unless the song ends) */
+    uint32_t tick_end;          /* where rendering stopped */
+    float *raw;                 /* raw samples from tick0 */
+    int done;
+} render_seg_t;
+
+typedef struct render_par {
+    render_seg_t *seg;
+    unsigned int maxseg;
+    unsigned int nseg;          /* segments handed out by the scan */
+    unsigned int next;          /* next segment to render */
+    unsigned int written;       /* segments written out */
+    unsigned int window;        /* segments allowed ahead of the writer */
+    int scanning;
+    uint32_t rate;
+    int tickless;
+    PSGEmu fin;                 /* output filter state */
+    pthread_mutex_t lock;
+    pthread_cond_t cond_done;   /* a segment was rendered */
+    pthread_cond_t cond_work;   /* a segment was scanned or written */
+} render_par_t;
+
+/* --- timing helpers --- */
+static inline uint64_t
+nsec_now_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void
+render_write_reg_cb(void *opaque, uint8_t reg, uint8_t val)
+{
+    render_t *r = opaque;
+
+    r->nwrites++;
+    if (r->scan != NULL)
+        psg_emu_write(r->scan, reg, val);
+    if (r->psgbe != NULL)
+        (void)(*r->psgbe->ops->write_reg)(r->psgbe, reg, val);
+    if (r->log != NULL) {
+        /* tick, song time (ms), register, value */
+        uint32_t tick = r->drv->tick_count;
+        fprintf(r->log, "%u %u %u %02x\n",
+            tick, (unsigned int)(tick * (TICK_NS / 1000000ull)), reg, val);
+    }
+}
+
+static void
+render_emu_write_reg_cb(void *opaque, uint8_t reg, uint8_t val)
+{
+    psg_emu_write(opaque, reg, val);
+}
+
+/* sample position of the start of a tick */
+static inline uint64_t
+tick_to_sample(uint32_t tick, uint32_t rate)
+{
+    return (uint64_t)tick * rate / (1000000000ull / TICK_NS);
+}
+
+/* render PCM up to the start of the given tick */
+static int
+render_pcm(render_t *r, uint32_t tick)
+{
+    int16_t buf[PCM_CHUNK];
+    uint64_t target = tick_to_sample(tick, r->wav.rate);
+
+    while (r->samples < target) {
+        size_t n = (target - r->samples > PCM_CHUNK) ?
+            PCM_CHUNK : (size_t)(target - r->samples);
+        if (psg_backend_emu_render(r->psgbe, buf, n) == 0 ||
+            psg_wav_write(&r->wav, buf, n) == 0)
+            return 0;
+        r->samples += n;
+    }
+    return 1;
+}
+
+/* render one segment from its snapshot into s->raw */
+static void
+render_segment(const render_par_t *p, render_seg_t *s)
+{
+    PSGEmu emu = s->emu;
+    PSGDriver drv = s->drv;
+    uint64_t s0 = tick_to_sample(s->tick0, p->rate);
+    uint64_t cur = s0;
+
+    s->raw = calloc(tick_to_sample(s->tick2, p->rate) - s0 + PSG_EMU_RAW_PAD,
+        sizeof(float));
+    if (s->raw == NULL)
+        return;
+
+    drv.write_reg = render_emu_write_reg_cb;
+    drv.write_regs = NULL;
+    drv.note_event = NULL;
+    drv.opaque = &emu;
+    /* same end condition as the serial loop */
+    while (drv.tick_count < s->tick2 && psg_driver_is_active(&drv)) {
+        uint32_t idle = p->tickless ? psg_driver_ticks_to_event(&drv) : 0;
+        if (idle > s->tick2 - drv.tick_count)
+            idle = s->tick2 - drv.tick_count;
+        if (idle > 0)
+            psg_driver_skip_ticks(&drv, idle);
+        else
+            psg_driver_tick(&drv);
+        uint64_t target = tick_to_sample(drv.tick_count, p->rate);
+        psg_emu_render_raw(&emu, s->raw + (cur - s0), (size_t)(target - cur));
+        cur = target;
+    }
+    s->tick_end = drv.tick_count;
+}
+
+static void *
+render_worker(void *arg)
+{
+    render_par_t *p = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        while ((p->next >= p->nseg && p->scanning) ||
+            (p->next < p->nseg && p->next >= p->written + p->window))
+            pthread_cond_wait(&p->cond_work, &p->lock);
+        if (p->next >= p->nseg) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        render_seg_t *s = &p->seg[p->next++];
+        pthread_mutex_unlock(&p->lock);
+
+        render_segment(p, s);
+
+        pthread_mutex_lock(&p->lock);
+        s->done = 1;
+        pthread_cond_signal(&p->cond_done);
+        pthread_mutex_unlock(&p->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Run the output filter over rendered segments in order and write
+ * them.  Waits for the next segment if block is set, otherwise stops
+ * at the first one that is not rendered yet.  Returns 0 on error.
+ */
+static int
+render_drain(render_t *r, render_par_t *p, int block)
+{
+    int16_t buf[PCM_CHUNK];
+
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        if (p->written >= p->nseg) {
+            pthread_mutex_unlock(&p->lock);
+            return 1;
+        }
+        render_seg_t *s = &p->seg[p->written];
+        while (block && !s->done)
+            pthread_cond_wait(&p->cond_done, &p->lock);
+        int done = s->done;
+        pthread_mutex_unlock(&p->lock);
+        if (!done)
+            return 1;
+
+        if (s->raw == NULL) {
+            fprintf(stderr, "segment %u: out of memory\n", p->written);
+            return 0;
+        }
+        uint64_t s0 = tick_to_sample(s->tick0, p->rate);
+        uint64_t s1 = tick_to_sample(s->tick1, p->rate);
+        uint64_t s2 = tick_to_sample(s->tick_end, p->rate);
+        const float *raw = s->raw + (s1 - s0);
+
+        /* the song may end in the pre-roll */
+        for (uint64_t left = (s2 > s1) ? s2 - s1 : 0; left > 0; ) {
+            size_t n = (left > PCM_CHUNK) ? PCM_CHUNK : (size_t)left;
+            psg_emu_render_finish(&p->fin, buf, raw, n);
+            if (psg_wav_write(&r->wav, buf, n) == 0) {
+                fprintf(stderr, "write error\n");
+                return 0;
+            }
+            raw += n;
+            left -= n;
+            r->samples += n;
+        }
+        free(s->raw);
+        s->raw = NULL;
+
+        pthread_mutex_lock(&p->lock);
+        p->written++;
+        pthread_cond_broadcast(&p->cond_work);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+/* run the driver up to tick (or the song end), advancing r->scan */
+static void
+render_scan_to(render_t *r, const render_par_t *p, PSGDriver *drv,
+    uint32_t tick)
+{
+    uint64_t samples = tick_to_sample(drv->tick_count, p->rate);
+
+    while (drv->tick_count < tick && psg_driver_is_active(drv)) {
+        uint32_t idle = p->tickless ? psg_driver_ticks_to_event(drv) : 0;
+        if (idle > tick - drv->tick_count)
+            idle = tick - drv->tick_count;
+        if (idle > 0)
+            psg_driver_skip_ticks(drv, idle);
+        else
+            psg_driver_tick(drv);
+        uint64_t target = tick_to_sample(drv->tick_count, p->rate);
+        psg_emu_skip(r->scan, (size_t)(target - samples));
+        samples = target;
+    }
+}
+
+/*
+ * Headless pass: run the driver up to max_ticks (or the song end) with
+ * register writes going to r->scan, which is only advanced, not
+ * rendered.  Both states are saved at the start of each segment's
+ * pre-roll and handed to the workers right away; segments they have
+ * finished meanwhile are written out.  Returns 0 on error.
+ */
+static int
+render_scan(render_t *r, render_par_t *p, PSGDriver *drv, uint32_t max_ticks,
+    uint32_t preroll)
+{
+    const uint32_t t0 = drv->tick_count;
+
+    for (unsigned int k = 0; k < p->maxseg; k++) {
+        uint32_t tick1 = t0 + k * SEG_TICKS;
+        uint32_t tick0 = (k > 0) ? tick1 - preroll : t0;
+
+        render_scan_to(r, p, drv, tick0);
+        if (drv->tick_count < tick0)
+            break;
+
+        render_seg_t *s = &p->seg[k];
+        s->emu = *r->scan;
+        s->drv = *drv;
+        s->tick0 = tick0;
+        s->tick1 = tick1;
+        s->tick2 = (max_ticks - tick1 > SEG_TICKS) ?
+            tick1 + SEG_TICKS : max_ticks;
+        s->tick_end = tick1;
+        s->raw = NULL;
+        s->done = 0;
+
+        pthread_mutex_lock(&p->lock);
+        p->nseg++;
+        pthread_cond_broadcast(&p->cond_work);
+        pthread_mutex_unlock(&p->lock);
+
+        if (render_drain(r, p, 0) == 0)
+            return 0;
+    }
+
+    /* the rest of the last segment, for the log and write count */
+    render_scan_to(r, p, drv, max_ticks);
+    return 1;
+}
+
+/*
+ * Parallel PCM output: render segments on njobs threads while this
+ * thread scans ahead and then runs the output filter over them in
+ * order.  The output is identical to the serial path.
+ */
+static int
+render_parallel(render_t *r, PSGDriver *drv, uint32_t max_ticks,
+    int tickless, unsigned int njobs)
+{
+    render_par_t par, *p = &par;
+    pthread_t thread[MAX_WORKERS];
+    unsigned int nthreads = 0;
+    int ok = 1;
+
+    memset(p, 0, sizeof(*p));
+    p->rate = r->wav.rate;
+    p->tickless = tickless;
+    p->window = 2 * njobs;
+
+    /* pre-roll covers the band-limited step spill of one sample */
+    uint32_t preroll = (uint32_t)(((uint64_t)PSG_EMU_RAW_PAD *
+        (1000000000ull / TICK_NS) + p->rate - 1) / p->rate);
+    if (preroll >= SEG_TICKS) {
+        fprintf(stderr, "rate %u Hz is too low for -j\n", p->rate);
+        return 0;
+    }
+
+    uint32_t t0 = drv->tick_count;
+    if (max_ticks <= t0)
+        return 1;
+    p->maxseg = (max_ticks - t0 + SEG_TICKS - 1) / SEG_TICKS;
+    /* PSGEmu holds 16-byte vectors */
+    if (posix_memalign((void **)&p->seg, 16,
+        p->maxseg * sizeof(*p->seg)) != 0) {
+        fprintf(stderr, "segments: out of memory\n");
+        return 0;
+    }
+
+    /* output filter state continues from the serial part (seek) */
+    p->fin = *r->scan;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond_done, NULL);
+    pthread_cond_init(&p->cond_work, NULL);
+    p->scanning = 1;
+    for (unsigned int i = 0; i < njobs; i++) {
+        int error = pthread_create(&thread[i], NULL, render_worker, p);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            break;
+        }
+        nthreads++;
+    }
+
+    if (nthreads == 0 || render_scan(r, p, drv, max_ticks, preroll) == 0)
+        ok = 0;
+
+    pthread_mutex_lock(&p->lock);
+    p->scanning = 0;
+    if (!ok) {
+        /* let the workers run out of segments */
+        p->next = p->nseg;
+    }
+    pthread_cond_broadcast(&p->cond_work);
+    pthread_mutex_unlock(&p->lock);
+
+    if (ok && render_drain(r, p, 1) == 0) {
+        ok = 0;
+        pthread_mutex_lock(&p->lock);
+        p->next = p->nseg;
+        pthread_cond_broadcast(&p->cond_work);
+        pthread_mutex_unlock(&p->lock);
+    }
+    for (unsigned int i = 0; i < nthreads; i++)
+        pthread_join(thread[i], NULL);
+    for (unsigned int i = 0; i < p->nseg; i++)
+        free(p->seg[i].raw);
+
+    fprintf(stderr, "%u segments of %u ticks on %u threads\n",
+        p->nseg, SEG_TICKS, nthreads);
+
+    pthread_cond_destroy(&p->cond_work);
+    pthread_cond_destroy(&p->cond_done);
+    pthread_mutex_destroy(&p->lock);
+    free(p->seg);
+    return ok;
+}
+
+static void
+render_setup(render_t *r, PSGDriver *drv,
+    const p6psg_channel_dataset_t *channels)
+{
+    r->drv = drv;
+    psg_driver_init(drv, render_write_reg_cb, NULL, r);
+    for (int i = 0; i < P6PSG_CH_COUNT; i++)
+        psg_driver_set_channel_data(drv, i, channels->ch[i].ptr);
+    psg_driver_start(drv);
+}
+
+/*
+ * Microbenchmark of the interpreter: ns/tick over max_ticks.  Songs
+ * that end before max_ticks are restarted so that every tick does work.
+ */
+static void
+render_bench(render_t *r, const p6psg_channel_dataset_t *channels,
+    uint32_t max_ticks)
+{
+    PSGDriver drv;
+
+    r->nwrites = 0;
+    uint64_t t0 = nsec_now_monotonic();
+    render_setup(r, &drv, channels);
+    for (uint32_t i = 0; i < max_ticks; i++) {
+        if (!psg_driver_is_active(&drv))
+            render_setup(r, &drv, channels);
+        psg_driver_tick(&drv);
+    }
+    uint64_t t1 = nsec_now_monotonic();
+    fprintf(stderr, "driver  : %u ticks, %llu writes, %.2f ns/tick\n",
+        max_ticks, (unsigned long long)r->nwrites,
+        (double)(t1 - t0) / max_ticks);
+}
+
+static const char *quality_name[PSG_EMU_QUALITY_COUNT] = {
+    [PSG_EMU_QUALITY_FAST] = "fast",
+    [PSG_EMU_QUALITY_GOOD] = "good",
+    [PSG_EMU_QUALITY_BEST] = "best",
+};
+
+static int
+quality_by_name(const char *name)
+{
+    for (int q = 0; q < PSG_EMU_QUALITY_COUNT; q++) {
+        if (strcmp(name, quality_name[q]) == 0)
+            return q;
+    }
+    return -1;
+}
+
+/*
+ * Emulator output filter benchmark: samples/s of each quality tier,
+ * with the register writes of the first max_ticks of the song.
+ */
+static int
+render_bench_emu(const p6psg_channel_dataset_t *channels, uint32_t max_ticks,
+    uint32_t rate)
+{
+    PSGEmu *emu;
+    PSGDriver drv;
+    int16_t buf[PCM_CHUNK];
+
+    if (posix_memalign((void **)&emu, 16, sizeof(*emu)) != 0) {
+        fprintf(stderr, "emu: out of memory\n");
+        return 0;
+    }
+    for (int q = 0; q < PSG_EMU_QUALITY_COUNT; q++) {
+        uint64_t samples = 0, ns = 0;
+
+        psg_emu_init(emu, PSG_EMU_CLOCK_DEFAULT, rate);
+        if (psg_emu_set_quality(emu, q) == 0) {
+            fprintf(stderr, "emu: cannot set quality %s\n", quality_name[q]);
+            free(emu);
+            return 0;
+        }
+        psg_driver_init(&drv, render_emu_write_reg_cb, NULL, emu);
+        for (int i = 0; i < P6PSG_CH_COUNT; i++)
+            psg_driver_set_channel_data(&drv, i, channels->ch[i].ptr);
+        psg_driver_start(&drv);
+
+        /* time only the PCM generation */
+        for (uint32_t t = 0; t < max_ticks; t++) {
+            if (!psg_driver_is_active(&drv))
+                break;
+            psg_driver_tick(&drv);
+            uint64_t target = (uint64_t)drv.tick_count * rate /
+                (1000000000ull / TICK_NS);
+            size_t n = (size_t)(target - samples);
+            if (n > PCM_CHUNK)
+                n = PCM_CHUNK;
+            uint64_t t0 = nsec_now_monotonic();
+            psg_emu_render(emu, buf, n);
+            ns += nsec_now_monotonic() - t0;
+            samples += n;
+        }
+        double sps = (ns > 0) ? samples * 1e9 / ns : 0.0;
+        fprintf(stderr, "emu %-4s: %llu samples, %.0f samples/s "
+            "(x%.0f realtime)\n", quality_name[q],
+            (unsigned long long)samples, sps, sps / rate);
+    }
+    free(emu);
+    return 1;
+}
+
+static void
+print_ticks(const char *label, uint32_t ticks)
+{
+    if (ticks == PSG_ANALYZE_NONE) {
+        fprintf(stderr, "%s: -\n", label);
+        return;
+    }
+    fprintf(stderr, "%s: %u ticks (%.3f s)\n",
+        label, ticks, (double)ticks * TICK_NS / 1e9);
+}
+
+/* song length / loop point report */
+static void
+render_analyze(const PSGDriver *drv, uint32_t max_ticks)
+{
+    PSGAnalysis a;
+    char label[32];
+
+    uint64_t t0 = nsec_now_monotonic();
+    int complete = psg_analyze(drv, max_ticks, &a);
+    uint64_t t1 = nsec_now_monotonic();
+
+    if (!complete)
+        fprintf(stderr, "song loop not found within %u ticks\n", max_ticks);
+    print_ticks("intro", a.intro_ticks);
+    print_ticks("loop ", a.loop_ticks);
+    for (int i = 0; i < 3; i++) {
+        snprintf(label, sizeof(label), "ch %c J", 'A' + i);
+        print_ticks(label, a.ch[i].j_tick);
+        if (a.ch[i].j_tick != PSG_ANALYZE_NONE) {
+            snprintf(label, sizeof(label), "ch %c loop", 'A' + i);
+            print_ticks(label, a.ch[i].loop_ticks);
+        } else {
+            snprintf(label, sizeof(label), "ch %c end", 'A' + i);
+            print_ticks(label, a.ch[i].end_tick);
+        }
+    }
+    fprintf(stderr, "analyzed in %.3f ms\n", (double)(t1 - t0) / 1e6);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "Usage: %s [-abe] [-j jobs] [-n ticks | -s seconds] [-o logfile]\n"
+        "       [-p position] [-q fast|good|best] [-r rate] [-w wavfile]\n"
+        "       p6psgfile\n",
+        getprogname());
+
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *ifname;
+    const char *logname = NULL;
+    const char *wavname = NULL;
+    uint32_t rate = PSG_EMU_RATE_DEFAULT;
+    int quality = PSG_EMU_QUALITY_FAST;
+    psg_backend_ops_t emu_ops;
+    psg_backend_t psgbe_store;
+    int backend_inited = 0;
+    int backend_enabled = 0;
+    uint32_t max_ticks = DEFAULT_TICKS;
+    p6psg_t *p6psg = NULL;
+    p6psg_channel_dataset_t channels;
+    render_t renderstore, *r;
+    PSGDriver psgdriver, *drv;
+    int status = EXIT_SUCCESS;
+    int analyze = 0;
+    int bench = 0;
+    int tickless = 0;
+    long njobs = 0;
+    double pos_sec = -1.0;
+    char *ep;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "abej:n:o:p:q:r:s:w:")) != -1) {
+        switch (ch) {
+        case 'a':
+            analyze = 1;
+            break;
+        case 'b':
+            bench = 1;
+            break;
+        case 'e':
+            tickless = 1;
+            break;
+        case 'j':
+            njobs = strtol(optarg, &ep, 10);
+            if (*optarg == '\0' || *ep != '\0' || njobs < 1)
+                usage();
+            if (njobs > MAX_WORKERS)
+                njobs = MAX_WORKERS;
+            break;
+        case 'n':
+            max_ticks = (uint32_t)strtoul(optarg, &ep, 0);
+            if (*optarg == '\0' || *ep != '\0')
+                usage();
+            break;
+        case 'o':
+            logname = optarg;
+            break;
+        case 'p':
+            pos_sec = strtod(optarg, &ep);
+            if (*optarg == '\0' || *ep != '\0' || pos_sec < 0.0)
+                usage();
+            break;
+        case 'q':
+            quality = quality_by_name(optarg);
+            if (quality < 0)
+                usage();
+            break;
+        case 'r':
+            rate = (uint32_t)strtoul(optarg, &ep, 0);
+            if (*optarg == '\0' || *ep != '\0' || rate == 0)
+                usage();
+            break;
+        case 'w':
+            wavname = optarg;
+            break;
+        case 's':
+            max_ticks = (uint32_t)(strtod(optarg, &ep) *
+                (1000000000.0 / TICK_NS));
+            if (*optarg == '\0' || *ep != '\0')
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1)
+        usage();
+    ifname = argv[0];
+    if (njobs != 0 && wavname == NULL) {
+        fprintf(stderr, "-j needs -w\n");
+        usage();
+    }
+
+    r = &renderstore;
+    memset(r, 0, sizeof(*r));
+
+    p6psg = p6psg_create();
+    if (p6psg == NULL) {
+        fprintf(stderr, "p6psg: out of memory\n");
+        status = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (p6psg_load(p6psg, ifname, &channels) == 0) {
+        fprintf(stderr, "%s: %s\n", ifname, p6psg_last_error(p6psg));
+        status = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (bench) {
+        render_bench(r, &channels, max_ticks);
+        if (render_bench_emu(&channels, max_ticks, rate) == 0)
+            status = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (logname != NULL) {
+        if (strcmp(logname, "-") == 0) {
+            r->log = stdout;
+        } else {
+            r->log = fopen(logname, "w");
+            if (r->log == NULL) {
+                perror(logname);
+                status = EXIT_FAILURE;
+                goto out;
+            }
+        }
+        /* log lines are tiny; use a large buffer to keep stdio cheap */
+        setvbuf(r->log, NULL, _IOFBF, 1024 * 1024);
+        fprintf(r->log, "# tick msec reg val\n");
+    }
+
+    if (wavname != NULL) {
+        if (logname != NULL && strcmp(logname, "-") == 0 &&
+            strcmp(wavname, "-") == 0) {
+            fprintf(stderr, "-o - and -w - cannot both use stdout\n");
+            status = EXIT_FAILURE;
+            goto out;
+        }
+        if (njobs != 0) {
+            /* parallel: no backend, the scan pass gets the writes */
+            if (posix_memalign((void **)&r->scan, 16, sizeof(*r->scan)) != 0) {
+                fprintf(stderr, "emu: out of memory\n");
+                status = EXIT_FAILURE;
+                goto out;
+            }
+            psg_emu_init(r->scan, PSG_EMU_CLOCK_DEFAULT, rate);
+            if (rate > PSG_EMU_CLOCK_DEFAULT / 8 ||
+                psg_emu_set_quality(r->scan, quality) == 0) {
+                fprintf(stderr, "emu: cannot set rate %u Hz / quality %s\n",
+                    rate, quality_name[quality]);
+                status = EXIT_FAILURE;
+                goto out;
+            }
+        } else {
+            psg_backend_emu_bind(&emu_ops);
+            r->psgbe = &psgbe_store;
+            memset(r->psgbe, 0, sizeof(*r->psgbe));
+            r->psgbe->ops = &emu_ops;
+            if ((*emu_ops.init)(r->psgbe) == 0) {
+                fprintf(stderr, "failed to init backend (%s): %s\n",
+                    emu_ops.id, psg_backend_last_error(r->psgbe));
+                status = EXIT_FAILURE;
+                goto out;
+            }
+            backend_inited = 1;
+            if (psg_backend_emu_configure(r->psgbe, PSG_EMU_CLOCK_DEFAULT,
+                rate, quality) == 0 || (*emu_ops.enable)(r->psgbe) == 0) {
+                fprintf(stderr, "failed to enable backend (%s): %s\n",
+                    emu_ops.id, psg_backend_last_error(r->psgbe));
+                status = EXIT_FAILURE;
+                goto out;
+            }
+            backend_enabled = 1;
+        }
+        if (psg_wav_open(&r->wav, wavname, rate, 1) == 0) {
+            perror(wavname);
+            status = EXIT_FAILURE;
+            goto out;
+        }
+    }
+
+    drv = &psgdriver;
+    render_setup(r, drv, &channels);
+
+    if (analyze) {
+        /* analysis may run far past -n to find the loop */
+        render_analyze(drv, max_ticks > 100 * DEFAULT_TICKS ?
+            max_ticks : 100 * DEFAULT_TICKS);
+        goto out;
+    }
+
+    if (pos_sec >= 0.0) {
+        /* build a seek index over the whole render range, then seek */
+        PSGSeekIndex idx;
+        uint32_t pos = (uint32_t)(pos_sec * (1000000000.0 / TICK_NS));
+
+        uint64_t tb = nsec_now_monotonic();
+        if (psg_seek_build(&idx, drv, PSG_SEEK_INTERVAL_DEFAULT,
+            max_ticks) == 0) {
+            fprintf(stderr, "seek index: out of memory\n");
+            status = EXIT_FAILURE;
+            goto out;
+        }
+        uint64_t ts = nsec_now_monotonic();
+        pos = psg_seek(&idx, drv, pos);
+        uint64_t te = nsec_now_monotonic();
+
+        fprintf(stderr, "seek index: %u snapshots (%zu bytes), "
+            "built in %.3f ms; seek to tick %u in %.1f us\n",
+            idx.count, idx.count * sizeof(PSGDriver),
+            (double)(ts - tb) / 1e6, pos, (double)(te - ts) / 1e3);
+        psg_seek_free(&idx);
+    }
+    /* PCM starts at the render start position */
+    r->samples = (uint64_t)drv->tick_count * rate / (1000000000ull / TICK_NS);
+
+    /*
+     * main render loop: no pacing, just run ticks until the limit or
+     * until all channels have reached their end mark
+     */
+    uint64_t t0 = nsec_now_monotonic();
+    if (r->scan != NULL) {
+        if (render_parallel(r, drv, max_ticks, tickless,
+            (unsigned int)njobs) == 0)
+            status = EXIT_FAILURE;
+    } else if (r->psgbe != NULL) {
+        /* PCM: render the samples of each tick after its writes */
+        while (drv->tick_count < max_ticks && psg_driver_is_active(drv)) {
+            uint32_t idle = tickless ? psg_driver_ticks_to_event(drv) : 0;
+            if (idle > max_ticks - drv->tick_count)
+                idle = max_ticks - drv->tick_count;
+            if (idle > 0)
+                psg_driver_skip_ticks(drv, idle);
+            else
+                psg_driver_tick(drv);
+            if (render_pcm(r, drv->tick_count) == 0) {
+                fprintf(stderr, "%s: write error\n", wavname);
+                status = EXIT_FAILURE;
+                break;
+            }
+        }
+    } else if (tickless) {
+        /* skip ticks in which nothing happens; same output */
+        if (drv->tick_count < max_ticks)
+            psg_driver_advance(drv, max_ticks - drv->tick_count);
+    } else {
+        while (drv->tick_count < max_ticks && psg_driver_is_active(drv)) {
+            psg_driver_tick(drv);
+        }
+    }
+    uint64_t t1 = nsec_now_monotonic();
+
+    psg_driver_stop(drv);
+
+    if ((r->psgbe != NULL || r->scan != NULL) &&
+        psg_wav_close(&r->wav) == 0) {
+        perror(wavname);
+        status = EXIT_FAILURE;
+    }
+
+    if (r->log != NULL && r->log != stdout) {
+        if (fclose(r->log) != 0) {
+            perror(logname);
+            status = EXIT_FAILURE;
+        }
+    } else if (r->log != NULL) {
+        fflush(r->log);
+    }
+    r->log = NULL;
+
+    double elapsed = (double)(t1 - t0) / 1e9;
+    double song_sec = (double)drv->tick_count * TICK_NS / 1e9;
+    fprintf(stderr, "%s: %u ticks (%.1f s), %llu writes, %.3f s elapsed",
+        ifname, drv->tick_count, song_sec,
+        (unsigned long long)r->nwrites, elapsed);
+    if (elapsed > 0.0) {
+        fprintf(stderr, ", %.0f ticks/s (x%.0f realtime)",
+            drv->tick_count / elapsed, song_sec / elapsed);
+    }
+    fprintf(stderr, "\n");
+    if (r->psgbe != NULL || r->scan != NULL) {
+        fprintf(stderr, "%s: %llu samples (%u Hz)\n", wavname,
+            (unsigned long long)r->samples, rate);
+    }
+
+ out:
+    if (r->wav.fp != NULL)
+        (void)psg_wav_close(&r->wav);
+    if (backend_enabled)
+        (*r->psgbe->ops->disable)(r->psgbe);
+    if (backend_inited)
+        (*r->psgbe->ops->fini)(r->psgbe);
+    if (r->log != NULL && r->log != stdout)
+        (void)fclose(r->log);
+    free(r->scan);
+    p6psg_destroy(p6psg);
+    exit(status);
+}
@@ -0,0 +1,100 @@
+/*
+ * psg_seek.c
+ *  PSGDriver スナップショットによるシーク
+ *
+ *  PSGDriver はポインタ以外ただの値の集まりなので、構造体コピーで
+ *  そのままスナップショットになる (レジスタシャドウも含む)。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "psg_seek.h"
+
+/* インデックス作成 */
+int
+psg_seek_build(PSGSeekIndex *idx, const PSGDriver *start,
+               uint32_t interval, uint32_t max_ticks)
+{
+    PSGDriver drv;
+
+    memset(idx, 0, sizeof(*idx));
+    if (interval == 0)
+        interval = PSG_SEEK_INTERVAL_DEFAULT;
+    idx->interval = interval;
+
+    uint32_t nsnap = max_ticks / interval + 1;
+    idx->snap = malloc(sizeof(PSGDriver) * nsnap);
+    if (idx->snap == NULL)
+        return 0;
+
+    /* 事前実行はコールバックなし、シャドウ更新のみ */
+    drv = *start;
+    drv.write_reg  = NULL;
+    drv.write_regs = NULL;
+    drv.note_event = NULL;
+    drv.opaque     = NULL;
+    psg_driver_set_mute(&drv, 1);
+
+    uint32_t t0 = drv.tick_count;
+    for (;;) {
+        uint32_t elapsed = drv.tick_count - t0;
+        if (elapsed % interval == 0 && idx->count < nsnap)
+            idx->snap[idx->count++] = drv;
+        if (elapsed >= max_ticks || !psg_driver_is_active(&drv))
+            break;
+        /* 次のスナップショット位置まで */
+        uint32_t n = interval - elapsed % interval;
+        if (n > max_ticks - elapsed)
+            n = max_ticks - elapsed;
+        psg_driver_advance(&drv, n);
+    }
+    idx->end_tick = drv.tick_count;
+
+    return 1;
+}
+
+/* インデックス破棄 */
+void
+psg_seek_free(PSGSeekIndex *idx)
+{
+    free(idx->snap);
+    memset(idx, 0, sizeof(*idx));
+}
+
+/* シーク */
+uint32_t
+psg_seek(const PSGSeekIndex *idx, PSGDriver *drv, uint32_t tick)
+{
+    if (idx->count == 0)
+        return drv->tick_count;
+
+    uint32_t t0 = idx->snap[0].tick_count;
+    uint32_t i = (tick < t0) ? 0 : (tick - t0) / idx->interval;
+    if (i >= idx->count)
+        i = idx->count - 1;
+
+    /* コールバックは現在のものを引き継ぐ */
+    PSGWriteRegFn  write_reg  = drv->write_reg;
+    PSGWriteRegsFn write_regs = drv->write_regs;
+    PSGNoteEventFn note_event = drv->note_event;
+    void          *opaque     = drv->opaque;
+    uint8_t        mute       = drv->mute;
+
+    *drv = idx->snap[i];
+    drv->write_reg  = write_reg;
+    drv->write_regs = write_regs;
+    drv->note_event = note_event;
+    drv->opaque     = opaque;
+
+    /* 残りは出力なしで早送り */
+    psg_driver_set_mute(drv, 1);
+    if (drv->tick_count < tick)
+        psg_driver_advance(drv, tick - drv->tick_count);
+    psg_driver_set_mute(drv, mute);
+
+    /* チップ側の状態は不明なので全レジスタを書き直す */
+    psg_driver_sync_regs(drv);
+
+    return drv->tick_count;
+}
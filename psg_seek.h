@@ -0,0 +1,52 @@
+/*
+ * psg_seek.h
+ *  PSGDriver スナップショットによるシーク用インデックス定義
+ */
+
+#ifndef PSG_SEEK_H
+#define PSG_SEEK_H
+
+#include <stdint.h>
+
+#include "psg_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* デフォルトのスナップショット間隔 (500 tick = 1秒) */
+#define PSG_SEEK_INTERVAL_DEFAULT   500u
+
+typedef struct PSGSeekIndex {
+    uint32_t   interval;            /* スナップショット間隔 (tick) */
+    uint32_t   count;               /* スナップショット数 */
+    uint32_t   end_tick;            /* 事前実行した tick 数 */
+    PSGDriver *snap;                /* snap[i]: tick = i * interval の状態 */
+} PSGSeekIndex;
+
+/*
+ * インデックス作成
+ *  start (psg_driver_start() 直後の状態) から max_ticks まで、または
+ *  全チャンネル終了までヘッドレスで事前実行して interval 毎に保存する。
+ *  成功で 1、メモリ不足で 0 を返す。
+ */
+int psg_seek_build(PSGSeekIndex *idx, const PSGDriver *start,
+                   uint32_t interval, uint32_t max_ticks);
+
+/* インデックス破棄 */
+void psg_seek_free(PSGSeekIndex *idx);
+
+/*
+ * シーク
+ *  tick 以前で最も近いスナップショットを drv に復元し (コールバックは
+ *  drv のものを維持)、残りを出力なしで早送りしてから
+ *  レジスタ状態をまとめて書き出す。
+ *  戻り値はシーク後の tick 位置 (曲が先に終わっていればそれ以前になる)。
+ */
+uint32_t psg_seek(const PSGSeekIndex *idx, PSGDriver *drv, uint32_t tick);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PSG_SEEK_H */
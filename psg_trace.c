@@ -0,0 +1,390 @@
+/*
+ * psg_trace.c
+ *  Register write trace checker for p6psg data
+ *
+ *  Plays each given song headlessly for a fixed number of ticks,
+ *  records the (tick, reg, val) stream from the driver callback and
+ *  compares it with a golden trace stored as <goldendir>/<song>.trace.
+ *  Golden traces use the same text format as psg_render -o, so either
+ *  tool can produce them.  Writes that leave a register unchanged do
+ *  nothing on the chip (except R13, which restarts the envelope) and are
+ *  dropped from both sides before comparing, so goldens taken from the
+ *  original driver, which still issues them, stay valid.  Wall time
+ *  per song is reported as well so that interpreter changes can be
+ *  checked for both output identity and speed.  With -r each song must
+ *  instead fail the load-time verification (fixtures the driver would
+ *  hang or run away on).
+ */
+
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "psg_compat.h"
+#include "p6psg.h"
+#include "psg_driver.h"
+#include "ym2149f.h"
+
+/* driver tick period (see psg_play.c) */
+#define TICK_NS         2000000ull
+
+/* default trace length: 3 minutes */
+#define DEFAULT_TICKS   (3u * 60u * 500u)
+
+typedef struct trace_ent {
+    uint32_t tick;
+    uint8_t reg;
+    uint8_t val;
+} trace_ent_t;
+
+typedef struct trace {
+    trace_ent_t *ent;
+    size_t len;
+    size_t cap;
+    int nomem;
+    uint32_t ticks;             /* ticks played */
+    const PSGDriver *drv;
+} trace_t;
+
+/* --- timing helpers --- */
+static inline uint64_t
+nsec_now_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int
+trace_append(trace_t *t, uint32_t tick, uint8_t reg, uint8_t val)
+{
+    if (t->len == t->cap) {
+        size_t ncap = (t->cap != 0) ? t->cap * 2 : 4096;
+        trace_ent_t *p = realloc(t->ent, ncap * sizeof(*p));
+        if (p == NULL) {
+            t->nomem = 1;
+            return 0;
+        }
+        t->ent = p;
+        t->cap = ncap;
+    }
+    t->ent[t->len].tick = tick;
+    t->ent[t->len].reg = reg;
+    t->ent[t->len].val = val;
+    t->len++;
+    return 1;
+}
+
+static void
+trace_free(trace_t *t)
+{
+    free(t->ent);
+    memset(t, 0, sizeof(*t));
+}
+
+static void
+trace_write_reg_cb(void *opaque, uint8_t reg, uint8_t val)
+{
+    trace_t *t = opaque;
+
+    (void)trace_append(t, t->drv->tick_count, reg, val);
+}
+
+/* drop the writes that leave a register unchanged (R13 always counts) */
+static void
+trace_squash(trace_t *t)
+{
+    uint8_t reg[PSG_REG_COUNT];
+    uint16_t valid = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < t->len; i++) {
+        const trace_ent_t *e = &t->ent[i];
+        uint16_t bit = (uint16_t)(1u << e->reg);
+
+        if ((valid & bit) != 0 && reg[e->reg] == e->val &&
+            e->reg != AY_ESHAPE)
+            continue;
+        reg[e->reg] = e->val;
+        valid |= bit;
+        t->ent[n++] = *e;
+    }
+    t->len = n;
+}
+
+/* read a psg_render style log ("tick msec reg val", '#' comments) */
+static int
+trace_read(trace_t *t, const char *path)
+{
+    FILE *fp;
+    char line[128];
+    unsigned int tick, msec, reg, val;
+    unsigned int lineno = 0;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%u %u %u %x", &tick, &msec, &reg, &val) != 4 ||
+            reg >= PSG_REG_COUNT || val > 0xff) {
+            fprintf(stderr, "%s:%u: malformed line\n", path, lineno);
+            fclose(fp);
+            errno = EINVAL;
+            return 0;
+        }
+        if (trace_append(t, tick, (uint8_t)reg, (uint8_t)val) == 0) {
+            fclose(fp);
+            errno = ENOMEM;
+            return 0;
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+static int
+trace_write(const trace_t *t, const char *path)
+{
+    FILE *fp;
+
+    fp = fopen(path, "w");
+    if (fp == NULL)
+        return 0;
+    fprintf(fp, "# tick msec reg val\n");
+    for (size_t i = 0; i < t->len; i++) {
+        const trace_ent_t *e = &t->ent[i];
+        fprintf(fp, "%u %u %u %02x\n", e->tick,
+            (unsigned int)(e->tick * (TICK_NS / 1000000ull)), e->reg, e->val);
+    }
+    return fclose(fp) == 0;
+}
+
+/* play one song into t; returns elapsed ns of the tick loop, 0 on error */
+static uint64_t
+trace_play(trace_t *t, const char *song, uint32_t max_ticks)
+{
+    p6psg_t *p6psg;
+    p6psg_channel_dataset_t channels;
+    PSGDriver drv;
+    uint64_t elapsed = 0;
+
+    p6psg = p6psg_create();
+    if (p6psg == NULL) {
+        fprintf(stderr, "p6psg: out of memory\n");
+        return 0;
+    }
+    if (p6psg_load(p6psg, song, &channels) == 0) {
+        fprintf(stderr, "%s: %s\n", song, p6psg_last_error(p6psg));
+        goto out;
+    }
+
+    t->drv = &drv;
+    psg_driver_init(&drv, trace_write_reg_cb, NULL, t);
+    for (int i = 0; i < P6PSG_CH_COUNT; i++)
+        psg_driver_set_channel_data(&drv, i, channels.ch[i].ptr);
+    psg_driver_start(&drv);
+
+    uint64_t t0 = nsec_now_monotonic();
+    while (drv.tick_count < max_ticks && psg_driver_is_active(&drv))
+        psg_driver_tick(&drv);
+    uint64_t t1 = nsec_now_monotonic();
+    t->ticks = drv.tick_count;
+    psg_driver_stop(&drv);
+
+    if (t->nomem) {
+        fprintf(stderr, "%s: trace: out of memory\n", song);
+        goto out;
+    }
+    elapsed = (t1 > t0) ? t1 - t0 : 1;
+
+ out:
+    p6psg_destroy(p6psg);
+    return elapsed;
+}
+
+/* load a song that the verifier must refuse; returns 1 if refused */
+static int
+trace_reject(const char *song)
+{
+    p6psg_t *p6psg;
+    p6psg_channel_dataset_t channels;
+    int refused;
+
+    p6psg = p6psg_create();
+    if (p6psg == NULL) {
+        fprintf(stderr, "p6psg: out of memory\n");
+        return 0;
+    }
+    refused = (p6psg_load(p6psg, song, &channels) == 0);
+    if (refused)
+        printf("ok      %s: rejected (%s)\n", song, p6psg_last_error(p6psg));
+    else
+        printf("FAIL    %s: accepted\n", song);
+    p6psg_destroy(p6psg);
+    return refused;
+}
+
+/*
+ * compare the writes that change the chip and describe the first
+ * difference; returns 1 if identical
+ */
+static int
+trace_compare(const char *song, trace_t *got, trace_t *want)
+{
+    trace_squash(got);
+    trace_squash(want);
+
+    size_t n = (got->len < want->len) ? got->len : want->len;
+
+    for (size_t i = 0; i < n; i++) {
+        const trace_ent_t *g = &got->ent[i];
+        const trace_ent_t *w = &want->ent[i];
+
+        if (g->tick != w->tick || g->reg != w->reg || g->val != w->val) {
+            fprintf(stderr, "%s: write #%zu differs: "
+                "got tick %u R%u=%02x, want tick %u R%u=%02x\n",
+                song, i, g->tick, g->reg, g->val, w->tick, w->reg, w->val);
+            return 0;
+        }
+    }
+    if (got->len != want->len) {
+        fprintf(stderr, "%s: %zu writes, golden has %zu\n",
+            song, got->len, want->len);
+        return 0;
+    }
+    return 1;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "Usage: %s [-u] [-n ticks] [-T ns_per_tick] -g goldendir\n"
+        "       p6psgfile ...\n"
+        "       %s -r p6psgfile ...\n",
+        getprogname(), getprogname());
+
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *goldendir = NULL;
+    uint32_t max_ticks = DEFAULT_TICKS;
+    double max_ns_tick = 0.0;
+    int update = 0;
+    int reject = 0;
+    unsigned int nfail = 0;
+    char *ep;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "g:n:rT:u")) != -1) {
+        switch (ch) {
+        case 'g':
+            goldendir = optarg;
+            break;
+        case 'n':
+            max_ticks = (uint32_t)strtoul(optarg, &ep, 0);
+            if (*optarg == '\0' || *ep != '\0')
+                usage();
+            break;
+        case 'r':
+            reject = 1;
+            break;
+        case 'T':
+            max_ns_tick = strtod(optarg, &ep);
+            if (*optarg == '\0' || *ep != '\0' || max_ns_tick < 0.0)
+                usage();
+            break;
+        case 'u':
+            update = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1 || (goldendir == NULL && !reject))
+        usage();
+
+    if (reject) {
+        for (int i = 0; i < argc; i++) {
+            if (trace_reject(argv[i]) == 0)
+                nfail++;
+        }
+        if (nfail != 0)
+            printf("%u of %d songs accepted\n", nfail, argc);
+        exit((nfail != 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    for (int i = 0; i < argc; i++) {
+        const char *song = argv[i];
+        char namebuf[1024], path[1024];
+        trace_t got, want;
+        const char *result;
+        int ok = 1;
+
+        memset(&got, 0, sizeof(got));
+        memset(&want, 0, sizeof(want));
+
+        /* basename(3) may modify its argument */
+        snprintf(namebuf, sizeof(namebuf), "%s", song);
+        snprintf(path, sizeof(path), "%s/%s.trace",
+            goldendir, basename(namebuf));
+
+        uint64_t ns = trace_play(&got, song, max_ticks);
+        if (ns == 0) {
+            result = "ERROR";
+            ok = 0;
+        } else if (update) {
+            if (trace_write(&got, path)) {
+                result = "UPDATED";
+            } else {
+                perror(path);
+                result = "ERROR";
+                ok = 0;
+            }
+        } else if (trace_read(&want, path) == 0) {
+            perror(path);
+            result = "ERROR";
+            ok = 0;
+        } else if (trace_squash(&got), trace_squash(&want),
+            trace_compare(song, &got, &want) == 0) {
+            result = "FAIL";
+            ok = 0;
+        } else {
+            result = "ok";
+        }
+
+        double ns_tick = (got.ticks != 0) ? (double)ns / got.ticks : 0.0;
+        if (ok && max_ns_tick > 0.0 && ns_tick > max_ns_tick) {
+            fprintf(stderr, "%s: %.2f ns/tick exceeds %.2f\n",
+                song, ns_tick, max_ns_tick);
+            result = "SLOW";
+            ok = 0;
+        }
+
+        printf("%-7s %s: %zu writes, %.3f ms, %.2f ns/tick\n",
+            result, song, got.len, (double)ns / 1e6, ns_tick);
+        if (!ok)
+            nfail++;
+
+        trace_free(&got);
+        trace_free(&want);
+    }
+
+    if (nfail != 0)
+        printf("%u of %d songs failed\n", nfail, argc);
+    exit((nfail != 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
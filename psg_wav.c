@@ -0,0 +1,137 @@
+/*
+ * psg_wav.c
+ *  Minimal 16-bit PCM WAV writer
+ *
+ *  Data is always written little-endian regardless of the host.  When
+ *  the output is not seekable (a pipe) the RIFF/data sizes are left at
+ *  0xffffffff, which most players read as "until EOF".
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "psg_wav.h"
+
+#define WAV_HEADER_SIZE 44
+
+static void
+put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void
+put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void
+wav_header(uint8_t *h, uint32_t rate, uint16_t channels, uint32_t data_bytes)
+{
+    uint32_t riff_bytes = (data_bytes == UINT32_MAX) ?
+        UINT32_MAX : data_bytes + WAV_HEADER_SIZE - 8;
+
+    memcpy(h + 0, "RIFF", 4);
+    put_le32(h + 4, riff_bytes);
+    memcpy(h + 8, "WAVE", 4);
+    memcpy(h + 12, "fmt ", 4);
+    put_le32(h + 16, 16);                       /* fmt chunk size */
+    put_le16(h + 20, 1);                        /* PCM */
+    put_le16(h + 22, channels);
+    put_le32(h + 24, rate);
+    put_le32(h + 28, rate * channels * 2);      /* bytes per second */
+    put_le16(h + 32, (uint16_t)(channels * 2)); /* block align */
+    put_le16(h + 34, 16);                       /* bits per sample */
+    memcpy(h + 36, "data", 4);
+    put_le32(h + 40, data_bytes);
+}
+
+int
+psg_wav_open(psg_wav_t *wav, const char *path, uint32_t rate,
+    uint16_t channels)
+{
+    FILE *fp;
+
+    memset(wav, 0, sizeof(*wav));
+    fp = (strcmp(path, "-") == 0) ? stdout : fopen(path, "wb");
+    if (fp == NULL)
+        return 0;
+    return psg_wav_open_fp(wav, fp, rate, channels);
+}
+
+int
+psg_wav_open_fp(psg_wav_t *wav, FILE *fp, uint32_t rate, uint16_t channels)
+{
+    uint8_t h[WAV_HEADER_SIZE];
+
+    memset(wav, 0, sizeof(*wav));
+    wav->fp = fp;
+    wav->rate = rate;
+    wav->channels = channels;
+
+    wav_header(h, rate, channels, UINT32_MAX);
+    if (fwrite(h, sizeof(h), 1, wav->fp) != 1) {
+        /* keep the fwrite() errno for the caller's message */
+        int error = errno;
+        if (wav->fp != stdout)
+            fclose(wav->fp);
+        wav->fp = NULL;
+        errno = error;
+        return 0;
+    }
+    return 1;
+}
+
+int
+psg_wav_write(psg_wav_t *wav, const int16_t *pcm, size_t frames)
+{
+    uint8_t buf[4096];
+    size_t n = frames * wav->channels;
+
+    while (n > 0) {
+        size_t chunk = n;
+        if (chunk > sizeof(buf) / 2)
+            chunk = sizeof(buf) / 2;
+        for (size_t i = 0; i < chunk; i++)
+            put_le16(buf + i * 2, (uint16_t)pcm[i]);
+        if (fwrite(buf, 2, chunk, wav->fp) != chunk)
+            return 0;
+        pcm += chunk;
+        n -= chunk;
+    }
+    wav->frames += frames;
+    return 1;
+}
+
+int
+psg_wav_close(psg_wav_t *wav)
+{
+    uint8_t h[WAV_HEADER_SIZE];
+    int ok = 1;
+
+    if (wav->fp == NULL)
+        return 0;
+
+    uint64_t bytes = wav->frames * wav->channels * 2;
+    if (bytes <= UINT32_MAX - WAV_HEADER_SIZE &&
+        fseek(wav->fp, 0, SEEK_SET) == 0) {
+        wav_header(h, wav->rate, wav->channels, (uint32_t)bytes);
+        if (fwrite(h, sizeof(h), 1, wav->fp) != 1)
+            ok = 0;
+    }
+
+    if (wav->fp == stdout) {
+        if (fflush(stdout) != 0)
+            ok = 0;
+    } else if (fclose(wav->fp) != 0) {
+        ok = 0;
+    }
+    wav->fp = NULL;
+    return ok;
+}
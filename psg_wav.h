@@ -0,0 +1,31 @@
+/* psg_wav.h - minimal 16-bit PCM WAV writer */
+
+#ifndef PSG_WAV_H
+#define PSG_WAV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct psg_wav {
+    FILE *fp;
+    uint32_t rate;
+    uint16_t channels;
+    uint64_t frames;            /* frames written so far */
+} psg_wav_t;
+
+/* open path ("-": stdout) and write a header; returns 1 on success */
+int psg_wav_open(psg_wav_t *wav, const char *path, uint32_t rate,
+    uint16_t channels);
+
+/* same on an already open stream, which psg_wav_close() closes */
+int psg_wav_open_fp(psg_wav_t *wav, FILE *fp, uint32_t rate,
+    uint16_t channels);
+
+/* append interleaved frames */
+int psg_wav_write(psg_wav_t *wav, const int16_t *pcm, size_t frames);
+
+/* fix up the header sizes (if seekable) and close */
+int psg_wav_close(psg_wav_t *wav);
+
+#endif /* PSG_WAV_H */
@@ -0,0 +1,211 @@
+/*
+ * psg_writer.c
+ *  Backend writes on a dedicated thread
+ *
+ *  Ring entries are single register writes; the writer takes the run
+ *  of entries that share a time as one batch, sleeps until that time
+ *  (absolute CLOCK_MONOTONIC) and hands the batch to the backend.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE             /* cpu_set_t, pthread_setaffinity_np() */
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "psg_backend.h"
+#include "psg_driver.h"
+#include "psg_writer.h"
+
+#define WRITER_RING_MASK    (PSG_WRITER_RING_SIZE - 1)
+#define WRITER_RETRY_NS     100000ull   /* ring full: retry interval */
+
+/* --- timing helpers --- */
+static inline uint64_t
+nsec_now_monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void
+sleep_until_ns(uint64_t t)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(t / 1000000000ull);
+    ts.tv_nsec = (long)(t % 1000000000ull);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        continue;
+}
+
+/* ---- writer thread ---- */
+
+static void *
+writer_thread(void *arg)
+{
+    psg_writer_t *w = arg;
+    psg_writer_stats_t *st = &w->st;
+    psg_regval_t rv[PSG_WRITE_BATCH_MAX];
+
+    for (;;) {
+        /* once stopped, the rest of the ring goes out without waiting */
+        int running = atomic_load_explicit(&w->running, memory_order_acquire);
+        uint32_t tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&w->head, memory_order_acquire);
+        if (tail == head) {
+            if (!running)
+                break;
+            sleep_until_ns(nsec_now_monotonic() + PSG_WRITER_IDLE_NS);
+            continue;
+        }
+
+        uint64_t t = w->ring[tail & WRITER_RING_MASK].t_ns;
+        uint64_t now = nsec_now_monotonic();
+        if (t > now && running) {
+            sleep_until_ns(t);
+            continue;
+        }
+
+        /* entries of the same time make one batch */
+        size_t n = 0;
+        while (tail != head && n < PSG_WRITE_BATCH_MAX) {
+            const psg_writer_ent_t *e = &w->ring[tail & WRITER_RING_MASK];
+            if (e->t_ns != t)
+                break;
+            rv[n].reg = e->reg;
+            rv[n].val = e->val;
+            n++;
+            tail++;
+        }
+        atomic_store_explicit(&w->tail, tail, memory_order_release);
+
+        if (psg_backend_write_regs(w->psgbe, rv, n) == 0)
+            st->errors++;
+
+        uint64_t lag = (t != 0 && now > t) ? now - t : 0;
+        st->batches++;
+        st->writes += n;
+        st->lag_sum_ns += lag;
+        if (lag > st->lag_max_ns)
+            st->lag_max_ns = lag;
+        if (lag > PSG_WRITER_LATE_NS)
+            st->late++;
+    }
+    return NULL;
+}
+
+static int
+writer_pin(psg_writer_t *w, int cpu)
+{
+    int error;
+
+#if defined(__linux__)
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    error = pthread_setaffinity_np(w->thread, sizeof(set), &set);
+#elif defined(__NetBSD__)
+    cpuset_t *set = cpuset_create();
+
+    if (set == NULL)
+        return ENOMEM;
+    cpuset_zero(set);
+    error = (cpuset_set((cpuid_t)cpu, set) == -1) ? EINVAL :
+        pthread_setaffinity_np(w->thread, cpuset_size(set), set);
+    cpuset_destroy(set);
+#else
+    (void)w;
+    (void)cpu;
+    error = EOPNOTSUPP;
+#endif
+    return error;
+}
+
+/* ---- API ---- */
+
+int
+psg_writer_start(psg_writer_t *w, psg_backend_t *psgbe, int cpu)
+{
+    memset(&w->st, 0, sizeof(w->st));
+    w->error[0] = '\0';
+    w->psgbe = psgbe;
+    w->ring_full = 0;
+    w->ring_max = 0;
+    atomic_init(&w->head, 0);
+    atomic_init(&w->tail, 0);
+    atomic_init(&w->running, 1);
+
+    int error = pthread_create(&w->thread, NULL, writer_thread, w);
+    if (error != 0) {
+        atomic_store(&w->running, 0);
+        snprintf(w->error, sizeof(w->error), "pthread_create: %s",
+            strerror(error));
+        return 0;
+    }
+    if (cpu >= 0 && (error = writer_pin(w, cpu)) != 0) {
+        psg_writer_stop(w);
+        snprintf(w->error, sizeof(w->error), "cannot pin to CPU %d: %s",
+            cpu, strerror(error));
+        return 0;
+    }
+    return 1;
+}
+
+int
+psg_writer_push(psg_writer_t *w, uint64_t t_ns, const psg_regval_t *rv,
+    size_t n)
+{
+    uint32_t head = atomic_load_explicit(&w->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+
+    if (head - tail > PSG_WRITER_RING_SIZE - n) {
+        /* writer stalled; wait rather than lose writes */
+        w->ring_full++;
+        do {
+            if (!atomic_load_explicit(&w->running, memory_order_relaxed))
+                return 0;
+            sleep_until_ns(nsec_now_monotonic() + WRITER_RETRY_NS);
+            tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+        } while (head - tail > PSG_WRITER_RING_SIZE - n);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        psg_writer_ent_t *e = &w->ring[(head + i) & WRITER_RING_MASK];
+        e->t_ns = t_ns;
+        e->reg = rv[i].reg;
+        e->val = rv[i].val;
+    }
+    head += (uint32_t)n;
+    atomic_store_explicit(&w->head, head, memory_order_release);
+
+    if (head - tail > w->ring_max)
+        w->ring_max = head - tail;
+    return 1;
+}
+
+void
+psg_writer_stop(psg_writer_t *w)
+{
+    if (!atomic_exchange(&w->running, 0))
+        return;
+    pthread_join(w->thread, NULL);
+}
+
+void
+psg_writer_stats(const psg_writer_t *w, psg_writer_stats_t *st)
+{
+    *st = w->st;
+    st->ring_full = w->ring_full;
+    st->ring_size = PSG_WRITER_RING_SIZE;
+    st->ring_max = w->ring_max;
+}
@@ -0,0 +1,91 @@
+/*
+ * psg_writer.h
+ *  Backend writes on a dedicated thread
+ *
+ *  The driver thread pushes timestamped register writes into a
+ *  single-producer single-consumer ring and a writer thread hands them
+ *  to the backend when their time comes, so that interpreter and UI
+ *  time do not add to the bus timing.  The writer thread may be
+ *  pinned to a CPU.
+ */
+
+#ifndef PSG_WRITER_H
+#define PSG_WRITER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "psg_backend.h"
+
+#define PSG_WRITER_RING_SIZE    4096u       /* entries, power of 2 */
+
+/* the writer polls an empty ring this often; push earlier than that */
+#define PSG_WRITER_IDLE_NS      500000ull
+
+/* a batch written later than this after its time counts as late */
+#define PSG_WRITER_LATE_NS      100000ull
+
+typedef struct {
+    uint64_t t_ns;              /* CLOCK_MONOTONIC time to write at */
+    uint8_t reg;
+    uint8_t val;
+} psg_writer_ent_t;
+
+typedef struct {
+    uint64_t batches;           /* backend calls */
+    uint64_t writes;
+    uint64_t late;              /* batches later than PSG_WRITER_LATE_NS */
+    uint64_t lag_sum_ns;        /* time to backend call, summed per batch */
+    uint64_t lag_max_ns;
+    uint64_t errors;            /* failed backend calls */
+    uint64_t ring_full;         /* pushes that waited for ring space */
+    uint32_t ring_size;
+    uint32_t ring_max;          /* highest ring fill (entries) */
+} psg_writer_stats_t;
+
+typedef struct psg_writer {
+    /* SPSC ring; head is written by the producer, tail by the writer */
+    psg_writer_ent_t ring[PSG_WRITER_RING_SIZE];
+    _Alignas(64) _Atomic uint32_t head;
+    _Alignas(64) _Atomic uint32_t tail;
+
+    /* producer side */
+    _Alignas(64) uint64_t ring_full;
+    uint32_t ring_max;
+
+    /* writer side */
+    _Alignas(64) psg_writer_stats_t st;
+    psg_backend_t *psgbe;
+    pthread_t thread;
+    _Atomic int running;
+
+    char error[128];            /* why start failed */
+} psg_writer_t;
+
+/*
+ * Start the writer thread for an enabled backend; cpu >= 0 pins it.
+ * From then on only the writer thread may call the backend until
+ * psg_writer_stop().  Returns 0 with w->error set on failure.
+ */
+int psg_writer_start(psg_writer_t *w, psg_backend_t *psgbe, int cpu);
+
+/*
+ * Queue one batch to be written at t_ns (CLOCK_MONOTONIC; 0 or a past
+ * time: as soon as possible).  Waits while the ring is full; 0 if the
+ * writer is not running.
+ */
+int psg_writer_push(psg_writer_t *w, uint64_t t_ns,
+    const psg_regval_t *rv, size_t n);
+
+/*
+ * Stop the thread once the ring is empty; writes queued for later are
+ * made right away, so a final mute queued behind them still goes out.
+ */
+void psg_writer_stop(psg_writer_t *w);
+
+/* statistics; exact once stopped */
+void psg_writer_stats(const psg_writer_t *w, psg_writer_stats_t *st);
+
+#endif /* PSG_WRITER_H */
@@ -0,0 +1,125 @@
+/*
+ * jitter_test.c
+ *  Tickless catch-up accounting (psg_play -e -J)
+ *
+ *  Feeds a wake that comes late across an idle run: the due ticks are
+ *  the idle ones plus a few that run.  Lateness must be taken against
+ *  the first tick that actually runs, not against the last due one, and
+ *  only the ticks that run may be counted.
+ *
+ *  Usage: jitter_test p6psgfile
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "p6psg.h"
+#include "psg_driver.h"
+#include "psg_jitter.h"
+
+#define TICK_NS     2000000ull
+#define LATE_NS     500000ull   /* wake after the last due tick */
+#define IDLE_MIN    3u          /* idle run to look for */
+#define RUN_TICKS   3u          /* due ticks after the idle run */
+#define SEARCH_MAX  100000u
+
+typedef struct {
+    psg_jitter_t *j;
+    uint64_t deadline;          /* first due tick */
+    uint64_t now;               /* the (late) wake */
+    uint32_t ran;
+    uint32_t first;             /* index of the first tick run */
+} run_t;
+
+static void
+write_reg_cb(void *opaque, uint8_t reg, uint8_t val)
+{
+    (void)opaque;
+    (void)reg;
+    (void)val;
+}
+
+static void
+tick_cb(void *opaque, uint32_t i)
+{
+    run_t *r = opaque;
+
+    psg_jitter_tick(r->j, r->deadline + (uint64_t)i * TICK_NS, r->now);
+    if (r->ran++ == 0)
+        r->first = i;
+}
+
+int
+main(int argc, char *argv[])
+{
+    p6psg_t *p6psg;
+    p6psg_channel_dataset_t channels;
+    PSGDriver drv;
+    psg_jitter_t j;
+    int ok = 1;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: jitter_test p6psgfile\n");
+        return EXIT_FAILURE;
+    }
+    p6psg = p6psg_create();
+    if (p6psg == NULL || p6psg_load(p6psg, argv[1], &channels) == 0) {
+        fprintf(stderr, "%s: %s\n", argv[1],
+            (p6psg != NULL) ? p6psg_last_error(p6psg) : "out of memory");
+        return EXIT_FAILURE;
+    }
+    psg_driver_init(&drv, write_reg_cb, NULL, NULL);
+    for (int i = 0; i < P6PSG_CH_COUNT; i++)
+        psg_driver_set_channel_data(&drv, i, channels.ch[i].ptr);
+    psg_driver_start(&drv);
+
+    /* a point where the next few ticks do nothing */
+    uint32_t idle = psg_driver_ticks_to_event(&drv);
+    while (idle < IDLE_MIN && drv.tick_count < SEARCH_MAX) {
+        psg_driver_tick(&drv);
+        idle = psg_driver_ticks_to_event(&drv);
+    }
+    if (idle < IDLE_MIN || idle == UINT32_MAX) {
+        fprintf(stderr, "%s: no idle run of %u ticks\n", argv[1], IDLE_MIN);
+        return EXIT_FAILURE;
+    }
+
+    if (psg_jitter_open(&j, NULL, 0, TICK_NS) == 0) {
+        fprintf(stderr, "jitter: %s\n", j.error);
+        return EXIT_FAILURE;
+    }
+    uint32_t due = idle + RUN_TICKS;
+    run_t r = { &j, 1000 * TICK_NS, 0, 0, 0 };
+    r.now = r.deadline + (uint64_t)(due - 1) * TICK_NS + LATE_NS;
+    psg_driver_advance_cb(&drv, due, tick_cb, &r);
+    uint64_t first = r.deadline + (uint64_t)r.first * TICK_NS;
+    if (r.ran > 0)
+        psg_jitter_wake(&j, first, r.now, r.ran, 0, 0, 0);
+
+    uint64_t want = r.now - (r.deadline + (uint64_t)idle * TICK_NS);
+    if (r.ran == 0 || r.ran > RUN_TICKS || r.first != idle) {
+        fprintf(stderr, "ticks run: %u from %u, want 1..%u from %u\n",
+            r.ran, r.first, RUN_TICKS, idle);
+        ok = 0;
+    }
+    if (j.late.count != r.ran || j.late.max_ns != want) {
+        fprintf(stderr, "lateness: %llu ticks, max %llu ns, want %u, %llu\n",
+            (unsigned long long)j.late.count,
+            (unsigned long long)j.late.max_ns, r.ran,
+            (unsigned long long)want);
+        ok = 0;
+    }
+    if (j.wakes != 1 || j.worst.late_ns != want || j.worst.due != r.ran) {
+        fprintf(stderr, "wake: %llu, late %u ns, due %u\n",
+            (unsigned long long)j.wakes, j.worst.late_ns, j.worst.due);
+        ok = 0;
+    }
+    psg_jitter_close(&j);
+    p6psg_destroy(p6psg);
+
+    printf("%s\t%s: late wake across %u idle ticks, %u run, %llu ns late\n",
+        ok ? "ok" : "FAIL", argv[1], idle, r.ran,
+        (unsigned long long)want);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}